@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "kwrlib.h"
+#include "kwrmaze.h"
+
+// Benchmark suite.  Each benchmark runs once per grid size (size x size
+// cells): one warm-up repetition, then repetitions until both a minimum
+// count and a time budget are reached.  Results go to stdout as CSV, one
+// line per benchmark and size, with median and p99 repetition times from
+// Kwr_ClockNow.
+//
+// usage: bench [-sizes 10,100,1000,10000] [-filter name] [-reps n]
+//              [-budget seconds] [-memory MB]
+//
+// Sizes whose estimated memory exceeds -memory are skipped.
+
+// Benchmarks time their own measured part and return it in nanoseconds,
+// leaving setup and teardown out
+typedef uint64_t (*Bench_Fn)(int size);
+
+static volatile uint32_t bench_sink;   // keeps results observable
+
+
+//------------------------------------------------------------
+//# Grids
+
+static uint64_t Bench_InitGrid(int size)
+{
+    Maze_Grid grid = { .num_rows = size, .num_columns = size };
+    uint64_t start = Kwr_ClockNow();
+    Maze_InitGrid(&grid);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_InitCompactGrid(int size)
+{
+    Maze_CompactGrid grid = { .num_rows = size, .num_columns = size };
+    uint64_t start = Kwr_ClockNow();
+    Maze_InitCompactGrid(&grid);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeCompactGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_GenerateWith(int size, ErrorCode (*generate)(Maze_CompactGrid *, uint64_t, int), int num_threads)
+{
+    Maze_CompactGrid grid = { .num_rows = size, .num_columns = size };
+    Maze_InitCompactGrid(&grid);
+    uint64_t start = Kwr_ClockNow();
+    generate(&grid, 12314, num_threads);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeCompactGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_BinaryTree(int size)          { return Bench_GenerateWith(size, Maze_BinaryTree, 1); }
+static uint64_t Bench_BinaryTreeParallel(int size)  { return Bench_GenerateWith(size, Maze_BinaryTree, 0); }
+static uint64_t Bench_Sidewinder(int size)          { return Bench_GenerateWith(size, Maze_Sidewinder, 1); }
+
+static uint64_t Bench_LinkCells(int size)
+{
+    Maze_Grid grid = { .num_rows = size, .num_columns = size };
+    Maze_InitGrid(&grid);
+    uint64_t start = Kwr_ClockNow();
+    for (int r = 0; r < size; ++r) {
+        for (int c = 0; c < size; ++c) {
+            Maze_Cell *cell = Maze_GridCellAt(&grid, r, c);
+            if (c < size-1)  Maze_LinkCells(cell, Maze_Dir_East, Maze_GoEast(&grid, cell));
+            else if (r > 0)  Maze_LinkCells(cell, Maze_Dir_North, Maze_GoNorth(&grid, cell));
+        }
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_UnlinkCells(int size)
+{
+    Maze_Grid grid = { .num_rows = size, .num_columns = size };
+    Maze_InitGrid(&grid);
+    for (int r = 0; r < size; ++r) {
+        for (int c = 0; c < size-1; ++c) {
+            Maze_Cell *cell = Maze_GridCellAt(&grid, r, c);
+            Maze_LinkCells(cell, Maze_Dir_East, Maze_GoEast(&grid, cell));
+        }
+    }
+    uint64_t start = Kwr_ClockNow();
+    for (int r = 0; r < size; ++r) {
+        for (int c = 0; c < size-1; ++c) {
+            Maze_Cell *cell = Maze_GridCellAt(&grid, r, c);
+            Maze_UnlinkCells(cell, cell->east);
+        }
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_CompactLinkCells(int size)
+{
+    Maze_CompactGrid grid = { .num_rows = size, .num_columns = size };
+    Maze_InitCompactGrid(&grid);
+    uint64_t start = Kwr_ClockNow();
+    for (int r = 0; r < size; ++r) {
+        for (int c = 0; c < size; ++c) {
+            if (c < size-1)  Maze_CompactLinkCells(&grid, r, c, Maze_Dir_East);
+            else if (r > 0)  Maze_CompactLinkCells(&grid, r, c, Maze_Dir_North);
+        }
+    }
+    for (int r = 0; r < size; ++r) {
+        for (int c = 0; c < size-1; ++c)  Maze_CompactUnlinkCells(&grid, r, c, Maze_Dir_East);
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    Maze_DisposeCompactGrid(&grid);
+    return elapsed;
+}
+
+
+//------------------------------------------------------------
+//# Grid Layouts
+//
+// Random walks and link-following BFS jump between rows, which is what
+// the tiled and Morton layouts of Maze_Grid are for.
+
+static Maze_Cell *Bench_Neighbor(Maze_Grid *grid, Maze_Cell *cell, Maze_Dir dir)
+{
+    switch (dir) {
+        case Maze_Dir_North:  return Maze_GoNorth(grid, cell);
+        case Maze_Dir_East:   return Maze_GoEast(grid, cell);
+        case Maze_Dir_West:   return Maze_GoWest(grid, cell);
+        default:              return Maze_GoSouth(grid, cell);
+    }
+}
+
+// Aldous-Broder walk of 4 steps per cell, linking newly visited cells.
+// Cells the walk missed are then joined to a neighbor.
+static uint64_t Bench_RandomWalk(Maze_Grid *grid, uint8_t *visited)
+{
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 12314);
+    memset(visited, 0, Maze_GridStorage(grid));
+
+    size_t steps = 4 * (size_t)grid->num_rows * grid->num_columns;
+    uint64_t start = Kwr_ClockNow();
+    Maze_Cell *at = Maze_GridCellAt(grid, 0, 0);
+    visited[at - grid->cells] = true;
+    uint64_t bits = 0;
+    for (size_t step = 0; step < steps; ++step) {
+        if (step % 32 == 0)  bits = Xoshiro256_Rand(&rng);
+        Maze_Dir dir = (Maze_Dir)(bits & 3);
+        bits >>= 2;
+
+        Maze_Cell *next = Bench_Neighbor(grid, at, dir);
+        if (!next)  continue;
+        if (!visited[next - grid->cells]) {
+            visited[next - grid->cells] = true;
+            Maze_LinkCells(at, dir, next);
+        }
+        at = next;
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    for (int r = 0; r < grid->num_rows; ++r) {
+        for (int c = 0; c < grid->num_columns; ++c) {
+            Maze_Cell *cell = Maze_GridCellAt(grid, r, c);
+            if (visited[cell - grid->cells] || (r == 0 && c == 0))  continue;
+            if (r > 0)  Maze_LinkCells(cell, Maze_Dir_North, Maze_GoNorth(grid, cell));
+            else        Maze_LinkCells(cell, Maze_Dir_West, Maze_GoWest(grid, cell));
+        }
+    }
+    return elapsed;
+}
+
+static uint64_t Bench_Search(Maze_Grid *grid, uint8_t *visited)
+{
+    Maze_Cell **queue = kalloc(NULL, (size_t)grid->num_rows * grid->num_columns * sizeof(Maze_Cell *));
+    memset(visited, 0, Maze_GridStorage(grid));
+
+    uint64_t start = Kwr_ClockNow();
+    size_t head = 0, tail = 0;
+    queue[tail++] = Maze_GridCellAt(grid, 0, 0);
+    visited[queue[0] - grid->cells] = true;
+    while (head < tail) {
+        Maze_Cell *cell = queue[head++];
+        for (Maze_Dir dir = Maze_Dir_First; dir < Maze_Dir_End; ++dir) {
+            Maze_Cell *next = cell->links[dir];
+            if (next && !visited[next - grid->cells]) {
+                visited[next - grid->cells] = true;
+                queue[tail++] = next;
+            }
+        }
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)tail;
+    kfree(queue);
+    return elapsed;
+}
+
+static uint64_t Bench_Layout(int size, Maze_Layout layout, _Bool search)
+{
+    Maze_Grid grid = { .num_rows = size, .num_columns = size, .layout = layout };
+    Maze_InitGrid(&grid);
+    uint8_t *visited = kalloc(NULL, Maze_GridStorage(&grid));
+
+    uint64_t elapsed = Bench_RandomWalk(&grid, visited);
+    if (search)  elapsed = Bench_Search(&grid, visited);
+
+    kfree(visited);
+    Maze_DisposeGrid(&grid);
+    return elapsed;
+}
+
+static uint64_t Bench_WalkRowMajor(int size)    { return Bench_Layout(size, Maze_Layout_RowMajor, false); }
+static uint64_t Bench_WalkTiled(int size)       { return Bench_Layout(size, Maze_Layout_Tiled, false); }
+static uint64_t Bench_WalkMorton(int size)      { return Bench_Layout(size, Maze_Layout_Morton, false); }
+static uint64_t Bench_SearchRowMajor(int size)  { return Bench_Layout(size, Maze_Layout_RowMajor, true); }
+static uint64_t Bench_SearchTiled(int size)     { return Bench_Layout(size, Maze_Layout_Tiled, true); }
+static uint64_t Bench_SearchMorton(int size)    { return Bench_Layout(size, Maze_Layout_Morton, true); }
+
+
+//------------------------------------------------------------
+//# Library
+
+// One random number per cell
+static uint64_t Bench_XorShiftRand(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    uint32_t sum = 0;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  sum += XorShift_Rand(&rng);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += sum;
+    return elapsed;
+}
+
+static uint64_t Bench_XorShiftFill(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    uint32_t *out = kalloc(NULL, count * sizeof(uint32_t));
+
+    uint64_t start = Kwr_ClockNow();
+    XorShift_Fill(&rng, out, count);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += out[count / 2];
+    kfree(out);
+    return elapsed;
+}
+
+typedef dynarray(uint64_t) Bench_Numbers;
+
+// One push per cell into an array grown from the default size
+static uint64_t Bench_DynarrayPush(int size)
+{
+    size_t count = (size_t)size * size;
+    uint64_t start = Kwr_ClockNow();
+    Bench_Numbers *numbers = new_dynarray(uint64_t);
+    for (size_t i = 0; i < count; ++i)  push_grow(numbers, i);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)length(numbers);
+    Dynarray_Dispose(numbers);
+    return elapsed;
+}
+
+// Doubling with enlarge, filling with push between doublings
+static uint64_t Bench_DynarrayEnlarge(int size)
+{
+    size_t count = (size_t)size * size;
+    uint64_t start = Kwr_ClockNow();
+    Bench_Numbers *numbers = Dynarray_Alloc(NULL, sizeof(uint64_t), 16);
+    for (size_t i = 0; i < count; ++i) {
+        if (is_full(numbers))  numbers = enlarge(numbers);
+        push(numbers, i);
+    }
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)length(numbers);
+    Dynarray_Dispose(numbers);
+    return elapsed;
+}
+
+// Allocation of a whole array at once
+static uint64_t Bench_DynarrayAlloc(int size)
+{
+    uint64_t start = Kwr_ClockNow();
+    Bench_Numbers *numbers = Dynarray_Alloc(NULL, sizeof(uint64_t), (size_t)size * size);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    Dynarray_Dispose(numbers);
+    return elapsed;
+}
+
+
+typedef struct { uint32_t key, value; } Bench_Slot;
+typedef hashmap(Bench_Slot) Bench_Map;
+
+// One key per cell, scattered over 32 bits, into a map grown from empty
+static uint64_t Bench_HashMapInsert(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    Bench_Map *map = NULL;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  hashmap_insert(map, XorShift_Rand(&rng))->value = (uint32_t)i;
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)hashmap_count(map);
+    hashmap_dispose(map);
+    return elapsed;
+}
+
+// One lookup per cell, half of them for keys not in the map
+static uint64_t Bench_HashMapFind(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    Bench_Map *map = NULL;
+    hashmap_reserve(map, count / 2);
+    for (size_t i = 0; i < count / 2; ++i)  hashmap_insert(map, XorShift_Rand(&rng) | 1);
+    uint32_t found = 0;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  found += hashmap_find(map, XorShift_Rand(&rng) | (i & 1)) != NULL;
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += found;
+    hashmap_dispose(map);
+    return elapsed;
+}
+
+// One integer or double formatted per cell, into a reused buffer
+static uint64_t Bench_FormatInt(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    char out[Kwr_IntChars];
+    size_t total = 0;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  total += Kwr_FormatInt(out, (int32_t)XorShift_Rand(&rng));
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)total;
+    return elapsed;
+}
+
+static double Bench_RandDouble(XorShift *rng)
+{
+    return (double)XorShift_Rand(rng) / ((XorShift_Rand(rng) | 1) * 0.001);
+}
+
+static uint64_t Bench_FormatDouble(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    char out[Kwr_DoubleChars];
+    size_t total = 0;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  total += Kwr_FormatDouble(out, Bench_RandDouble(&rng));
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)total;
+    return elapsed;
+}
+
+// The same doubles through snprintf with round-trip precision, for comparison
+static uint64_t Bench_SnprintfDouble(int size)
+{
+    XorShift rng;
+    XorShift_Init(&rng, 12314, 0);
+    size_t count = (size_t)size * size;
+    char out[32];
+    size_t total = 0;
+
+    uint64_t start = Kwr_ClockNow();
+    for (size_t i = 0; i < count; ++i)  total += snprintf(out, sizeof(out), "%.17g", Bench_RandDouble(&rng));
+    uint64_t elapsed = Kwr_ClockNow() - start;
+
+    bench_sink += (uint32_t)total;
+    return elapsed;
+}
+
+//------------------------------------------------------------
+//# Driver
+
+// name, bytes per cell (memory estimate)
+#define BENCHMARK_X_TABLE \
+  X(InitGrid,           48) \
+  X(InitCompactGrid,     1) \
+  X(BinaryTree,          1) \
+  X(BinaryTreeParallel,  1) \
+  X(Sidewinder,          1) \
+  X(LinkCells,          48) \
+  X(UnlinkCells,        48) \
+  X(CompactLinkCells,    1) \
+  X(WalkRowMajor,       49) \
+  X(WalkTiled,          49) \
+  X(WalkMorton,         49) \
+  X(SearchRowMajor,     57) \
+  X(SearchTiled,        57) \
+  X(SearchMorton,       57) \
+  X(XorShiftRand,        0) \
+  X(XorShiftFill,        4) \
+  X(DynarrayPush,       16) \
+  X(DynarrayEnlarge,    16) \
+  X(DynarrayAlloc,       8) \
+  X(HashMapInsert,      40) \
+  X(HashMapFind,        20) \
+  X(FormatInt,           0) \
+  X(FormatDouble,        0) \
+  X(SnprintfDouble,      0)
+
+typedef struct Bench_Info {
+    const char *name;
+    Bench_Fn fn;
+    size_t bytes_per_cell;
+} Bench_Info;
+
+#define X(Name, bytes)  { #Name, Bench_##Name, bytes },
+static const Bench_Info bench_infos[] = { BENCHMARK_X_TABLE };
+#undef X
+
+typedef struct Bench_Options {
+    int sizes[16];
+    int num_sizes;
+    const char *filter;
+    int min_reps, max_reps;
+    double budget;          // seconds per benchmark and size
+    size_t memory;          // bytes
+} Bench_Options;
+
+static int Bench_CompareTimes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void Bench_Run(const Bench_Info *info, int size, const Bench_Options *options, uint64_t *times)
+{
+    info->fn(size);   // warm-up
+
+    int reps = 0;
+    uint64_t total = 0, budget = (uint64_t)(options->budget * 1e9);
+    while (reps < options->max_reps && (reps < options->min_reps || total < budget)) {
+        times[reps] = info->fn(size);
+        total += times[reps++];
+    }
+
+    qsort(times, (size_t)reps, sizeof(uint64_t), Bench_CompareTimes);
+    uint64_t median = times[reps / 2];
+    uint64_t p99    = times[(size_t)((reps - 1) * 0.99 + 0.5)];
+    double cells    = (double)size * size;
+    printf("%s,%d,%.0f,%d,%llu,%llu,%llu,%.3f\n", info->name, size, cells, reps,
+           (unsigned long long)median, (unsigned long long)p99, (unsigned long long)times[0], median / cells);
+    fflush(stdout);
+}
+
+static int Bench_ParseSizes(const char *text, int *sizes, int max_sizes)
+{
+    int count = 0;
+    for (char *end; *text && count < max_sizes; text = end + (*end == ',')) {
+        long size = strtol(text, &end, 10);
+        if (end == text)  break;
+        if (size > 0)  sizes[count++] = (int)size;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    Bench_Options options = { .sizes = { 10, 100, 1000, 10000 }, .num_sizes = 4,
+                              .min_reps = 5, .max_reps = 1000, .budget = 0.25, .memory = (size_t)2048 << 20 };
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (!strcmp(argv[i], "-sizes"))   options.num_sizes = Bench_ParseSizes(argv[i+1], options.sizes, (int)array_length(options.sizes));
+        else if (!strcmp(argv[i], "-filter"))  options.filter    = argv[i+1];
+        else if (!strcmp(argv[i], "-reps"))    options.min_reps  = atoi(argv[i+1]) > 0? atoi(argv[i+1]): 1;
+        else if (!strcmp(argv[i], "-budget"))  options.budget    = atof(argv[i+1]);
+        else if (!strcmp(argv[i], "-memory"))  options.memory    = (size_t)atol(argv[i+1]) << 20;
+    }
+    if (options.max_reps < options.min_reps)  options.max_reps = options.min_reps;
+
+    uint64_t *times = kalloc(NULL, (size_t)options.max_reps * sizeof(uint64_t));
+    printf("benchmark,size,cells,reps,median_ns,p99_ns,min_ns,median_ns_per_cell\n");
+
+    for (size_t b = 0; b < array_length(bench_infos); ++b) {
+        const Bench_Info *info = &bench_infos[b];
+        if (options.filter && !strstr(info->name, options.filter))  continue;
+
+        for (int s = 0; s < options.num_sizes; ++s) {
+            int size = options.sizes[s];
+            if ((double)size * size * info->bytes_per_cell > (double)options.memory) {
+                fprintf(stderr, "%s,%d: skipped, needs more than -memory\n", info->name, size);
+                continue;
+            }
+            Bench_Run(info, size, &options, times);
+        }
+    }
+
+    kfree(times);
+    return 0;
+}
@@ -1,8 +1,37 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // mremap, MADV_HUGEPAGE
+#endif
+
 #include "kwrlib.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc
+#include <cpuid.h>
+#define KWR_HAS_TSC 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define KWR_HAS_MMAP 1
+#endif
+
+#include <pthread.h>
 
 void_fp swap_fp(void_fp *a, void_fp *b)
 {
@@ -27,7 +56,12 @@ const char *ErrorCode_String(ErrorCode error)
 
 void Status_Print(Status *stat)
 {
-    printf("%s: \"%s\" in function %s()\n", ErrorCode_String(stat->error), stat->message, stat->function);
+    char line[256];
+    Kwr_Buffer buf = Kwr_FixedBuffer(line);
+    Kwr_AppendStatus(&buf, stat);
+    Kwr_AppendChar(&buf, '\n');
+    if (Kwr_BufferTruncated(&buf))  line[sizeof(line) - 2] = '\n';
+    fputs(line, stdout);
 }
 
 
@@ -55,64 +89,2668 @@ _Bool AssertFailureFmt(const char *sourceline, const char *format, ...)
 
 //------------------------------------------------------------
 //# Memory Management
+//
+// With KWR_ALLOC_STATS each thread counts into its own table of sites,
+// open addressed by the site pointer; the last slot takes sites that do
+// not fit.  Only the owner writes a table (relaxed atomics so reports
+// can read it any time).  Tables outlive their threads: a new thread
+// takes over a table whose thread has exited.
 
-void *kalloc(void *ptr, size_t size)
+#undef kalloc
+#undef kcalloc
+
+#if KWR_ALLOC_STATS
+
+#ifndef KWR_ALLOC_SITES
+#define    KWR_ALLOC_SITES  512     // per thread, a power of two
+#endif
+#ifndef KWR_ALLOC_FLUSH_BYTES
+#define    KWR_ALLOC_FLUSH_BYTES  (64*1024)
+#endif
+
+typedef union Kwr_AllocHeader {
+    struct {
+        const char *site;
+        size_t      size;
+    } block;
+    max_align_t align;
+} Kwr_AllocHeader;
+
+typedef struct Kwr_AllocSite {
+    _Atomic(const char *) site;
+    atomic_int_least64_t  live_bytes, live_blocks;
+    atomic_uint_least64_t allocs, resizes, moves, frees, bytes;
+} Kwr_AllocSite;
+
+typedef struct Kwr_AllocTable Kwr_AllocTable;
+struct Kwr_AllocTable {
+    atomic_bool      owned;
+    int64_t          unflushed;     // live bytes not yet added to kwr_alloc.live_bytes
+    Kwr_AllocTable  *next;
+    Kwr_AllocSite    sites[KWR_ALLOC_SITES];
+};
+
+static struct {
+    _Atomic(Kwr_AllocTable *) tables;
+    atomic_int_least64_t live_bytes;
+    atomic_int_least64_t peak_bytes;
+} kwr_alloc;
+
+static _Thread_local Kwr_AllocTable *kwr_alloc_table;
+static _Thread_local const char     *kwr_alloc_site;
+static pthread_key_t  kwr_alloc_key;
+static pthread_once_t kwr_alloc_once = PTHREAD_ONCE_INIT;
+
+#define Kwr_Add(counter_, n_)  atomic_store_explicit(&(counter_), atomic_load_explicit(&(counter_), memory_order_relaxed) + (n_), memory_order_relaxed)
+
+static void Kwr_FlushAllocTable(Kwr_AllocTable *table)
+{
+    int64_t live = atomic_fetch_add(&kwr_alloc.live_bytes, table->unflushed) + table->unflushed;
+    table->unflushed = 0;
+
+    int64_t peak = atomic_load(&kwr_alloc.peak_bytes);
+    while (live > peak && !atomic_compare_exchange_weak(&kwr_alloc.peak_bytes, &peak, live))  {}
+}
+
+static void Kwr_ReleaseAllocTable(void *table)
+{
+    Kwr_FlushAllocTable(table);
+    atomic_store_explicit(&((Kwr_AllocTable *)table)->owned, false, memory_order_release);
+}
+
+static void Kwr_ReportLeaksAtExit(void)
+{
+    Kwr_PrintLeaks(stderr);
+}
+
+static void Kwr_InitAllocStats(void)
+{
+    pthread_key_create(&kwr_alloc_key, Kwr_ReleaseAllocTable);
+    atexit(Kwr_ReportLeaksAtExit);
+}
+
+// The tables themselves come from calloc, outside the accounting
+static Kwr_AllocTable *Kwr_ClaimAllocTable(void)
+{
+    pthread_once(&kwr_alloc_once, Kwr_InitAllocStats);
+
+    Kwr_AllocTable *table = atomic_load(&kwr_alloc.tables);
+    for (; table; table = table->next) {
+        _Bool owned = false;
+        if (atomic_compare_exchange_strong_explicit(&table->owned, &owned, true, memory_order_acquire, memory_order_relaxed))  break;
+    }
+
+    if (!table) {
+        table = calloc(1, sizeof(Kwr_AllocTable));
+        if (!table) {
+            fprintf(stderr, "kalloc: no memory for allocation counters\n");
+            abort();
+        }
+        atomic_init(&table->owned, true);
+        table->next = atomic_load(&kwr_alloc.tables);
+        while (!atomic_compare_exchange_weak(&kwr_alloc.tables, &table->next, table))  {}
+    }
+
+    pthread_setspecific(kwr_alloc_key, table);
+    return kwr_alloc_table = table;
+}
+
+static Kwr_AllocSite *Kwr_FindAllocSite(const char *site)
+{
+    Kwr_AllocTable *table = kwr_alloc_table? kwr_alloc_table: Kwr_ClaimAllocTable();
+
+    size_t mask = KWR_ALLOC_SITES - 1;
+    size_t slot = ((uintptr_t)site >> 3) * 0x9E3779B97F4A7C15u >> 32 & mask;
+    for (size_t probe = 0; probe < mask; ++probe, slot = (slot + 1) & mask) {
+        if (slot == mask)  continue;   // the overflow slot
+        Kwr_AllocSite *entry = &table->sites[slot];
+        const char *at = atomic_load_explicit(&entry->site, memory_order_relaxed);
+        if (at == site)  return entry;
+        if (!at) {
+            atomic_store_explicit(&entry->site, site, memory_order_release);
+            return entry;
+        }
+    }
+
+    Kwr_AllocSite *other = &table->sites[mask];
+    atomic_store_explicit(&other->site, "(other sites)", memory_order_release);
+    return other;
+}
+
+static void Kwr_CountLive(Kwr_AllocSite *entry, int64_t bytes, int64_t blocks)
+{
+    Kwr_Add(entry->live_bytes, bytes);
+    Kwr_Add(entry->live_blocks, blocks);
+
+    Kwr_AllocTable *table = kwr_alloc_table;
+    table->unflushed += bytes;
+    if (table->unflushed >= KWR_ALLOC_FLUSH_BYTES || table->unflushed <= -KWR_ALLOC_FLUSH_BYTES)  Kwr_FlushAllocTable(table);
+}
+
+// A pending site from KWR_ALLOC_SITE takes precedence over the caller's
+static const char *Kwr_TakeAllocSite(const char *site)
+{
+    if (kwr_alloc_site) {
+        site = kwr_alloc_site;
+        kwr_alloc_site = NULL;
+    }
+    return site? site: "(unknown)";
+}
+
+static void *Kwr_CountNewBlock(Kwr_AllocHeader *header, size_t size, const char *site)
+{
+    if (!header)  return NULL;
+
+    header->block.site = site;
+    header->block.size = size;
+    Kwr_AllocSite *entry = Kwr_FindAllocSite(site);
+    Kwr_Add(entry->allocs, 1);
+    Kwr_Add(entry->bytes, size);
+    Kwr_CountLive(entry, (int64_t)size, 1);
+    return header + 1;
+}
+
+static void Kwr_CountFree(Kwr_AllocHeader *header)
+{
+    Kwr_AllocSite *entry = Kwr_FindAllocSite(header->block.site);
+    Kwr_Add(entry->frees, 1);
+    Kwr_CountLive(entry, -(int64_t)header->block.size, -1);
+}
+
+void *Kwr_AllocAt(void *ptr, size_t size, const char *site)
+{
+    site = Kwr_TakeAllocSite(site);
+    if (size > SIZE_MAX - sizeof(Kwr_AllocHeader))  return NULL;
+
+    if (!ptr)  return Kwr_CountNewBlock(malloc(sizeof(Kwr_AllocHeader) + size), size, site);
+
+    Kwr_AllocHeader *header = (Kwr_AllocHeader *)ptr - 1;
+    if (!size) {
+        Kwr_CountFree(header);
+        free(header);
+        return NULL;
+    }
+
+    const char *old_site = header->block.site;
+    size_t old_size = header->block.size;
+    Kwr_AllocHeader *moved = realloc(header, sizeof(Kwr_AllocHeader) + size);
+    if (!moved)  return NULL;
+
+    // The block now belongs to the site that resized it
+    Kwr_AllocSite *old_entry = Kwr_FindAllocSite(old_site);
+    Kwr_CountLive(old_entry, -(int64_t)old_size, -1);
+
+    Kwr_AllocSite *entry = Kwr_FindAllocSite(site);
+    Kwr_Add(entry->resizes, 1);
+    if (moved != header)  Kwr_Add(entry->moves, 1);
+    if (size > old_size)  Kwr_Add(entry->bytes, size - old_size);
+    Kwr_CountLive(entry, (int64_t)size, 1);
+
+    moved->block.site = site;
+    moved->block.size = size;
+    return moved + 1;
+}
+
+void *Kwr_CallocAt(size_t count, size_t size, const char *site)
+{
+    site = Kwr_TakeAllocSite(site);
+    if (size && count > (SIZE_MAX - sizeof(Kwr_AllocHeader)) / size)  return NULL;
+    return Kwr_CountNewBlock(calloc(1, sizeof(Kwr_AllocHeader) + count * size), count * size, site);
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr)  return;  // okay to pass NULL, just ignore it
+
+    Kwr_AllocHeader *header = (Kwr_AllocHeader *)ptr - 1;
+    Kwr_CountFree(header);
+    free(header);
+}
+
+void Kwr_SetAllocSite(const char *site)
+{
+    kwr_alloc_site = site;
+}
+
+void *Kwr_EndAllocSite(void *result)
+{
+    kwr_alloc_site = NULL;
+    return result;
+}
+
+static void Kwr_SumAllocSite(Kwr_AllocStats *sum, Kwr_AllocSite *entry)
+{
+    sum->live_bytes  += atomic_load_explicit(&entry->live_bytes, memory_order_relaxed);
+    sum->live_blocks += atomic_load_explicit(&entry->live_blocks, memory_order_relaxed);
+    sum->allocs  += atomic_load_explicit(&entry->allocs, memory_order_relaxed);
+    sum->resizes += atomic_load_explicit(&entry->resizes, memory_order_relaxed);
+    sum->moves   += atomic_load_explicit(&entry->moves, memory_order_relaxed);
+    sum->frees   += atomic_load_explicit(&entry->frees, memory_order_relaxed);
+    sum->bytes   += atomic_load_explicit(&entry->bytes, memory_order_relaxed);
+}
+
+void Kwr_GetAllocStats(Kwr_AllocStats *stats, const char *site)
+{
+    requires(stats);
+
+    *stats = (Kwr_AllocStats){0};
+    for (Kwr_AllocTable *table = atomic_load(&kwr_alloc.tables); table; table = table->next) {
+        for (size_t i = 0; i < KWR_ALLOC_SITES; ++i) {
+            const char *at = atomic_load_explicit(&table->sites[i].site, memory_order_acquire);
+            if (at && (!site || !strcmp(at, site)))  Kwr_SumAllocSite(stats, &table->sites[i]);
+        }
+    }
+
+    // Unflushed bytes could make the live total pass the recorded peak
+    int64_t peak = atomic_load(&kwr_alloc.peak_bytes);
+    if (!site && stats->live_bytes > peak)  peak = stats->live_bytes;
+    stats->peak_bytes = peak > 0? (uint64_t)peak: 0;
+}
+
+typedef struct Kwr_SiteTotal {
+    const char     *site;
+    Kwr_AllocStats  stats;
+} Kwr_SiteTotal;
+
+static int Kwr_CompareSiteTotals(const void *a, const void *b)
+{
+    const Kwr_AllocStats *x = &((const Kwr_SiteTotal *)a)->stats, *y = &((const Kwr_SiteTotal *)b)->stats;
+    if (x->live_bytes != y->live_bytes)  return x->live_bytes < y->live_bytes? 1: -1;
+    return (x->allocs + x->resizes < y->allocs + y->resizes) - (x->allocs + x->resizes > y->allocs + y->resizes);
+}
+
+// Sites merged across threads, most live bytes first; NULL if out of memory
+static Kwr_SiteTotal *Kwr_MergeAllocSites(size_t *count)
+{
+    size_t capacity = 0;
+    for (Kwr_AllocTable *table = atomic_load(&kwr_alloc.tables); table; table = table->next)  capacity += KWR_ALLOC_SITES;
+
+    Kwr_SiteTotal *totals = malloc((capacity? capacity: 1) * sizeof(Kwr_SiteTotal));
+    *count = 0;
+    if (!totals)  return NULL;
+
+    for (Kwr_AllocTable *table = atomic_load(&kwr_alloc.tables); table; table = table->next) {
+        for (size_t i = 0; i < KWR_ALLOC_SITES; ++i) {
+            const char *site = atomic_load_explicit(&table->sites[i].site, memory_order_acquire);
+            if (!site)  continue;
+
+            size_t k = 0;
+            while (k < *count && strcmp(totals[k].site, site))  ++k;
+            if (k == *count)  totals[(*count)++] = (Kwr_SiteTotal){ .site = site };
+            Kwr_SumAllocSite(&totals[k].stats, &table->sites[i]);
+        }
+    }
+
+    qsort(totals, *count, sizeof(Kwr_SiteTotal), Kwr_CompareSiteTotals);
+    return totals;
+}
+
+static void Kwr_PrintSiteTotal(FILE *out, const Kwr_SiteTotal *total)
+{
+    const Kwr_AllocStats *s = &total->stats;
+    fprintf(out, "%-32s %14lld %10lld %10llu %10llu %10llu %10llu %16llu\n", total->site, 
+            (long long)s->live_bytes, (long long)s->live_blocks, (unsigned long long)s->allocs, 
+            (unsigned long long)s->resizes, (unsigned long long)s->moves, (unsigned long long)s->frees, 
+            (unsigned long long)s->bytes);
+}
+
+static const char kwr_alloc_columns[] = "%-32s %14s %10s %10s %10s %10s %10s %16s\n";
+
+void Kwr_PrintAllocStats(void *file)
+{
+    FILE *out = file? file: stdout;
+    size_t count;
+    Kwr_SiteTotal *totals = Kwr_MergeAllocSites(&count);
+    if (!totals)  return;
+
+    Kwr_AllocStats all;
+    Kwr_GetAllocStats(&all, NULL);
+    fprintf(out, "heap: %lld bytes live in %lld blocks, peak %llu bytes\n", 
+            (long long)all.live_bytes, (long long)all.live_blocks, (unsigned long long)all.peak_bytes);
+    fprintf(out, kwr_alloc_columns, "site", "live bytes", "blocks", "allocs", "resizes", "moves", "frees", "bytes");
+    for (size_t i = 0; i < count; ++i)  Kwr_PrintSiteTotal(out, &totals[i]);
+    fflush(out);
+    free(totals);
+}
+
+int Kwr_PrintLeaks(void *file)
+{
+    FILE *out = file? file: stdout;
+    size_t count;
+    Kwr_SiteTotal *totals = Kwr_MergeAllocSites(&count);
+    if (!totals)  return 0;
+
+    int leaks = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!totals[i].stats.live_blocks)  continue;
+        if (!leaks++)  fprintf(out, kwr_alloc_columns, "leaked from", "live bytes", "blocks", "allocs", "resizes", "moves", "frees", "bytes");
+        Kwr_PrintSiteTotal(out, &totals[i]);
+    }
+    fflush(out);
+    free(totals);
+    return leaks;
+}
+
+#else
+
+void *Kwr_AllocAt(void *ptr, size_t size, const char *site)
 {
+    UNUSED(site);
     return realloc(ptr, size);
 }
 
+void *Kwr_CallocAt(size_t count, size_t size, const char *site)
+{
+    UNUSED(site);
+    return calloc(count, size);
+}
 
-//------------------------------------------------------------
-//# Dynamically Sized Arrays 
+void kfree(void *ptr)
+{
+    free(ptr);
+}
 
-void *Dynarray_Alloc(void *a, size_t item_size, size_t num_items)
+void Kwr_SetAllocSite(const char *site)  { UNUSED(site); }
+void *Kwr_EndAllocSite(void *result)     { return result; }
+
+void Kwr_GetAllocStats(Kwr_AllocStats *stats, const char *site)
+{
+    requires(stats);
+    UNUSED(site);
+    *stats = (Kwr_AllocStats){0};
+}
+
+void Kwr_PrintAllocStats(void *file)
+{
+    fputs("heap: not counted, build with KWR_ALLOC_STATS=1\n", file? file: stdout);
+}
+
+int Kwr_PrintLeaks(void *file)
+{
+    UNUSED(file);
+    return 0;
+}
+
+#endif
+
+void *kalloc(void *ptr, size_t size)
+{
+    return Kwr_AllocAt(ptr, size, NULL);
+}
+
+void *kcalloc(size_t count, size_t size)
+{
+    return Kwr_CallocAt(count, size, NULL);
+}
+
+#if KWR_ALLOC_STATS
+#define kalloc(ptr_, size_)     Kwr_AllocAt((ptr_), (size_), SOURCE_LINE_STR)
+#define kcalloc(count_, size_)  Kwr_CallocAt((count_), (size_), SOURCE_LINE_STR)
+#endif
+
+struct Kwr_ArenaChunk {
+    Kwr_ArenaChunk *prev;
+    size_t size;
+    max_align_t data[];
+};
+
+static size_t Kwr_ArenaAlign(size_t size)
 {
-    size_t array_size = item_size * num_items;
-    dynarray(char) *na = kalloc(a, sizeof(dynarray(char)) + array_size);
-    if (na) {
-        na->end = na->begin + array_size;
-        if (!a)  na->top = na->begin;
+    const size_t align = _Alignof(max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+static void Kwr_ArenaUseChunk(Kwr_Arena *arena, Kwr_ArenaChunk *chunk)
+{
+    arena->chunk = chunk;
+    arena->top   = chunk? (char*)chunk->data: NULL;
+    arena->end   = chunk? (char*)chunk->data + chunk->size: NULL;
+}
+
+static _Bool Kwr_ArenaAddChunk(Kwr_Arena *arena, size_t size)
+{
+    Kwr_ArenaChunk *chunk = arena->spare;
+    if (chunk && chunk->size >= size) {
+        arena->spare = chunk->prev;
+    }
+    else {
+        if (size < arena->chunk_size)  size = arena->chunk_size;
+        chunk = kalloc(NULL, sizeof(Kwr_ArenaChunk) + size);
+        if (!chunk)  return false;
+        chunk->size = size;
     }
 
-    return na;
+    chunk->prev = arena->chunk;
+    Kwr_ArenaUseChunk(arena, chunk);
+    return true;
 }
 
+void Kwr_InitArena(Kwr_Arena *arena, size_t chunk_size)
+{
+    requires(arena);
+    *arena = (Kwr_Arena){ .chunk_size = Kwr_ArenaAlign(chunk_size? chunk_size: ARENA_DEFAULT_CHUNK_SIZE) };
+}
 
-//------------------------------------------------------------
-//# Pseudo-Random Number Generation
+void *Kwr_ArenaAlloc(Kwr_Arena *arena, size_t size)
+{
+    requires(arena);
 
-static const int XOR_SHIFT_PARAMETERS[][3] = {
-   { 1, 3,10}, { 1, 5,16}, { 1, 5,19}, { 1, 9,29}, { 1,11, 6}, { 1,11,16}, { 1,19, 3}, { 1,21,20}, { 1,27,27}, 
-   { 2, 5,15}, { 2, 5,21}, { 2, 7, 7}, { 2, 7, 9}, { 2, 7,25}, { 2, 9,15}, { 2,15,17}, { 2,15,25}, { 2,21, 9}, 
-   { 3, 1,14}, { 3, 3,26}, { 3, 3,28}, { 3, 3,29}, { 3, 5,20}, { 3, 5,22}, { 3, 5,25}, { 3, 7,29}, { 3,13, 7}, 
-   { 3,23,25}, { 3,25,24}, { 3,27,11}, { 4, 3,17}, { 4, 3,27}, { 4, 5,15}, { 5, 3,21}, { 5, 7,22}, { 5, 9,7 }, 
-   { 5, 9,28}, { 5, 9,31}, { 5,13, 6}, { 5,15,17}, { 5,17,13}, { 5,21,12}, { 5,27, 8}, { 5,27,21}, { 5,27,25}, 
-   { 5,27,28}, { 6, 1,11}, { 6, 3,17}, { 6,17, 9}, { 6,21, 7}, { 6,21,13}, { 7, 1, 9}, { 7, 1,18}, { 7, 1,25}, 
-   { 7,13,25}, { 7,17,21}, { 7,25,12}, { 7,25,20}, { 8, 7,23}, { 8,9,23 }, { 9, 5,1 }, { 9, 5,25}, { 9,11,19}, 
-   { 9,21,16}, {10, 9,21}, {10, 9,25}, {11, 7,12}, {11, 7,16}, {11,17,13}, {11,21,13}, {12, 9,23}, {13, 3,17}, 
-   {13, 3,27}, {13, 5,19}, {13,17,15}, {14, 1,15}, {14,13,15}, {15, 1,29}, {17,15,20}, {17,15,23}, {17,15,26}, 
+    size = Kwr_ArenaAlign(size);
+    if (size > (size_t)(arena->end - arena->top)) {
+        if (!Kwr_ArenaAddChunk(arena, size))  return NULL;
+    }
+
+    void *ptr = arena->top;
+    arena->top += size;
+    return ptr;
+}
+
+void *Kwr_ArenaResize(Kwr_Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    requires(arena);
+
+    if (!ptr)  return Kwr_ArenaAlloc(arena, new_size);
+
+    // The most recent allocation can grow or shrink in place
+    old_size = Kwr_ArenaAlign(old_size);
+    if ((char*)ptr + old_size == arena->top) {
+        size_t room = arena->end - (char*)ptr;
+        if (new_size <= room) {
+            arena->top = (char*)ptr + Kwr_ArenaAlign(new_size);
+            return ptr;
+        }
+    }
+
+    if (new_size <= old_size)  return ptr;
+
+    void *new_ptr = Kwr_ArenaAlloc(arena, new_size);
+    if (new_ptr)  memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+Kwr_ArenaMark Kwr_ArenaGetMark(Kwr_Arena *arena)
+{
+    requires(arena);
+    return (Kwr_ArenaMark){ .chunk = arena->chunk, .top = arena->top };
+}
+
+void Kwr_ArenaReset(Kwr_Arena *arena, Kwr_ArenaMark mark)
+{
+    requires(arena);
+
+    // Move chunks allocated after the mark to the spare list
+    while (arena->chunk != mark.chunk) {
+        requires_m(arena->chunk, "arena mark does not belong to this arena");
+        Kwr_ArenaChunk *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        chunk->prev  = arena->spare;
+        arena->spare = chunk;
+    }
+
+    Kwr_ArenaUseChunk(arena, mark.chunk);
+    if (mark.top)  arena->top = mark.top;
+}
+
+void Kwr_DisposeArena(Kwr_Arena *arena)
+{
+    if (arena) {  // okay to pass NULL, just ignore it
+        Kwr_ClearArena(arena);
+        for (Kwr_ArenaChunk *chunk = arena->spare, *prev; chunk; chunk = prev) {
+            prev = chunk->prev;
+            kfree(chunk);
+        }
+        *arena = (Kwr_Arena){0};
+    }
+}
+
+
+struct Kwr_PoolItem {
+    Kwr_PoolItem *next;
 };
 
-void XorShift_Init(XorShift *state, uint32_t seed, int params_num)
+struct Kwr_PoolSlab {
+    Kwr_PoolSlab *next;
+    max_align_t items[];
+};
+
+static void Kwr_PoolLock(Kwr_Pool *pool)
 {
-    params_num = params_num % array_length(XOR_SHIFT_PARAMETERS);
-    const int *params = XOR_SHIFT_PARAMETERS[params_num];
+    while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire))
+        ;
+}
 
-    *state = (XorShift)
-    { 
-        .a = params[0], 
-        .b = params[1], 
-        .c = params[2], 
-        .x = seed
+static void Kwr_PoolUnlock(Kwr_Pool *pool)
+{
+    atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+static void Kwr_PoolCountLive(Kwr_Pool *pool, ptrdiff_t delta)
+{
+    pool->live_count += delta;
+    if (pool->live_count > pool->peak_count)  pool->peak_count = pool->live_count;
+}
+
+// Requires the pool lock
+static _Bool Kwr_PoolAddSlab(Kwr_Pool *pool)
+{
+    Kwr_PoolSlab *slab = kalloc(NULL, sizeof(Kwr_PoolSlab) + pool->item_size * pool->items_per_slab);
+    if (!slab)  return false;
+
+    slab->next  = pool->slabs;
+    pool->slabs = slab;
+
+    char *item = (char*)slab->items + pool->item_size * pool->items_per_slab;
+    for (size_t n = pool->items_per_slab; n--; ) {
+        item -= pool->item_size;
+        ((Kwr_PoolItem*)item)->next = pool->free_list;
+        pool->free_list = (Kwr_PoolItem*)item;
+    }
+    return true;
+}
+
+void Kwr_InitPool(Kwr_Pool *pool, size_t item_size, size_t items_per_slab)
+{
+    requires(pool);
+    requires(item_size > 0);
+
+    const size_t align = _Alignof(max_align_t);
+    if (item_size < sizeof(Kwr_PoolItem))  item_size = sizeof(Kwr_PoolItem);
+
+    *pool = (Kwr_Pool){
+        .item_size      = (item_size + align - 1) & ~(align - 1),
+        .items_per_slab = items_per_slab? items_per_slab: POOL_DEFAULT_SLAB_ITEMS,
+        .lock           = ATOMIC_FLAG_INIT,
     };
 }
 
-uint32_t XorShift_Rand(XorShift *state)
+void *Kwr_PoolAlloc(Kwr_Pool *pool)
 {
-    int x = state->x;
-    x ^= (x << state->a);
-    x ^= (x >> state->b);
-    x ^= (x << state->c);
-    return state->x = x;
+    requires(pool);
+
+    Kwr_PoolLock(pool);
+    Kwr_PoolItem *item = pool->free_list;
+    if (item || (Kwr_PoolAddSlab(pool) && (item = pool->free_list))) {
+        pool->free_list = item->next;
+        Kwr_PoolCountLive(pool, 1);
+    }
+    Kwr_PoolUnlock(pool);
+
+    return item;
+}
+
+void Kwr_PoolFree(Kwr_Pool *pool, void *item)
+{
+    requires(pool);
+    if (!item)  return;
+
+    Kwr_PoolLock(pool);
+    ((Kwr_PoolItem*)item)->next = pool->free_list;
+    pool->free_list = item;
+    Kwr_PoolCountLive(pool, -1);
+    Kwr_PoolUnlock(pool);
+}
+
+void Kwr_DisposePool(Kwr_Pool *pool)
+{
+    if (pool) {  // okay to pass NULL, just ignore it
+        for (Kwr_PoolSlab *slab = pool->slabs, *next; slab; slab = next) {
+            next = slab->next;
+            kfree(slab);
+        }
+        *pool = (Kwr_Pool){0};
+    }
+}
+
+void Kwr_InitPoolCache(Kwr_PoolCache *cache, Kwr_Pool *pool)
+{
+    requires(cache);
+    requires(pool);
+    *cache = (Kwr_PoolCache){ .pool = pool };
+}
+
+// Move up to one batch of items from the pool into the cache
+static void Kwr_PoolCacheRefill(Kwr_PoolCache *cache)
+{
+    Kwr_Pool *pool = cache->pool;
+    Kwr_PoolLock(pool);
+
+    Kwr_PoolCountLive(pool, cache->live_delta);
+    cache->live_delta = 0;
+
+    while (cache->free_count < POOL_CACHE_BATCH) {
+        Kwr_PoolItem *item = pool->free_list;
+        if (!item && !(Kwr_PoolAddSlab(pool) && (item = pool->free_list)))  break;
+        pool->free_list  = item->next;
+        item->next       = cache->free_list;
+        cache->free_list = item;
+        ++cache->free_count;
+    }
+
+    Kwr_PoolUnlock(pool);
+}
+
+// Return up to `count` cached items to the pool
+static void Kwr_PoolCacheDrain(Kwr_PoolCache *cache, size_t count)
+{
+    Kwr_Pool *pool = cache->pool;
+    Kwr_PoolLock(pool);
+
+    Kwr_PoolCountLive(pool, cache->live_delta);
+    cache->live_delta = 0;
+
+    while (count-- && cache->free_list) {
+        Kwr_PoolItem *item = cache->free_list;
+        cache->free_list = item->next;
+        item->next       = pool->free_list;
+        pool->free_list  = item;
+        --cache->free_count;
+    }
+
+    Kwr_PoolUnlock(pool);
 }
 
+void *Kwr_PoolCacheAlloc(Kwr_PoolCache *cache)
+{
+    requires(cache);
+
+    if (!cache->free_list)  Kwr_PoolCacheRefill(cache);
+
+    Kwr_PoolItem *item = cache->free_list;
+    if (item) {
+        cache->free_list = item->next;
+        --cache->free_count;
+        ++cache->live_delta;
+    }
+    return item;
+}
+
+void Kwr_PoolCacheFree(Kwr_PoolCache *cache, void *item)
+{
+    requires(cache);
+    if (!item)  return;
+
+    ((Kwr_PoolItem*)item)->next = cache->free_list;
+    cache->free_list = item;
+    ++cache->free_count;
+    --cache->live_delta;
+
+    if (cache->free_count >= 2 * POOL_CACHE_BATCH)  Kwr_PoolCacheDrain(cache, POOL_CACHE_BATCH);
+}
+
+void Kwr_DisposePoolCache(Kwr_PoolCache *cache)
+{
+    if (cache && cache->pool) {  // okay to pass NULL, just ignore it
+        Kwr_PoolCacheDrain(cache, cache->free_count);
+        *cache = (Kwr_PoolCache){0};
+    }
+}
+
+
+//------------------------------------------------------------
+//# Dynamically Sized Arrays 
+
+typedef dynarray(char) Dynarray_Bytes;
+
+static size_t Dynarray_Resize(Dynarray_Bytes *da, size_t num_items)
+{
+    da->capacity = num_items;
+    if (da->length > num_items)  da->length = num_items;
+    return da->capacity;
+}
+
+#ifdef KWR_HAS_MMAP
+
+static size_t Dynarray_MapRound(size_t size, unsigned flags)
+{
+    size_t page = (flags & Dynarray_HugePages)? 2*1024*1024: (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+static void *Dynarray_MapPages(size_t size, unsigned flags)
+{
+    void *pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pages == MAP_FAILED)  return NULL;
+#ifdef MADV_HUGEPAGE
+    if (flags & Dynarray_HugePages)  madvise(pages, size, MADV_HUGEPAGE);
+#endif
+    return pages;
+}
+
+static void *Dynarray_Remap(Dynarray_Bytes *da, size_t item_size, size_t num_items)
+{
+    size_t size = sizeof(Dynarray_Bytes) + item_size * num_items;
+
+    if (size > da->map_size) {
+        // Grow the reservation geometrically so remaps stay rare
+        size_t new_size = Dynarray_MapRound(size > 2*da->map_size? size: 2*da->map_size, da->map_flags);
+#if defined(__linux__)
+        void *pages = mremap(da, da->map_size, new_size, MREMAP_MAYMOVE);
+        if (pages == MAP_FAILED)  return NULL;
+#else
+        void *pages = Dynarray_MapPages(new_size, da->map_flags);
+        if (!pages)  return NULL;
+        memcpy(pages, da, sizeof(Dynarray_Bytes) + item_size * da->length);
+        munmap(da, da->map_size);
+#endif
+        da = pages;
+        da->map_size = new_size;
+    }
+    else {
+        // Return whole pages past the new end to the system
+        size_t keep = Dynarray_MapRound(size, 0);
+        if (keep < da->map_size)  madvise((char*)da + keep, da->map_size - keep, MADV_DONTNEED);
+    }
+
+    Dynarray_Resize(da, num_items);
+    return da;
+}
+
+#endif
+
+void *Dynarray_Alloc(void *a, size_t item_size, size_t num_items)
+{
+    Dynarray_Bytes *da = a;
+#ifdef KWR_HAS_MMAP
+    if (da && da->map_size)  return Dynarray_Remap(da, item_size, num_items);
+#endif
+    requires_m(!da || !(da->map_flags & Dynarray_InArena), "arena dynarray cannot grow on the heap; use enlarge_in");
+
+    da = kalloc(a, sizeof(Dynarray_Bytes) + item_size * num_items);
+    if (da) {
+        if (!a)  *da = (Dynarray_Bytes){0};
+        Dynarray_Resize(da, num_items);
+    }
+    return da;
+}
+
+void *Dynarray_Map(size_t item_size, size_t max_items, unsigned flags)
+{
+    requires(item_size > 0);
+
+#ifdef KWR_HAS_MMAP
+    size_t size = Dynarray_MapRound(sizeof(Dynarray_Bytes) + item_size * max_items, flags);
+    Dynarray_Bytes *da = Dynarray_MapPages(size, flags);
+    if (da) {
+        *da = (Dynarray_Bytes){ .map_size = size, .map_flags = flags };
+        Dynarray_Resize(da, max_items);
+    }
+    return da;
+#else
+    UNUSED(flags);
+    return Dynarray_Alloc(NULL, item_size, max_items);
+#endif
+}
+
+void Dynarray_Dispose(void *a)
+{
+    Dynarray_Bytes *da = a;
+    if (!da)  return;  // okay to pass NULL, just ignore it
+    if (da->map_flags & Dynarray_InArena)  return;   // freed with the arena
+
+#ifdef KWR_HAS_MMAP
+    if (da->map_size) {
+        munmap(da, da->map_size);
+        return;
+    }
+#endif
+    kfree(da);
+}
+
+void *Dynarray_Grow(void *a, size_t item_size, size_t num_items)
+{
+    requires(a);
+    requires(item_size > 0);
+
+    Dynarray_Bytes *da = a;
+    if (da->capacity - da->length >= num_items)  return a;
+
+    size_t new_capacity = da->capacity? da->capacity: 1;
+    while (new_capacity - da->length < num_items) {
+        requires_m(new_capacity <= SIZE_MAX / 2 / item_size, "dynarray capacity overflow");
+        new_capacity *= 2;
+    }
+
+    void *na = Dynarray_Alloc(a, item_size, new_capacity);
+    if (!na)  AssertFailure(SOURCE_LINE_STR " Dynarray allocation failed", __func__);
+    return na;
+}
+
+void *Dynarray_Append(void *a, size_t item_size, const void *items, size_t num_items)
+{
+    requires(items || !num_items);
+
+    Dynarray_Bytes *da = Dynarray_Grow(a, item_size, num_items);
+    memcpy(da->begin + item_size * da->length, items, item_size * num_items);
+    da->length += num_items;
+    return da;
+}
+
+void *Dynarray_ShrinkToFit(void *a, size_t item_size)
+{
+    requires(a);
+    requires(item_size > 0);
+
+    Dynarray_Bytes *da = a;
+    void *na = Dynarray_Alloc(a, item_size, da->length);
+    return na? na: a;  // still valid at the old size
+}
+
+void *Dynarray_ArenaAlloc(Kwr_Arena *arena, void *a, size_t item_size, size_t num_items)
+{
+    requires(arena);
+
+    Dynarray_Bytes *da = a;
+    requires_m(!da || (da->map_flags & Dynarray_InArena), "heap or mapped dynarray cannot move into an arena");
+
+    size_t old_size = da? sizeof(Dynarray_Bytes) + item_size * da->capacity: 0;
+    da = Kwr_ArenaResize(arena, a, old_size, sizeof(Dynarray_Bytes) + item_size * num_items);
+    if (da) {
+        if (!a)  *da = (Dynarray_Bytes){ .map_flags = Dynarray_InArena };
+        Dynarray_Resize(da, num_items);
+    }
+    return da;
+}
+
+
+//------------------------------------------------------------
+//# Hash Maps
+
+typedef hashmap(char) Kwr_HashMapBytes;
+
+#ifndef KWR_HASHMAP_SIMD
+#if defined(__SSE2__)
+#define KWR_HASHMAP_SIMD  1
+#else
+#define KWR_HASHMAP_SIMD  0
+#endif
+#endif
+
+// Control bytes: full slots hold the low 7 bits of the hash.  The first
+// group is repeated past the end so a group can be read at any slot.
+enum {
+    Kwr_HashGroup   = 16,
+    Kwr_HashEmpty   = 0x80,
+    Kwr_HashDeleted = 0xFE,
+    Kwr_HashMinCapacity = Kwr_HashGroup,
+};
+
+uint64_t Kwr_HashInt(uint64_t value)
+{
+    // MurmurHash3 finalizer: each input bit flips about half the output bits
+    value ^= value >> 33;
+    value *= UINT64_C(0xff51afd7ed558ccd);
+    value ^= value >> 33;
+    value *= UINT64_C(0xc4ceb9fe1a85ec53);
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t Kwr_HashString(const char *string)
+{
+    requires(string);
+
+    // Eight bytes per step; each step is invertible, so strings of one
+    // length only collide through the final mix
+    const uint64_t k = UINT64_C(0x9e3779b97f4a7c15);
+    size_t n = strlen(string);
+    uint64_t hash = n * k, word;
+    for (; n >= 8; n -= 8, string += 8) {
+        memcpy(&word, string, 8);
+        hash = (hash ^ word) * k;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    memcpy(&word, string, n);
+    return Kwr_HashInt(hash ^ word);
+}
+
+// Bit i set where byte i of the group at ctrl equals byte
+static inline uint32_t Kwr_HashGroupMatch(const uint8_t *ctrl, uint8_t byte)
+{
+#if KWR_HASHMAP_SIMD
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < Kwr_HashGroup; ++i)  mask |= (uint32_t)(ctrl[i] == byte) << i;
+    return mask;
+#endif
+}
+
+// ...where the slot is empty or deleted: the high bit is set
+static inline uint32_t Kwr_HashGroupMatchFree(const uint8_t *ctrl)
+{
+#if KWR_HASHMAP_SIMD
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < Kwr_HashGroup; ++i)  mask |= (uint32_t)(ctrl[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static inline uint8_t *Kwr_HashCtrl(const Kwr_HashMapBytes *map, size_t slot_size)
+{
+    return (uint8_t*)map->slots + map->capacity * slot_size;
+}
+
+static inline void Kwr_HashSetCtrl(Kwr_HashMapBytes *map, uint8_t *ctrl, size_t index, uint8_t byte)
+{
+    ctrl[index] = byte;
+    if (index < Kwr_HashGroup)  ctrl[map->capacity + index] = byte;
+}
+
+static inline uint64_t Kwr_HashKeyBits(uint64_t key, size_t key_size)
+{
+    requires_m(key_size <= 8, "hash map keys are integers, pointers or strings");
+    return key_size == Kwr_HashStringKey || key_size == 8? key: key & ((UINT64_C(1) << 8 * key_size) - 1);
+}
+
+static inline uint64_t Kwr_HashKey(uint64_t key, size_t key_size)
+{
+    return key_size == Kwr_HashStringKey? Kwr_HashString((const char*)(uintptr_t)key): Kwr_HashInt(key);
+}
+
+static inline uint64_t Kwr_HashLoadKey(const char *slot, size_t key_size)
+{
+    switch (key_size) {
+        case 1:  { uint8_t  key;  memcpy(&key, slot, 1);  return key; }
+        case 2:  { uint16_t key;  memcpy(&key, slot, 2);  return key; }
+        case 4:  { uint32_t key;  memcpy(&key, slot, 4);  return key; }
+        case 8:  { uint64_t key;  memcpy(&key, slot, 8);  return key; }
+        default: { const char *key;  memcpy(&key, slot, sizeof(key));  return (uintptr_t)key; }
+    }
+}
+
+static inline void Kwr_HashStoreKey(char *slot, size_t key_size, uint64_t key)
+{
+    switch (key_size) {
+        case 1:  { uint8_t  k = (uint8_t)key;   memcpy(slot, &k, 1);  break; }
+        case 2:  { uint16_t k = (uint16_t)key;  memcpy(slot, &k, 2);  break; }
+        case 4:  { uint32_t k = (uint32_t)key;  memcpy(slot, &k, 4);  break; }
+        case 8:  memcpy(slot, &key, 8);  break;
+        default: { const char *k = (const char*)(uintptr_t)key;  memcpy(slot, &k, sizeof(k));  break; }
+    }
+}
+
+static inline _Bool Kwr_HashKeyEquals(const char *slot, size_t key_size, uint64_t key)
+{
+    uint64_t stored = Kwr_HashLoadKey(slot, key_size);
+    if (stored == key)  return true;
+    return key_size == Kwr_HashStringKey && !strcmp((const char*)(uintptr_t)stored, (const char*)(uintptr_t)key);
+}
+
+// Index of the slot holding key, or the capacity when absent.  Probes
+// groups at triangular offsets, which visit every group of a power of
+// two table; an empty byte in a group ends the search.
+static size_t Kwr_HashLocate(const Kwr_HashMapBytes *map, size_t slot_size, size_t key_size, uint64_t key, uint64_t hash)
+{
+    const uint8_t *ctrl = Kwr_HashCtrl(map, slot_size);
+    size_t mask = map->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask;
+    for (size_t step = Kwr_HashGroup; ; pos = (pos + step) & mask, step += Kwr_HashGroup) {
+        uint32_t match = Kwr_HashGroupMatch(ctrl + pos, hash & 0x7F);
+        for (; match; match &= match - 1) {
+            size_t index = (pos + __builtin_ctz(match)) & mask;
+            if (Kwr_HashKeyEquals(map->slots + index * slot_size, key_size, key))  return index;
+        }
+        if (Kwr_HashGroupMatch(ctrl + pos, Kwr_HashEmpty))  return map->capacity;
+    }
+}
+
+// First empty or deleted slot on the probe sequence of hash
+static size_t Kwr_HashFindFree(const Kwr_HashMapBytes *map, const uint8_t *ctrl, uint64_t hash)
+{
+    size_t mask = map->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask;
+    for (size_t step = Kwr_HashGroup; ; pos = (pos + step) & mask, step += Kwr_HashGroup) {
+        uint32_t free = Kwr_HashGroupMatchFree(ctrl + pos);
+        if (free)  return (pos + __builtin_ctz(free)) & mask;
+    }
+}
+
+void *Kwr_HashMapFind(const void *map_, size_t slot_size, size_t key_size, uint64_t key)
+{
+    const Kwr_HashMapBytes *map = map_;
+    if (!map || !map->count)  return NULL;
+    requires(key_size != Kwr_HashStringKey || key);
+
+    key = Kwr_HashKeyBits(key, key_size);
+    size_t index = Kwr_HashLocate(map, slot_size, key_size, key, Kwr_HashKey(key, key_size));
+    return index < map->capacity? (void*)(map->slots + index * slot_size): NULL;
+}
+
+size_t Kwr_HashMapInsert(void *map_, size_t slot_size, size_t key_size, uint64_t key)
+{
+    requires(map_);
+    requires(key_size != Kwr_HashStringKey || key);
+
+    Kwr_HashMapBytes *map = map_;
+    key = Kwr_HashKeyBits(key, key_size);
+    uint64_t hash = Kwr_HashKey(key, key_size);
+    size_t index = Kwr_HashLocate(map, slot_size, key_size, key, hash);
+    if (index < map->capacity)  return index;
+
+    requires_m(map->used < Kwr_HashMapMaxLoad(map->capacity), "hash map full; reserve before inserting");
+    uint8_t *ctrl = Kwr_HashCtrl(map, slot_size);
+    index = Kwr_HashFindFree(map, ctrl, hash);
+    if (ctrl[index] == Kwr_HashEmpty)  ++map->used;
+    ++map->count;
+    Kwr_HashSetCtrl(map, ctrl, index, hash & 0x7F);
+
+    char *slot = map->slots + index * slot_size;
+    memset(slot, 0, slot_size);
+    Kwr_HashStoreKey(slot, key_size, key);
+    return index;
+}
+
+_Bool Kwr_HashMapRemove(void *map_, size_t slot_size, size_t key_size, uint64_t key)
+{
+    Kwr_HashMapBytes *map = map_;
+    if (!map || !map->count)  return false;
+    requires(key_size != Kwr_HashStringKey || key);
+
+    key = Kwr_HashKeyBits(key, key_size);
+    size_t index = Kwr_HashLocate(map, slot_size, key_size, key, Kwr_HashKey(key, key_size));
+    if (index == map->capacity)  return false;
+
+    // A slot can go back to empty if no group holding it was ever full,
+    // because then no probe has passed over it (as in Abseil)
+    uint8_t *ctrl = Kwr_HashCtrl(map, slot_size);
+    uint32_t empty_after  = Kwr_HashGroupMatch(ctrl + index, Kwr_HashEmpty);
+    uint32_t empty_before = Kwr_HashGroupMatch(ctrl + ((index - Kwr_HashGroup) & (map->capacity - 1)), Kwr_HashEmpty);
+    _Bool never_full = empty_after && empty_before &&
+        __builtin_ctz(empty_after) + (__builtin_clz(empty_before) - 16) < Kwr_HashGroup;
+
+    Kwr_HashSetCtrl(map, ctrl, index, never_full? Kwr_HashEmpty: Kwr_HashDeleted);
+    if (never_full)  --map->used;
+    --map->count;
+    return true;
+}
+
+static size_t Kwr_HashCapacityFor(size_t num_keys)
+{
+    size_t capacity = Kwr_HashMinCapacity;
+    while (Kwr_HashMapMaxLoad(capacity) < num_keys) {
+        requires_m(capacity <= SIZE_MAX / 4, "hash map capacity overflow");
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Move the filled slots into a new table of capacity slots
+static Kwr_HashMapBytes *Kwr_HashRebuild(Kwr_HashMapBytes *map, Kwr_Arena *arena, size_t slot_size, size_t key_size, size_t capacity)
+{
+    requires(slot_size > 0);
+    requires_m(capacity <= (SIZE_MAX - sizeof(Kwr_HashMapBytes) - Kwr_HashGroup) / (slot_size + 1), "hash map capacity overflow");
+
+    size_t size = sizeof(Kwr_HashMapBytes) + capacity * (slot_size + 1) + Kwr_HashGroup;
+    Kwr_HashMapBytes *table = arena? Kwr_ArenaAlloc(arena, size): kalloc(NULL, size);
+    if (!table) {
+        AssertFailure(SOURCE_LINE_STR " Hash map allocation failed", __func__);
+        return map;
+    }
+
+    size_t count = map? map->count: 0;
+    *table = (Kwr_HashMapBytes){ .count = count, .capacity = capacity, .used = count, .arena = arena };
+    uint8_t *ctrl = Kwr_HashCtrl(table, slot_size);
+    memset(ctrl, Kwr_HashEmpty, capacity + Kwr_HashGroup);
+
+    if (map) {
+        const uint8_t *old_ctrl = Kwr_HashCtrl(map, slot_size);
+        for (size_t i = 0; i < map->capacity; ++i) {
+            if (old_ctrl[i] & 0x80)  continue;
+            const char *slot = map->slots + i * slot_size;
+            uint64_t hash = Kwr_HashKey(Kwr_HashLoadKey(slot, key_size), key_size);
+            size_t index = Kwr_HashFindFree(table, ctrl, hash);
+            Kwr_HashSetCtrl(table, ctrl, index, hash & 0x7F);
+            memcpy(table->slots + index * slot_size, slot, slot_size);
+        }
+        Kwr_HashMapDispose(map);
+    }
+    return table;
+}
+
+void *Kwr_HashMapReserve(void *map_, Kwr_Arena *arena, size_t slot_size, size_t key_size, size_t num_keys)
+{
+    Kwr_HashMapBytes *map = map_;
+    if (!map)  return Kwr_HashRebuild(NULL, arena, slot_size, key_size, Kwr_HashCapacityFor(num_keys));
+    if (map->used + num_keys <= Kwr_HashMapMaxLoad(map->capacity))  return map;
+
+    // Rebuilding at the same size clears deleted slots; doubling once
+    // half full keeps a remove-insert cycle from rebuilding every time
+    size_t keys = map->count + num_keys;
+    size_t capacity = Kwr_HashCapacityFor(keys);
+    if (capacity <= map->capacity)  capacity = keys > Kwr_HashMapMaxLoad(map->capacity) / 2? 2 * map->capacity: map->capacity;
+    return Kwr_HashRebuild(map, map->arena, slot_size, key_size, capacity);
+}
+
+void *Kwr_HashMapRehash(void *map_, size_t slot_size, size_t key_size, size_t num_keys)
+{
+    Kwr_HashMapBytes *map = map_;
+    if (map && num_keys < map->count)  num_keys = map->count;
+    return Kwr_HashRebuild(map, map? map->arena: NULL, slot_size, key_size, Kwr_HashCapacityFor(num_keys));
+}
+
+size_t Kwr_HashMapNext(const void *map_, size_t slot_size, size_t index)
+{
+    const Kwr_HashMapBytes *map = map_;
+    if (!map)  return 0;
+
+    const uint8_t *ctrl = Kwr_HashCtrl(map, slot_size);
+    while (index < map->capacity && (ctrl[index] & 0x80))  ++index;
+    return index;
+}
+
+void Kwr_HashMapClear(void *map_, size_t slot_size)
+{
+    Kwr_HashMapBytes *map = map_;
+    if (map) {  // okay to pass NULL, just ignore it
+        memset(Kwr_HashCtrl(map, slot_size), Kwr_HashEmpty, map->capacity + Kwr_HashGroup);
+        map->count = map->used = 0;
+    }
+}
+
+void Kwr_HashMapDispose(void *map_)
+{
+    Kwr_HashMapBytes *map = map_;
+    if (map && !map->arena)  kfree(map);  // arena maps go with the arena; okay to pass NULL
+}
+
+
+//------------------------------------------------------------
+//# Formatting
+
+Kwr_Buffer Kwr_InitBuffer(char *memory, size_t size)
+{
+    requires(memory && size > 0);
+    memory[0] = '\0';
+    return (Kwr_Buffer){ .begin = memory, .capacity = size - 1 };
+}
+
+Kwr_Buffer Kwr_InitTextBuffer(Kwr_Text *text)
+{
+    if (!text)  text = new_dynarray(char, 64);
+    if (!text)  AssertFailure(SOURCE_LINE_STR " Text allocation failed", __func__);
+    if (is_full(text))  reserve(text, 1);
+    text->begin[text->length] = '\0';
+    return (Kwr_Buffer){ .begin = text->begin, .length = text->length, .capacity = text->capacity - 1, .text = text };
+}
+
+// Room for n more chars and the NUL, growing the text if there is one;
+// returns how many of the n fit
+static size_t Kwr_BufferRoom(Kwr_Buffer *buf, size_t n)
+{
+    if (buf->text && buf->length + n > buf->capacity) {
+        buf->text->length = buf->length;
+        reserve(buf->text, n + 1);
+        buf->begin = buf->text->begin;
+        buf->capacity = buf->text->capacity - 1;
+    }
+    if (buf->length >= buf->capacity)  return 0;
+    return n < buf->capacity - buf->length? n: buf->capacity - buf->length;
+}
+
+// Once a fixed buffer is full its NUL is in place at the capacity, and
+// later appends only count
+static void Kwr_BufferAdvance(Kwr_Buffer *buf, size_t n, size_t written)
+{
+    if (buf->length < buf->capacity)  buf->begin[buf->length + written] = '\0';
+    buf->length += n;
+    if (buf->text)  buf->text->length = buf->length;
+}
+
+void Kwr_AppendBytes(Kwr_Buffer *buf, const char *bytes, size_t n)
+{
+    requires(buf && (bytes || !n));
+    size_t room = Kwr_BufferRoom(buf, n);
+    memcpy(buf->begin + buf->length, bytes, room);
+    Kwr_BufferAdvance(buf, n, room);
+}
+
+void Kwr_AppendString(Kwr_Buffer *buf, const char *string)
+{
+    if (!string)  string = "(null)";
+    Kwr_AppendBytes(buf, string, strlen(string));
+}
+
+void Kwr_AppendChar(Kwr_Buffer *buf, char c)
+{
+    Kwr_AppendBytes(buf, &c, 1);
+}
+
+static const char kwr_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint64_t kwr_powers_of_10[20] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u,
+    10000000000u, 100000000000u, 1000000000000u, 10000000000000u, 100000000000000u,
+    1000000000000000u, 10000000000000000u, 100000000000000000u, 1000000000000000000u,
+    10000000000000000000u,
+};
+
+// 1233/4096 ~ log10(2) estimates the digits from the bit length
+static int Kwr_CountDigits(uint64_t value)
+{
+    int estimate = (64 - __builtin_clzll(value | 1)) * 1233 >> 12;
+    return estimate + (value >= kwr_powers_of_10[estimate]) + (value == 0);
+}
+
+// Write the digits of value ending just before end
+static void Kwr_PutDigits(char *end, uint64_t value)
+{
+    while (value >= 100) {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--end = kwr_digit_pairs[pair + 1];
+        *--end = kwr_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--end = kwr_digit_pairs[value * 2 + 1];
+        *--end = kwr_digit_pairs[value * 2];
+    }
+    else {
+        *--end = (char)('0' + value);
+    }
+}
+
+static size_t Kwr_WriteUnsigned(char *out, uint64_t value)
+{
+    int digits = Kwr_CountDigits(value);
+    Kwr_PutDigits(out + digits, value);
+    return (size_t)digits;
+}
+
+size_t Kwr_FormatUnsigned(char out[Kwr_IntChars], uint64_t value)
+{
+    return Kwr_WriteUnsigned(out, value);
+}
+
+size_t Kwr_FormatInt(char out[Kwr_IntChars], int64_t value)
+{
+    if (value >= 0)  return Kwr_WriteUnsigned(out, (uint64_t)value);
+    out[0] = '-';
+    return 1 + Kwr_WriteUnsigned(out + 1, 0 - (uint64_t)value);
+}
+
+// Ryu: the shortest decimal in the interval of reals that round to the 
+// double, closest to its exact value.  The 128-bit powers of 5 are 
+// computed on first use.
+
+#define    KWR_POW5_INV_BITS   125
+#define    KWR_POW5_BITS       125
+#define    KWR_POW5_INV_COUNT  342
+#define    KWR_POW5_COUNT      326
+#define    KWR_BIG_WORDS       32    // 32-bit words, enough for 2^(pow5bits(341) + 124)
+
+static uint64_t kwr_pow5_inv[KWR_POW5_INV_COUNT][2];   // low, high
+static uint64_t kwr_pow5[KWR_POW5_COUNT][2];
+static pthread_once_t kwr_pow5_once = PTHREAD_ONCE_INIT;
+
+static inline int Kwr_Pow5Bits(int e)    { return (int)(((uint32_t)e * 1217359) >> 19) + 1; }
+static inline int Kwr_Log10Pow2(int e)   { return (int)(((uint32_t)e * 78913) >> 18); }
+static inline int Kwr_Log10Pow5(int e)   { return (int)(((uint32_t)e * 732923) >> 20); }
+
+// Bits [shift, shift+128) of a little-endian big number
+static void Kwr_BigBits(const uint32_t *big, int shift, uint64_t out[2])
+{
+    uint32_t words[4];
+    for (int w = 0; w < 4; ++w) {
+        int bit = shift + 32 * w;
+        uint64_t lo = (bit >= 0 && bit / 32 < KWR_BIG_WORDS)? big[bit / 32]: 0;
+        uint64_t hi = (bit >= -32 && bit / 32 + 1 < KWR_BIG_WORDS && bit + 32 >= 0)? big[(bit + 32) / 32]: 0;
+        if (bit < 0) {
+            words[w] = (bit <= -32)? 0: (uint32_t)(hi << (-bit));
+        }
+        else {
+            words[w] = (uint32_t)(((hi << 32) | lo) >> (bit % 32));
+        }
+    }
+    out[0] = (uint64_t)words[1] << 32 | words[0];
+    out[1] = (uint64_t)words[3] << 32 | words[2];
+}
+
+static int Kwr_BigBitLength(const uint32_t *big)
+{
+    for (int w = KWR_BIG_WORDS - 1; w >= 0; --w) {
+        if (big[w])  return 32 * w + 32 - __builtin_clz(big[w]);
+    }
+    return 0;
+}
+
+static void Kwr_InitPow5Tables(void)
+{
+    // 5^i, each truncated to its top KWR_POW5_BITS bits
+    uint32_t big[KWR_BIG_WORDS] = { 1 };
+    for (int i = 0; i < KWR_POW5_COUNT; ++i) {
+        Kwr_BigBits(big, Kwr_BigBitLength(big) - KWR_POW5_BITS, kwr_pow5[i]);
+        uint64_t carry = 0;
+        for (int w = 0; w < KWR_BIG_WORDS; ++w) {
+            carry += (uint64_t)big[w] * 5;
+            big[w] = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+
+    // floor(2^j / 5^q) + 1 for j = pow5bits(q) - 1 + KWR_POW5_INV_BITS, as
+    // floor(2^top / 5^q) >> (top - j): nested floors of divisions compose
+    int top = Kwr_Pow5Bits(KWR_POW5_INV_COUNT - 1) - 1 + KWR_POW5_INV_BITS;
+    memset(big, 0, sizeof(big));
+    big[top / 32] = 1u << (top % 32);
+    for (int q = 0; q < KWR_POW5_INV_COUNT; ++q) {
+        int j = Kwr_Pow5Bits(q) - 1 + KWR_POW5_INV_BITS;
+        uint64_t *inv = kwr_pow5_inv[q];
+        Kwr_BigBits(big, top - j, inv);
+        inv[1] += (++inv[0] == 0);
+
+        uint64_t rem = 0;
+        for (int w = KWR_BIG_WORDS - 1; w >= 0; --w) {
+            uint64_t cur = rem << 32 | big[w];
+            big[w] = (uint32_t)(cur / 5);
+            rem = cur % 5;
+        }
+    }
+}
+
+// (m * mul) >> j for a 64-bit m, 128-bit mul and j >= 64
+static inline uint64_t Kwr_MulShift64(uint64_t m, const uint64_t mul[2], int j)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 b0 = (unsigned __int128)m * mul[0];
+    unsigned __int128 b2 = (unsigned __int128)m * mul[1];
+    return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+#else
+    // 64 x 64 -> 128 from 32-bit halves
+    uint64_t parts[2][2];
+    for (int k = 0; k < 2; ++k) {
+        uint64_t a_lo = (uint32_t)m, a_hi = m >> 32, b_lo = (uint32_t)mul[k], b_hi = mul[k] >> 32;
+        uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+        uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+        parts[k][0] = (cross << 32) | (uint32_t)lo_lo;
+        parts[k][1] = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    }
+    uint64_t lo = parts[0][1] + parts[1][0];
+    uint64_t hi = parts[1][1] + (lo < parts[0][1]);
+    int shift = j - 64;
+    return shift? (hi << (64 - shift)) | (lo >> shift): lo;
+#endif
+}
+
+static inline _Bool Kwr_MultipleOfPow5(uint64_t value, int p)
+{
+    int count = 0;
+    for (; value % 5 == 0 && value; value /= 5)  ++count;
+    return count >= p;
+}
+
+static inline _Bool Kwr_MultipleOfPow2(uint64_t value, int p)
+{
+    return (value & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+// Shortest digits and decimal exponent of a finite, positive double
+static uint64_t Kwr_ShortestDigits(uint64_t mantissa, int exponent, int *e10_out)
+{
+    int e2;
+    uint64_t m2;
+    if (exponent == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = mantissa;
+    }
+    else {
+        e2 = exponent - 1023 - 52 - 2;
+        m2 = (UINT64_C(1) << 52) | mantissa;
+    }
+    _Bool accept_bounds = (m2 & 1) == 0;
+    uint64_t mv = 4 * m2;
+    unsigned mm_shift = mantissa != 0 || exponent <= 1;
+
+    // Bounds of the reals that round to this double, in 2^e2 units:
+    // [mv - 1 - mm_shift, mv + 2], scaled to a power of ten
+    uint64_t vr, vp, vm;
+    int e10;
+    _Bool vm_trailing_zeros = false, vr_trailing_zeros = false;
+    if (e2 >= 0) {
+        int q = Kwr_Log10Pow2(e2) - (e2 > 3);
+        e10 = q;
+        int k = KWR_POW5_INV_BITS + Kwr_Pow5Bits(q) - 1;
+        int i = -e2 + q + k;
+        vr = Kwr_MulShift64(4 * m2, kwr_pow5_inv[q], i);
+        vp = Kwr_MulShift64(4 * m2 + 2, kwr_pow5_inv[q], i);
+        vm = Kwr_MulShift64(4 * m2 - 1 - mm_shift, kwr_pow5_inv[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0)         vr_trailing_zeros = Kwr_MultipleOfPow5(mv, q);
+            else if (accept_bounds)  vm_trailing_zeros = Kwr_MultipleOfPow5(mv - 1 - mm_shift, q);
+            else                     vp -= Kwr_MultipleOfPow5(mv + 2, q);
+        }
+    }
+    else {
+        int q = Kwr_Log10Pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        int i = -e2 - q;
+        int k = Kwr_Pow5Bits(i) - KWR_POW5_BITS;
+        int j = q - k;
+        vr = Kwr_MulShift64(4 * m2, kwr_pow5[i], j);
+        vp = Kwr_MulShift64(4 * m2 + 2, kwr_pow5[i], j);
+        vm = Kwr_MulShift64(4 * m2 - 1 - mm_shift, kwr_pow5[i], j);
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds)  vm_trailing_zeros = mm_shift == 1;
+            else                --vp;
+        }
+        else if (q < 63) {
+            vr_trailing_zeros = Kwr_MultipleOfPow2(mv, q);
+        }
+    }
+
+    // Drop digits while the bounds still differ
+    int removed = 0;
+    unsigned last_removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        for (; vp / 10 > vm / 10; ++removed) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (unsigned)(vr % 10);
+            vr /= 10;  vp /= 10;  vm /= 10;
+        }
+        if (vm_trailing_zeros) {
+            for (; vm % 10 == 0; ++removed) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (unsigned)(vr % 10);
+                vr /= 10;  vp /= 10;  vm /= 10;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)  last_removed = 4;   // round half even
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    }
+    else {
+        _Bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;  vp /= 100;  vm /= 100;
+            removed += 2;
+        }
+        for (; vp / 10 > vm / 10; ++removed) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;  vp /= 10;  vm /= 10;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    *e10_out = e10 + removed;
+    return output;
+}
+
+size_t Kwr_FormatDouble(char out[Kwr_DoubleChars], double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+    int exponent = (int)(bits >> 52 & 0x7FF);
+
+    char *at = out;
+    if (exponent == 0x7FF) {
+        if (mantissa) {
+            memcpy(out, "nan", 3);
+            return 3;
+        }
+        if (bits >> 63)  *at++ = '-';
+        memcpy(at, "inf", 3);
+        return (size_t)(at - out) + 3;
+    }
+    if (bits >> 63)  *at++ = '-';
+    if (!exponent && !mantissa) {
+        *at++ = '0';
+        return (size_t)(at - out);
+    }
+
+    pthread_once(&kwr_pow5_once, Kwr_InitPow5Tables);
+    int e10;
+    uint64_t digits = Kwr_ShortestDigits(mantissa, exponent, &e10);
+    int num_digits = Kwr_CountDigits(digits);
+    int point = e10 + num_digits;     // digits before the decimal point
+
+    if (point > -5 && point <= 17) {
+        if (point <= 0) {
+            // 0.000ddd
+            *at++ = '0';
+            *at++ = '.';
+            for (int z = 0; z < -point; ++z)  *at++ = '0';
+            Kwr_PutDigits(at + num_digits, digits);
+            at += num_digits;
+        }
+        else if (point >= num_digits) {
+            // ddd000
+            Kwr_PutDigits(at + num_digits, digits);
+            at += num_digits;
+            for (int z = num_digits; z < point; ++z)  *at++ = '0';
+        }
+        else {
+            // ddd.ddd
+            Kwr_PutDigits(at + num_digits + 1, digits);
+            memmove(at, at + 1, (size_t)point);
+            at[point] = '.';
+            at += num_digits + 1;
+        }
+        return (size_t)(at - out);
+    }
+
+    // d.ddde+XX
+    Kwr_PutDigits(at + num_digits + 1, digits);
+    at[0] = at[1];
+    if (num_digits > 1) {
+        at[1] = '.';
+        at += num_digits + 1;
+    }
+    else {
+        at += 1;
+    }
+    int e = point - 1;
+    *at++ = 'e';
+    *at++ = e < 0? '-': '+';
+    if (e < 0)  e = -e;
+    if (e < 10)  *at++ = '0';
+    at += Kwr_WriteUnsigned(at, (uint64_t)e);
+    return (size_t)(at - out);
+}
+
+void Kwr_AppendUnsigned(Kwr_Buffer *buf, uint64_t value)
+{
+    char digits[Kwr_IntChars];
+    Kwr_AppendBytes(buf, digits, Kwr_FormatUnsigned(digits, value));
+}
+
+void Kwr_AppendInt(Kwr_Buffer *buf, int64_t value)
+{
+    char digits[Kwr_IntChars];
+    Kwr_AppendBytes(buf, digits, Kwr_FormatInt(digits, value));
+}
+
+void Kwr_AppendZeroPadded(Kwr_Buffer *buf, uint64_t value, int width)
+{
+    char digits[Kwr_IntChars];
+    size_t n = Kwr_FormatUnsigned(digits, value);
+    for (; width > (int)n; --width)  Kwr_AppendChar(buf, '0');
+    Kwr_AppendBytes(buf, digits, n);
+}
+
+void Kwr_AppendDouble(Kwr_Buffer *buf, double value)
+{
+    char digits[Kwr_DoubleChars];
+    Kwr_AppendBytes(buf, digits, Kwr_FormatDouble(digits, value));
+}
+
+void Kwr_AppendHex(Kwr_Buffer *buf, uint64_t value)
+{
+    char digits[18] = "0x";
+    int n = value? (67 - __builtin_clzll(value)) / 4: 1;
+    for (int i = n - 1; i >= 0; --i, value >>= 4)  digits[2 + i] = "0123456789abcdef"[value & 15];
+    Kwr_AppendBytes(buf, digits, 2 + (size_t)n);
+}
+
+void Kwr_AppendStatus(Kwr_Buffer *buf, const Status *stat)
+{
+    requires(stat);
+    Kwr_AppendString(buf, ErrorCode_String(stat->error));
+    Kwr_AppendBytes(buf, ": \"", 3);
+    Kwr_AppendString(buf, stat->message);
+    Kwr_AppendBytes(buf, "\" in function ", 14);
+    Kwr_AppendString(buf, stat->function);
+    Kwr_AppendBytes(buf, "()", 2);
+}
+
+
+//------------------------------------------------------------
+//# Priority Queue
+
+ErrorCode Kwr_InitIndexHeap(Kwr_IndexHeap *heap, uint32_t capacity)
+{
+    requires(heap);
+    requires(capacity < Kwr_HeapAbsent);
+
+    *heap = (Kwr_IndexHeap){ .capacity = capacity };
+    heap->items      = kalloc(NULL, (size_t)capacity * sizeof(uint32_t));
+    heap->slots      = kalloc(NULL, (size_t)capacity * sizeof(uint32_t));
+    heap->priorities = kalloc(NULL, (size_t)capacity * sizeof(uint64_t));
+    if (capacity && (!heap->items || !heap->slots || !heap->priorities)) {
+        Kwr_DisposeIndexHeap(heap);
+        return ErrorCode_AllocationFailed;
+    }
+    for (uint32_t item = 0; item < capacity; ++item)  heap->slots[item] = Kwr_HeapAbsent;
+    return ErrorCode_OK;
+}
+
+void Kwr_DisposeIndexHeap(Kwr_IndexHeap *heap)
+{
+    if (heap) {  // okay to pass NULL, just ignore it
+        kfree(heap->items);
+        kfree(heap->slots);
+        kfree(heap->priorities);
+        *heap = (Kwr_IndexHeap){0};
+    }
+}
+
+void Kwr_HeapClear(Kwr_IndexHeap *heap)
+{
+    requires(heap);
+    for (uint32_t slot = 0; slot < heap->count; ++slot)  heap->slots[heap->items[slot]] = Kwr_HeapAbsent;
+    heap->count = 0;
+}
+
+static void Kwr_HeapPlace(Kwr_IndexHeap *heap, uint32_t slot, uint32_t item)
+{
+    heap->items[slot] = item;
+    heap->slots[item] = slot;
+}
+
+static void Kwr_HeapSiftUp(Kwr_IndexHeap *heap, uint32_t slot, uint32_t item)
+{
+    uint64_t priority = heap->priorities[item];
+    while (slot > 0) {
+        uint32_t parent = (slot - 1) / 2;
+        if (heap->priorities[heap->items[parent]] <= priority)  break;
+        Kwr_HeapPlace(heap, slot, heap->items[parent]);
+        slot = parent;
+    }
+    Kwr_HeapPlace(heap, slot, item);
+}
+
+static void Kwr_HeapSiftDown(Kwr_IndexHeap *heap, uint32_t slot, uint32_t item)
+{
+    uint64_t priority = heap->priorities[item];
+    for (;;) {
+        uint32_t child = 2 * slot + 1;
+        if (child >= heap->count)  break;
+        if (child + 1 < heap->count && heap->priorities[heap->items[child + 1]] < heap->priorities[heap->items[child]])  ++child;
+        if (priority <= heap->priorities[heap->items[child]])  break;
+        Kwr_HeapPlace(heap, slot, heap->items[child]);
+        slot = child;
+    }
+    Kwr_HeapPlace(heap, slot, item);
+}
+
+// Insert item, or lower its priority if already queued.  Returns false
+// when the item was queued with a priority no greater than the new one.
+_Bool Kwr_HeapPush(Kwr_IndexHeap *heap, uint32_t item, uint64_t priority)
+{
+    requires(heap);
+    requires(item < heap->capacity);
+
+    uint32_t slot = heap->slots[item];
+    if (slot == Kwr_HeapAbsent)  slot = heap->count++;
+    else if (heap->priorities[item] <= priority)  return false;
+
+    heap->priorities[item] = priority;
+    Kwr_HeapSiftUp(heap, slot, item);
+    return true;
+}
+
+uint32_t Kwr_HeapPop(Kwr_IndexHeap *heap)
+{
+    requires(heap);
+    requires(heap->count > 0);
+
+    uint32_t top  = heap->items[0];
+    uint32_t last = heap->items[--heap->count];
+    heap->slots[top] = Kwr_HeapAbsent;
+    if (heap->count)  Kwr_HeapSiftDown(heap, 0, last);
+    return top;
+}
+
+
+//------------------------------------------------------------
+//# Images
+
+ErrorCode Kwr_InitImage(Kwr_Image *image)
+{
+    requires(image);
+    requires(image->width > 0 && image->height > 0);
+    requires(image->channels == 1 || image->channels == 4);
+
+    image->stride = (size_t)image->width * image->channels;
+    image->pixels = kcalloc((size_t)image->height, image->stride);
+    return image->pixels? ErrorCode_OK: ErrorCode_AllocationFailed;
+}
+
+void Kwr_DisposeImage(Kwr_Image *image)
+{
+    if (image) {  // okay to pass NULL, just ignore it
+        kfree(image->pixels);
+        *image = (Kwr_Image){0};
+    }
+}
+
+// Clipped to the image.  color has one byte per channel.
+void Kwr_ImageFillRect(Kwr_Image *image, int x, int y, int w, int h, const uint8_t *color)
+{
+    requires(image && image->pixels);
+    requires(color);
+
+    int x1 = x + w, y1 = y + h;
+    if (x < 0)  x = 0;
+    if (y < 0)  y = 0;
+    if (x1 > image->width)   x1 = image->width;
+    if (y1 > image->height)  y1 = image->height;
+    if (x >= x1 || y >= y1)  return;
+
+    // Fill the first row a span at a time, copy it to the rest
+    size_t span = (size_t)(x1 - x) * image->channels;
+    uint8_t *first = Kwr_ImageRow(image, y) + (size_t)x * image->channels;
+    if (image->channels == 1)  memset(first, color[0], span);
+    else {
+        uint32_t pixel;
+        memcpy(&pixel, color, sizeof(pixel));
+        for (size_t i = 0; i < span; i += sizeof(pixel))  memcpy(first + i, &pixel, sizeof(pixel));
+    }
+    for (int row = y + 1; row < y1; ++row) {
+        memcpy(Kwr_ImageRow(image, row) + (size_t)x * image->channels, first, span);
+    }
+}
+
+ErrorCode Kwr_WriteImage(Kwr_Image *image, const char *path)
+{
+    requires(image && image->pixels);
+    requires(path);
+
+    FILE *file = fopen(path, "wb");
+    if (!file)  return ErrorCode_Error;
+
+    _Bool gray = image->channels == 1;
+    fprintf(file, "%s\n%d %d\n255\n", gray? "P5": "P6", image->width, image->height);
+
+    uint8_t *rgb = gray? NULL: kalloc(NULL, (size_t)image->width * 3);
+    _Bool ok = gray || rgb;
+    for (int y = 0; ok && y < image->height; ++y) {
+        const uint8_t *row = Kwr_ImageRow(image, y);
+        if (!gray) {
+            for (int x = 0; x < image->width; ++x) {
+                memcpy(rgb + 3*x, row + 4*x, 3);
+            }
+            row = rgb;
+        }
+        ok = fwrite(row, 1, (size_t)image->width * (gray? 1: 3), file) == (size_t)image->width * (gray? 1: 3);
+    }
+
+    kfree(rgb);
+    if (fclose(file) != 0)  ok = false;
+    return ok? ErrorCode_OK: ErrorCode_Error;
+}
+
+
+//------------------------------------------------------------
+//# Mapped Files
+
+ErrorCode Kwr_MapFile(const char *path, void **data, size_t *size)
+{
+    requires(path);
+    requires(data && size);
+    *data = NULL;
+    *size = 0;
+
+#ifdef KWR_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)  return ErrorCode_Error;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return ErrorCode_Error;
+    }
+
+    void *map = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);   // the mapping keeps the file open
+    if (map == MAP_FAILED)  return ErrorCode_Error;
+
+    *data = map;
+    *size = (size_t)info.st_size;
+    return ErrorCode_OK;
+#else
+    FILE *file = fopen(path, "rb");
+    if (!file)  return ErrorCode_Error;
+
+    long length = (fseek(file, 0, SEEK_END) == 0)? ftell(file): -1;
+    void *buffer = (length > 0)? kalloc(NULL, (size_t)length): NULL;
+    _Bool ok = buffer && fseek(file, 0, SEEK_SET) == 0 && fread(buffer, 1, (size_t)length, file) == (size_t)length;
+    fclose(file);
+    if (!ok) {
+        ErrorCode error = buffer? ErrorCode_Error: ErrorCode_AllocationFailed;
+        kfree(buffer);
+        return error;
+    }
+
+    *data = buffer;
+    *size = (size_t)length;
+    return ErrorCode_OK;
+#endif
+}
+
+void Kwr_UnmapFile(void *data, size_t size)
+{
+    if (!data)  return;   // okay to pass NULL, just ignore it
+#ifdef KWR_HAS_MMAP
+    munmap(data, size);
+#else
+    UNUSED(size);
+    kfree(data);
+#endif
+}
+
+
+//------------------------------------------------------------
+//# Concurrency
+
+int Kwr_CountCpus(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0? (int)cpus: 1;
+#else
+    return 1;
+#endif
+}
+
+typedef struct Kwr_ParallelJob {
+    Kwr_TaskFn fn;
+    void *data;
+    size_t num_tasks;
+    atomic_size_t next_task;
+} Kwr_ParallelJob;
+
+static void *Kwr_ParallelWorker(void *arg)
+{
+    Kwr_ParallelJob *job = arg;
+    for (size_t task; (task = atomic_fetch_add(&job->next_task, 1)) < job->num_tasks; ) {
+        job->fn(job->data, task);
+    }
+    return NULL;
+}
+
+void Kwr_ParallelFor(size_t num_tasks, int num_threads, Kwr_TaskFn fn, void *data)
+{
+    requires(fn);
+
+    if (num_threads <= 0)  num_threads = Kwr_CountCpus();
+    if (num_threads > KWR_MAX_THREADS)  num_threads = KWR_MAX_THREADS;
+    if ((size_t)num_threads > num_tasks)  num_threads = (int)num_tasks;
+
+    Kwr_ParallelJob job = { .fn = fn, .data = data, .num_tasks = num_tasks };
+    atomic_init(&job.next_task, 0);
+
+    // The calling thread is one of the workers
+    pthread_t threads[KWR_MAX_THREADS];
+    int started = 0;
+    while (started < num_threads - 1 && !pthread_create(&threads[started], NULL, Kwr_ParallelWorker, &job)) {
+        ++started;
+    }
+
+    Kwr_ParallelWorker(&job);
+    while (started)  pthread_join(threads[--started], NULL);
+}
+
+
+//------------------------------------------------------------
+//# Clock and Profiling
+
+// TSC ticks convert to ns as base_ns + (ticks - base_ticks) * ns_per_tick,
+// with ns_per_tick in 32.32 fixed point
+static struct {
+    atomic_bool  ready;
+    _Bool        use_tsc;
+    uint64_t     base_ns, base_ticks, ns_per_tick;
+} kwr_clock;
+
+static pthread_once_t kwr_clock_once = PTHREAD_ONCE_INIT;
+
+#define    KWR_CLOCK_CALIBRATION_NS  5000000
+
+static uint64_t Kwr_ClockGettime(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void Kwr_CalibrateClock(void)
+{
+#if KWR_HAS_TSC
+    unsigned eax, ebx, ecx, edx;
+    _Bool invariant = __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx >> 8 & 1);
+    if (invariant) {
+        uint64_t start_ns = Kwr_ClockGettime(CLOCK_MONOTONIC), start_ticks = __rdtsc();
+        uint64_t end_ns, end_ticks;
+        do {
+            end_ns = Kwr_ClockGettime(CLOCK_MONOTONIC);
+            end_ticks = __rdtsc();
+        } while (end_ns - start_ns < KWR_CLOCK_CALIBRATION_NS);
+
+        if (end_ticks > start_ticks) {
+            kwr_clock.ns_per_tick = ((end_ns - start_ns) << 32) / (end_ticks - start_ticks);
+            kwr_clock.base_ns     = end_ns;
+            kwr_clock.base_ticks  = end_ticks;
+            kwr_clock.use_tsc     = kwr_clock.ns_per_tick > 0;
+        }
+    }
+#endif
+    atomic_store_explicit(&kwr_clock.ready, true, memory_order_release);
+}
+
+uint64_t Kwr_ClockNow(void)
+{
+    if (!atomic_load_explicit(&kwr_clock.ready, memory_order_acquire))  pthread_once(&kwr_clock_once, Kwr_CalibrateClock);
+
+#if KWR_HAS_TSC
+    if (kwr_clock.use_tsc) {
+        uint64_t ticks = __rdtsc() - kwr_clock.base_ticks;
+        uint64_t ns = (ticks >> 32) * kwr_clock.ns_per_tick + (((ticks & 0xFFFFFFFF) * kwr_clock.ns_per_tick) >> 32);
+        return kwr_clock.base_ns + ns;
+    }
+#endif
+    return Kwr_ClockGettime(CLOCK_MONOTONIC);
+}
+
+const char *Kwr_ClockSource(void)
+{
+    Kwr_ClockNow();
+    return kwr_clock.use_tsc? "tsc": "clock_gettime";
+}
+
+static _Atomic(Kwr_ProfileZone *) kwr_profile_zones;
+
+static void Kwr_RegisterZone(Kwr_ProfileZone *zone)
+{
+    _Bool registered = false;
+    if (!atomic_compare_exchange_strong(&zone->registered, &registered, true))  return;
+
+    zone->next = atomic_load(&kwr_profile_zones);
+    while (!atomic_compare_exchange_weak(&kwr_profile_zones, &zone->next, zone))  {}
+}
+
+uint64_t Kwr_EnterZone(Kwr_ProfileZone *zone)
+{
+    if (!atomic_load_explicit(&zone->registered, memory_order_relaxed))  Kwr_RegisterZone(zone);
+    return Kwr_ClockNow();
+}
+
+void Kwr_LeaveZone(Kwr_ProfileZone *zone, uint64_t start)
+{
+    uint64_t ns = Kwr_ClockNow() - start;
+    int bucket = ns? 63 - __builtin_clzll(ns): 0;
+    if (bucket >= KWR_PROFILE_BUCKETS)  bucket = KWR_PROFILE_BUCKETS - 1;
+
+    atomic_fetch_add_explicit(&zone->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&zone->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&zone->buckets[bucket], 1, memory_order_relaxed);
+
+    uint64_t min = atomic_load_explicit(&zone->min_ns, memory_order_relaxed);
+    while (ns < min && !atomic_compare_exchange_weak_explicit(&zone->min_ns, &min, ns, memory_order_relaxed, memory_order_relaxed))  {}
+    uint64_t max = atomic_load_explicit(&zone->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&zone->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed))  {}
+}
+
+Kwr_ProfileZone *Kwr_FindProfileZone(const char *name)
+{
+    requires(name);
+    for (Kwr_ProfileZone *zone = atomic_load(&kwr_profile_zones); zone; zone = zone->next) {
+        if (!strcmp(zone->name, name))  return zone;
+    }
+    return NULL;
+}
+
+// Zones timing at the moment may straddle the reset
+void Kwr_ResetProfile(void)
+{
+    for (Kwr_ProfileZone *zone = atomic_load(&kwr_profile_zones); zone; zone = zone->next) {
+        atomic_store(&zone->count, 0);
+        atomic_store(&zone->total_ns, 0);
+        atomic_store(&zone->min_ns, UINT64_MAX);
+        atomic_store(&zone->max_ns, 0);
+        for (int b = 0; b < KWR_PROFILE_BUCKETS; ++b)  atomic_store(&zone->buckets[b], 0);
+    }
+}
+
+// Upper bound of the bucket holding the given fraction of the times,
+// but no more than the max
+static uint64_t Kwr_ZonePercentile(Kwr_ProfileZone *zone, uint64_t count, double fraction)
+{
+    uint64_t max = atomic_load_explicit(&zone->max_ns, memory_order_relaxed);
+    uint64_t seen = 0, wanted = (uint64_t)(count * fraction + 0.5);
+    for (int b = 0; b < KWR_PROFILE_BUCKETS; ++b) {
+        seen += atomic_load_explicit(&zone->buckets[b], memory_order_relaxed);
+        if (seen >= wanted && seen) {
+            uint64_t bound = (UINT64_C(2) << b) - 1;
+            return bound < max? bound: max;
+        }
+    }
+    return max;
+}
+
+// One line per zone, times in microseconds, then its histogram as
+// "<=limit:count" for the buckets in use
+void Kwr_PrintProfile(void *file)
+{
+    FILE *out = file? file: stdout;
+    fprintf(out, "%-28s %10s %12s %10s %10s %10s %10s %10s  (us, clock: %s)\n", 
+            "zone", "count", "total", "mean", "min", "p50", "p99", "max", Kwr_ClockSource());
+
+    for (Kwr_ProfileZone *zone = atomic_load(&kwr_profile_zones); zone; zone = zone->next) {
+        uint64_t count = atomic_load_explicit(&zone->count, memory_order_relaxed);
+        if (!count)  continue;
+
+        uint64_t total = atomic_load_explicit(&zone->total_ns, memory_order_relaxed);
+        fprintf(out, "%-28s %10llu %12.1f %10.2f %10.2f %10.2f %10.2f %10.2f\n", zone->name, (unsigned long long)count,
+                total * 1e-3, total * 1e-3 / count, 
+                atomic_load_explicit(&zone->min_ns, memory_order_relaxed) * 1e-3,
+                Kwr_ZonePercentile(zone, count, 0.50) * 1e-3, Kwr_ZonePercentile(zone, count, 0.99) * 1e-3,
+                atomic_load_explicit(&zone->max_ns, memory_order_relaxed) * 1e-3);
+
+        fputs("   ", out);
+        for (int b = 0; b < KWR_PROFILE_BUCKETS; ++b) {
+            uint64_t n = atomic_load_explicit(&zone->buckets[b], memory_order_relaxed);
+            if (n)  fprintf(out, " <=%.3g:%llu", ((UINT64_C(2) << b) - 1) * 1e-3, (unsigned long long)n);
+        }
+        fputc('\n', out);
+    }
+    fflush(out);
+}
+
+static void Kwr_PrintProfileToStderr(void)
+{
+    Kwr_PrintProfile(stderr);
+}
+
+void Kwr_PrintProfileAtExit(void)
+{
+    static atomic_bool registered;
+    if (!atomic_exchange(&registered, true))  atexit(Kwr_PrintProfileToStderr);
+}
+
+
+//------------------------------------------------------------
+//# Logging
+//
+// Each thread claims a single-producer ring on its first log call and
+// gives it back when it exits, for the next new thread to reuse.  Rings
+// are linked into a list that only ever grows, so the log thread can
+// walk it without locks.  Records are copied out of the rings, sorted by
+// time and written with the FILE buffered on the log thread alone.
+
+typedef struct Kwr_LogRecord {
+    uint64_t      time;         // Kwr_ClockNow
+    const char   *format;
+    const char   *category;
+    uint8_t       level;
+    uint8_t       num_args;
+    uint8_t       types[KWR_LOG_MAX_ARGS];
+    Kwr_LogValue  values[KWR_LOG_MAX_ARGS];
+} Kwr_LogRecord;
+
+typedef struct Kwr_LogRing Kwr_LogRing;
+struct Kwr_LogRing {
+    atomic_size_t  head;        // next record to write, owner thread only
+    size_t         tail_seen;   // owner's last look at tail, read again only when full
+    char           pad_head[64 - sizeof(atomic_size_t) - sizeof(size_t)];
+    atomic_size_t  tail;        // next record to read, log thread only
+    char           pad_tail[64 - sizeof(atomic_size_t)];
+    atomic_bool    owned;
+    atomic_uint_least64_t dropped;
+    Kwr_LogRing   *next;
+    Kwr_LogRecord  records[KWR_LOG_RING_RECORDS];
+};
+
+_Static_assert((KWR_LOG_RING_RECORDS & (KWR_LOG_RING_RECORDS - 1)) == 0, "KWR_LOG_RING_RECORDS must be a power of two");
+
+typedef dynarray(Kwr_LogRecord) Kwr_LogBatch;
+
+static struct {
+    atomic_bool   open;
+    atomic_int    threshold;
+    _Atomic(Kwr_LogRing *) rings;
+    FILE         *file;
+    int64_t       wall_offset;     // CLOCK_REALTIME - Kwr_ClockNow, ns
+    pthread_t     thread;
+    atomic_bool   stop;
+    atomic_uint_least64_t flush_requested;
+    atomic_uint_least64_t flushed;
+} kwr_log;
+
+static _Thread_local Kwr_LogRing *kwr_log_ring;
+static pthread_key_t  kwr_log_ring_key;
+static pthread_once_t kwr_log_once = PTHREAD_ONCE_INIT;
+
+static const char *const kwr_log_level_names[] = { "Trace", "Debug", "Info", "Warn", "Error" };
+
+static void Kwr_ReleaseLogRing(void *ring)
+{
+    atomic_store_explicit(&((Kwr_LogRing *)ring)->owned, false, memory_order_release);
+}
+
+static void Kwr_InitLogRingKey(void)
+{
+    pthread_key_create(&kwr_log_ring_key, Kwr_ReleaseLogRing);
+}
+
+static Kwr_LogRing *Kwr_ClaimLogRing(void)
+{
+    Kwr_LogRing *ring = atomic_load(&kwr_log.rings);
+    for (; ring; ring = ring->next) {
+        _Bool owned = false;
+        if (atomic_compare_exchange_strong_explicit(&ring->owned, &owned, true, memory_order_acquire, memory_order_relaxed))  break;
+    }
+
+    if (!ring) {
+        ring = malloc(sizeof(Kwr_LogRing));   // kept for the process, outside kalloc's counts
+        if (!ring)  return NULL;
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        ring->tail_seen = 0;
+        atomic_init(&ring->owned, true);
+        atomic_init(&ring->dropped, 0);
+        ring->next = atomic_load(&kwr_log.rings);
+        while (!atomic_compare_exchange_weak(&kwr_log.rings, &ring->next, ring))  {}
+    }
+
+    pthread_setspecific(kwr_log_ring_key, ring);
+    return kwr_log_ring = ring;
+}
+
+void Kwr_Log(Kwr_LogLevel level, const char *category, const char *format, int num_args, const Kwr_LogArg *args)
+{
+    if (!atomic_load_explicit(&kwr_log.open, memory_order_relaxed))  return;
+    if ((int)level < atomic_load_explicit(&kwr_log.threshold, memory_order_relaxed))  return;
+    requires(format && num_args >= 0 && num_args <= KWR_LOG_MAX_ARGS);
+
+    Kwr_LogRing *ring = kwr_log_ring;
+    if (!ring && !(ring = Kwr_ClaimLogRing()))  return;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->tail_seen == KWR_LOG_RING_RECORDS) {
+        ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+    if (head - ring->tail_seen == KWR_LOG_RING_RECORDS) {
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+        return;
+    }
+
+    Kwr_LogRecord *record = &ring->records[head & (KWR_LOG_RING_RECORDS - 1)];
+    record->time = Kwr_ClockNow();
+    record->format = format;
+    record->category = category;
+    record->level = (uint8_t)level;
+    record->num_args = (uint8_t)num_args;
+    for (int i = 0; i < num_args; ++i) {
+        record->types[i] = (uint8_t)args[i].type;
+        record->values[i] = args[i].value;
+    }
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void Kwr_AppendLogArg(Kwr_Buffer *buf, Kwr_LogArg arg)
+{
+    switch (arg.type) {
+    case Kwr_LogArg_Int:      Kwr_AppendInt(buf, arg.value.i);       break;
+    case Kwr_LogArg_Unsigned: Kwr_AppendUnsigned(buf, arg.value.u);  break;
+    case Kwr_LogArg_Double:   Kwr_AppendDouble(buf, arg.value.d);    break;
+    case Kwr_LogArg_Char:     Kwr_AppendChar(buf, (char)arg.value.i);  break;
+    case Kwr_LogArg_Bool:     Kwr_AppendString(buf, arg.value.u? "true": "false");  break;
+    case Kwr_LogArg_String:   Kwr_AppendString(buf, arg.value.s);    break;
+    case Kwr_LogArg_Pointer:  Kwr_AppendHex(buf, (uintptr_t)arg.value.p);  break;
+    }
+}
+
+typedef struct Kwr_LogStamp {
+    time_t seconds;
+    char   str[32];
+} Kwr_LogStamp;
+
+// Format: "2024-01-31 12:34:56.123456 category Level "message""
+static void Kwr_AppendLogRecord(Kwr_Buffer *buf, const Kwr_LogRecord *record, Kwr_LogStamp *stamp)
+{
+    int64_t wall = (int64_t)record->time + kwr_log.wall_offset;
+    time_t seconds = (time_t)(wall / 1000000000);
+    if (seconds != stamp->seconds || !stamp->str[0]) {
+        struct tm local_tm;
+        stamp->seconds = seconds;
+        if (!localtime_r(&seconds, &local_tm) || !strftime(stamp->str, sizeof(stamp->str), "%Y-%m-%d %H:%M:%S", &local_tm)) {
+            stamp->str[Kwr_FormatInt(stamp->str, (int64_t)seconds)] = '\0';
+        }
+    }
+
+    Kwr_AppendString(buf, stamp->str);
+    Kwr_AppendChar(buf, '.');
+    Kwr_AppendZeroPadded(buf, (uint64_t)(wall % 1000000000 / 1000), 6);
+    Kwr_AppendChar(buf, ' ');
+    Kwr_AppendString(buf, record->category? record->category: "-");
+    Kwr_AppendChar(buf, ' ');
+    Kwr_AppendString(buf, kwr_log_level_names[record->level]);
+    Kwr_AppendBytes(buf, " \"", 2);
+
+    const char *at = record->format;
+    for (int arg = 0; ; ++arg) {
+        const char *hole = strstr(at, "{}");
+        if (!hole || arg == record->num_args) {
+            Kwr_AppendString(buf, at);
+            break;
+        }
+        Kwr_AppendBytes(buf, at, (size_t)(hole - at));
+        Kwr_AppendLogArg(buf, (Kwr_LogArg){ (Kwr_LogArgType)record->types[arg], record->values[arg] });
+        at = hole + 2;
+    }
+    Kwr_AppendBytes(buf, "\"\n", 2);
+}
+
+static int Kwr_CompareLogRecords(const void *a, const void *b)
+{
+    uint64_t x = ((const Kwr_LogRecord *)a)->time, y = ((const Kwr_LogRecord *)b)->time;
+    return (x > y) - (x < y);
+}
+
+static void Kwr_DrainLogRings(Kwr_LogBatch **batch)
+{
+    (*batch)->length = 0;
+    for (Kwr_LogRing *ring = atomic_load(&kwr_log.rings); ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; ++tail) {
+            push_grow(*batch, ring->records[tail & (KWR_LOG_RING_RECORDS - 1)]);
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+static void *Kwr_LogThread(void *arg)
+{
+    UNUSED(arg);
+    Kwr_LogBatch *batch = new_dynarray(Kwr_LogRecord, KWR_LOG_RING_RECORDS);
+    Kwr_Buffer lines = Kwr_InitTextBuffer(NULL);
+    Kwr_LogStamp stamp = {0};
+
+    for (;;) {
+        // Read the requests first: whatever was logged before them gets drained below
+        _Bool stopping = atomic_load(&kwr_log.stop);
+        uint64_t flush = atomic_load(&kwr_log.flush_requested);
+
+        if (batch)  Kwr_DrainLogRings(&batch);
+        size_t count = batch? length(batch): 0;
+        if (count) {
+            qsort(batch->begin, count, sizeof(Kwr_LogRecord), Kwr_CompareLogRecords);
+            lines.text->length = 0;
+            lines = Kwr_InitTextBuffer(lines.text);
+            for (size_t i = 0; i < count; ++i)  Kwr_AppendLogRecord(&lines, &batch->begin[i], &stamp);
+            fwrite(lines.begin, 1, lines.length, kwr_log.file);
+        }
+        if (count || flush != atomic_load(&kwr_log.flushed)) {
+            fflush(kwr_log.file);
+            atomic_store(&kwr_log.flushed, flush);
+        }
+
+        if (stopping)  break;
+        if (!count)  nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+
+    Dynarray_Dispose(batch);
+    Dynarray_Dispose(lines.text);
+    return NULL;
+}
+
+ErrorCode Kwr_OpenLog(const char *path, Kwr_LogLevel threshold)
+{
+    requires(!atomic_load(&kwr_log.open));
+
+    pthread_once(&kwr_log_once, Kwr_InitLogRingKey);
+
+    FILE *file = path? fopen(path, "a"): stderr;
+    if (!file)  return ErrorCode_Error;
+
+    kwr_log.file = file;
+    kwr_log.wall_offset = (int64_t)(Kwr_ClockGettime(CLOCK_REALTIME) - Kwr_ClockNow());
+    atomic_store(&kwr_log.threshold, (int)threshold);
+    atomic_store(&kwr_log.stop, false);
+    atomic_store(&kwr_log.flush_requested, 0);
+    atomic_store(&kwr_log.flushed, 0);
+
+    if (pthread_create(&kwr_log.thread, NULL, Kwr_LogThread, NULL)) {
+        if (path)  fclose(file);
+        return ErrorCode_Error;
+    }
+    atomic_store(&kwr_log.open, true);
+    return ErrorCode_OK;
+}
+
+// Waits until everything logged before the call has been written
+void Kwr_FlushLog(void)
+{
+    if (!atomic_load(&kwr_log.open))  return;
+
+    uint64_t request = atomic_fetch_add(&kwr_log.flush_requested, 1) + 1;
+    while (atomic_load(&kwr_log.flushed) < request) {
+        nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+    }
+}
+
+// Writes what is left and stops the log thread.  The rings are kept
+// for the threads that own them, in case the log is opened again.
+void Kwr_CloseLog(void)
+{
+    if (!atomic_load(&kwr_log.open))  return;
+
+    atomic_store(&kwr_log.open, false);
+    atomic_store(&kwr_log.stop, true);
+    pthread_join(kwr_log.thread, NULL);
+
+    if (kwr_log.file != stderr)  fclose(kwr_log.file);
+    kwr_log.file = NULL;
+}
+
+uint64_t Kwr_LogDropped(void)
+{
+    uint64_t dropped = 0;
+    for (Kwr_LogRing *ring = atomic_load(&kwr_log.rings); ring; ring = ring->next) {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+
+//------------------------------------------------------------
+//# Pseudo-Random Number Generation
+
+static const int XOR_SHIFT_PARAMETERS[][3] = {
+   { 1, 3,10}, { 1, 5,16}, { 1, 5,19}, { 1, 9,29}, { 1,11, 6}, { 1,11,16}, { 1,19, 3}, { 1,21,20}, { 1,27,27}, 
+   { 2, 5,15}, { 2, 5,21}, { 2, 7, 7}, { 2, 7, 9}, { 2, 7,25}, { 2, 9,15}, { 2,15,17}, { 2,15,25}, { 2,21, 9}, 
+   { 3, 1,14}, { 3, 3,26}, { 3, 3,28}, { 3, 3,29}, { 3, 5,20}, { 3, 5,22}, { 3, 5,25}, { 3, 7,29}, { 3,13, 7}, 
+   { 3,23,25}, { 3,25,24}, { 3,27,11}, { 4, 3,17}, { 4, 3,27}, { 4, 5,15}, { 5, 3,21}, { 5, 7,22}, { 5, 9,7 }, 
+   { 5, 9,28}, { 5, 9,31}, { 5,13, 6}, { 5,15,17}, { 5,17,13}, { 5,21,12}, { 5,27, 8}, { 5,27,21}, { 5,27,25}, 
+   { 5,27,28}, { 6, 1,11}, { 6, 3,17}, { 6,17, 9}, { 6,21, 7}, { 6,21,13}, { 7, 1, 9}, { 7, 1,18}, { 7, 1,25}, 
+   { 7,13,25}, { 7,17,21}, { 7,25,12}, { 7,25,20}, { 8, 7,23}, { 8,9,23 }, { 9, 5,1 }, { 9, 5,25}, { 9,11,19}, 
+   { 9,21,16}, {10, 9,21}, {10, 9,25}, {11, 7,12}, {11, 7,16}, {11,17,13}, {11,21,13}, {12, 9,23}, {13, 3,17}, 
+   {13, 3,27}, {13, 5,19}, {13,17,15}, {14, 1,15}, {14,13,15}, {15, 1,29}, {17,15,20}, {17,15,23}, {17,15,26}, 
+};
+
+void XorShift_Init(XorShift *state, uint32_t seed, int params_num)
+{
+    params_num = params_num % array_length(XOR_SHIFT_PARAMETERS);
+    const int *params = XOR_SHIFT_PARAMETERS[params_num];
+
+    *state = (XorShift)
+    { 
+        .a = params[0], 
+        .b = params[1], 
+        .c = params[2], 
+        .x = seed
+    };
+}
+
+uint32_t XorShift_Rand(XorShift *state)
+{
+    uint32_t x = state->x;
+    x ^= (x << state->a);
+    x ^= (x >> state->b);
+    x ^= (x << state->c);
+    return state->x = x;
+}
+
+
+// Derive well separated, non-zero lane seeds from one random number
+static void XorShift_SeedLanes(XorShift *state, uint32_t lanes[XorShift_Lanes])
+{
+    uint32_t seed = XorShift_Rand(state);
+    for (uint32_t i = 0; i < XorShift_Lanes; ++i) {
+        uint32_t z = seed + (i + 1) * 0x9E3779B9u;
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        lanes[i] = z? z: i + 1;
+    }
+}
+
+typedef void (*XorShift_FillFn)(uint32_t *lanes, int a, int b, int c, uint32_t *out, size_t blocks);
+
+// KWR_XORSHIFT_SIMD=0 builds the scalar kernels, for checking that the
+// vector ones match them
+#ifndef KWR_XORSHIFT_SIMD
+#define KWR_XORSHIFT_SIMD  1
+#endif
+
+// Each block writes one number from every lane, interleaved
+#if KWR_XORSHIFT_SIMD && defined(__AVX2__)
+#define XOR_SHIFT_FILL_BODY(A_, B_, C_) \
+    __m256i x = _mm256_loadu_si256((const __m256i*)lanes); \
+    for (size_t i = 0; i < blocks; ++i, out += XorShift_Lanes) { \
+        x = _mm256_xor_si256(x, _mm256_sll_epi32(x, _mm_cvtsi32_si128(A_))); \
+        x = _mm256_xor_si256(x, _mm256_srl_epi32(x, _mm_cvtsi32_si128(B_))); \
+        x = _mm256_xor_si256(x, _mm256_sll_epi32(x, _mm_cvtsi32_si128(C_))); \
+        _mm256_storeu_si256((__m256i*)out, x); \
+    } \
+    _mm256_storeu_si256((__m256i*)lanes, x);
+#elif KWR_XORSHIFT_SIMD && defined(__SSE2__)
+#define XOR_SHIFT_FILL_BODY(A_, B_, C_) \
+    __m128i x0 = _mm_loadu_si128((const __m128i*)lanes); \
+    __m128i x1 = _mm_loadu_si128((const __m128i*)lanes + 1); \
+    __m128i sa = _mm_cvtsi32_si128(A_), sb = _mm_cvtsi32_si128(B_), sc = _mm_cvtsi32_si128(C_); \
+    for (size_t i = 0; i < blocks; ++i, out += XorShift_Lanes) { \
+        x0 = _mm_xor_si128(x0, _mm_sll_epi32(x0, sa)); \
+        x1 = _mm_xor_si128(x1, _mm_sll_epi32(x1, sa)); \
+        x0 = _mm_xor_si128(x0, _mm_srl_epi32(x0, sb)); \
+        x1 = _mm_xor_si128(x1, _mm_srl_epi32(x1, sb)); \
+        x0 = _mm_xor_si128(x0, _mm_sll_epi32(x0, sc)); \
+        x1 = _mm_xor_si128(x1, _mm_sll_epi32(x1, sc)); \
+        _mm_storeu_si128((__m128i*)out, x0); \
+        _mm_storeu_si128((__m128i*)out + 1, x1); \
+    } \
+    _mm_storeu_si128((__m128i*)lanes, x0); \
+    _mm_storeu_si128((__m128i*)lanes + 1, x1);
+#else
+#define XOR_SHIFT_FILL_BODY(A_, B_, C_) \
+    for (size_t i = 0; i < blocks; ++i, out += XorShift_Lanes) { \
+        for (int lane = 0; lane < XorShift_Lanes; ++lane) { \
+            uint32_t x = lanes[lane]; \
+            x ^= x << (A_); \
+            x ^= x >> (B_); \
+            x ^= x << (C_); \
+            out[lane] = lanes[lane] = x; \
+        } \
+    }
+#endif
+
+static void XorShift_FillAny(uint32_t *lanes, int a, int b, int c, uint32_t *out, size_t blocks)
+{
+    XOR_SHIFT_FILL_BODY(a, b, c)
+}
+
+// Shift triples with compile-time kernels
+#define XOR_SHIFT_FILL_SPECIALIZED_X \
+  X( 1, 3,10) \
+  X( 1,11, 6) \
+  X( 5, 9,28) \
+  X(13,17,15)
+
+#define X(A_, B_, C_) \
+static void XorShift_Fill_##A_##_##B_##_##C_(uint32_t *lanes, int a, int b, int c, uint32_t *out, size_t blocks) \
+{ \
+    UNUSED(a); UNUSED(b); UNUSED(c); \
+    XOR_SHIFT_FILL_BODY(A_, B_, C_) \
+}
+XOR_SHIFT_FILL_SPECIALIZED_X
+#undef X
+
+static XorShift_FillFn XorShift_SelectFill(XorShift *state)
+{
+#define X(A_, B_, C_)  if (state->a == A_ && state->b == B_ && state->c == C_)  return XorShift_Fill_##A_##_##B_##_##C_;
+    XOR_SHIFT_FILL_SPECIALIZED_X
+#undef X
+    return XorShift_FillAny;
+}
+
+void XorShift_Fill(XorShift *state, uint32_t *out, size_t n)
+{
+    requires(state);
+    requires(out || !n);
+
+    uint32_t lanes[XorShift_Lanes];
+    XorShift_SeedLanes(state, lanes);
+
+    XorShift_FillFn fill = XorShift_SelectFill(state);
+    size_t blocks = n / XorShift_Lanes;
+    fill(lanes, state->a, state->b, state->c, out, blocks);
+
+    size_t tail = n % XorShift_Lanes;
+    if (tail) {
+        uint32_t last[XorShift_Lanes];
+        fill(lanes, state->a, state->b, state->c, last, 1);
+        memcpy(out + blocks * XorShift_Lanes, last, tail * sizeof(*last));
+    }
+}
+
+uint64_t SplitMix64_Next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+void Xoshiro256_Init(Xoshiro256 *state, uint64_t seed)
+{
+    requires(state);
+    for (int i = 0; i < 4; ++i)  state->s[i] = SplitMix64_Next(&seed);
+}
+
+void Xoshiro256_InitStream(Xoshiro256 *state, uint64_t seed, uint64_t stream)
+{
+    Xoshiro256_Init(state, seed);
+    while (stream--)  Xoshiro256_Jump(state);
+}
+
+static inline uint64_t Xoshiro256_Rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t Xoshiro256_Rand(Xoshiro256 *state)
+{
+    uint64_t *s = state->s;
+    uint64_t result = Xoshiro256_Rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3]  = Xoshiro256_Rotl(s[3], 45);
+
+    return result;
+}
+
+static void Xoshiro256_JumpPoly(Xoshiro256 *state, const uint64_t poly[4])
+{
+    uint64_t t[4] = {0};
+    for (int i = 0; i < 4; ++i) {
+        for (int b = 0; b < 64; ++b) {
+            if (poly[i] & (UINT64_C(1) << b)) {
+                for (int j = 0; j < 4; ++j)  t[j] ^= state->s[j];
+            }
+            Xoshiro256_Rand(state);
+        }
+    }
+    memcpy(state->s, t, sizeof(t));
+}
+
+void Xoshiro256_Jump(Xoshiro256 *state)
+{
+    requires(state);
+    static const uint64_t JUMP[] = { 0x180EC6D33CFD0ABA, 0xD5A61266F0C9392C, 0xA9582618E03FC9AA, 0x39ABDC4529B1661C };
+    Xoshiro256_JumpPoly(state, JUMP);
+}
+
+void Xoshiro256_LongJump(Xoshiro256 *state)
+{
+    requires(state);
+    static const uint64_t LONG_JUMP[] = { 0x76E15D3EFEFDCBBF, 0xC5004E441C522FB3, 0x77710069854EE241, 0x39109BB02ACBE635 };
+    Xoshiro256_JumpPoly(state, LONG_JUMP);
+}
+
+uint32_t XorShift_RandBelow(XorShift *state, uint32_t n)
+{
+    requires(n > 0);
+
+    uint64_t m = (uint64_t)XorShift_Rand(state) * n;
+    if ((uint32_t)m < n) {
+        uint32_t threshold = -n % n;  // 2^32 mod n
+        while ((uint32_t)m < threshold)  m = (uint64_t)XorShift_Rand(state) * n;
+    }
+    return m >> 32;
+}
+
+// High 64 bits of a * b, low 64 bits in *lo
+static inline uint64_t Kwr_MulHi64(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 m = (unsigned __int128)a * b;
+    *lo = (uint64_t)m;
+    return m >> 64;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    *lo = (mid << 32) | (uint32_t)ll;
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+uint64_t Xoshiro256_RandBelow(Xoshiro256 *state, uint64_t n)
+{
+    requires(n > 0);
+
+    if (n <= UINT32_MAX) {  // 32-bit multiply on the high (best) output bits
+        uint64_t m = (Xoshiro256_Rand(state) >> 32) * n;
+        if ((uint32_t)m < n) {
+            uint32_t threshold = (uint32_t)-n % (uint32_t)n;
+            while ((uint32_t)m < threshold)  m = (Xoshiro256_Rand(state) >> 32) * n;
+        }
+        return m >> 32;
+    }
+
+    uint64_t lo, hi = Kwr_MulHi64(Xoshiro256_Rand(state), n, &lo);
+    if (lo < n) {
+        uint64_t threshold = -n % n;  // 2^64 mod n
+        while (lo < threshold)  hi = Kwr_MulHi64(Xoshiro256_Rand(state), n, &lo);
+    }
+    return hi;
+}
+
+static void Kwr_SwapBytes(char *a, char *b, size_t size)
+{
+    char tmp[64];
+    while (size) {
+        size_t chunk = size < sizeof(tmp)? size: sizeof(tmp);
+        memcpy(tmp, a, chunk);
+        memcpy(a, b, chunk);
+        memcpy(b, tmp, chunk);
+        a += chunk, b += chunk, size -= chunk;
+    }
+}
+
+#define KWR_SHUFFLE_BODY(state_, items_, count_, item_size_) \
+    requires((items_) || !(count_)); \
+    char *bytes = (items_); \
+    for (size_t i = (count_); i > 1; --i) { \
+        size_t j = Kwr_RandBelow((state_), i); \
+        if (j != i-1)  Kwr_SwapBytes(bytes + j * (item_size_), bytes + (i-1) * (item_size_), (item_size_)); \
+    }
+
+void XorShift_Shuffle(XorShift *state, void *items, size_t count, size_t item_size)
+{
+    requires_m(count <= UINT32_MAX, "too many items for a 32-bit generator");
+    KWR_SHUFFLE_BODY(state, items, count, item_size)
+}
+
+void Xoshiro256_Shuffle(Xoshiro256 *state, void *items, size_t count, size_t item_size)
+{
+    KWR_SHUFFLE_BODY(state, items, count, item_size)
+}
@@ -1,11 +1,16 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
 #define KWRLIB_H_INCLUDED
 
 #define STRINGIFY(x)            #x
 #define EXPAND_STRINGIFY(x)     STRINGIFY(x)
 
+#define CONCAT(a, b)            a##b
+#define EXPAND_CONCAT(a, b)     CONCAT(a, b)
+
 #define LINE_STR                EXPAND_STRINGIFY(__LINE__)
 #define SOURCE_LINE_STR         __FILE__ ":" LINE_STR ":"
 
@@ -17,6 +22,7 @@
 
 #define PARAM_0(_0, ...)      _0
 #define PARAM_1(_0, _1, ...)  _1
+#define PARAM_2(_0, _1, _2, ...)  _2
 
 #define STANDARD_ENUM_VALUES(EnumName_) \
   EnumName_##_End,  \
@@ -71,8 +77,129 @@ _Bool AssertFailureFmt(const char *sourceline, const char *format, ...);
 
 //------------------------------------------------------------
 //# Memory Management
-
-void *kalloc(void *ptr, size_t size);
+//
+// kalloc allocates (ptr NULL) or resizes like realloc; kcalloc gives
+// zeroed memory.  Release what they return with kfree.
+//
+// Built with KWR_ALLOC_STATS=1 (make ALLOC_STATS=1, then rebuild all),
+// each block carries a small header and is counted against the source
+// line that asked for it: live bytes and blocks, allocations, resizes
+// and resizes that moved the block.  Dynarray macros count against
+// their own call site.  Counters are kept per thread and merged for a
+// report; blocks still live at exit are reported to stderr.  The peak
+// is of all live bytes, up to KWR_ALLOC_FLUSH_BYTES per thread late.
+
+#ifndef KWR_ALLOC_STATS
+#define KWR_ALLOC_STATS  0
+#endif
+
+void *kalloc  (void *ptr, size_t size);
+void *kcalloc (size_t count, size_t size);
+void  kfree   (void *ptr);
+
+void *Kwr_AllocAt   (void *ptr, size_t size, const char *site);
+void *Kwr_CallocAt  (size_t count, size_t size, const char *site);
+
+// Totals for one site (NULL for all): live ones are signed because a
+// block freed on another thread is counted there
+typedef struct Kwr_AllocStats {
+    int64_t  live_bytes, live_blocks;
+    uint64_t allocs, resizes, moves, frees, bytes;
+    uint64_t peak_bytes;   // of all sites
+} Kwr_AllocStats;
+
+void  Kwr_GetAllocStats   (Kwr_AllocStats *stats, const char *site);
+void  Kwr_PrintAllocStats (void *file);   // FILE *; NULL for stdout
+int   Kwr_PrintLeaks      (void *file);   // returns the number of leaking sites
+
+void  Kwr_SetAllocSite (const char *site);
+void *Kwr_EndAllocSite (void *result);
+
+#if KWR_ALLOC_STATS
+#define kalloc(ptr_, size_)     Kwr_AllocAt((ptr_), (size_), SOURCE_LINE_STR)
+#define kcalloc(count_, size_)  Kwr_CallocAt((count_), (size_), SOURCE_LINE_STR)
+// Counts the allocations inside call_ against the line using the macro
+#define KWR_ALLOC_SITE(call_)   (Kwr_SetAllocSite(SOURCE_LINE_STR), Kwr_EndAllocSite(call_))
+#else
+#define KWR_ALLOC_SITE(call_)   (call_)
+#endif
+
+// Arena: bump allocator carving objects out of large chunks. Objects are 
+// not freed individually; reset the arena to a mark to free everything
+// allocated since the mark.  Released chunks are kept for reuse until
+// the arena is disposed.
+
+typedef struct Kwr_ArenaChunk Kwr_ArenaChunk;
+
+typedef struct Kwr_Arena {
+    Kwr_ArenaChunk *chunk;   // current chunk, linked to older chunks
+    Kwr_ArenaChunk *spare;   // released chunks waiting for reuse
+    char *top, *end;
+    size_t chunk_size;
+} Kwr_Arena;
+
+typedef struct Kwr_ArenaMark {
+    Kwr_ArenaChunk *chunk;
+    char *top;
+} Kwr_ArenaMark;
+
+#ifndef ARENA_DEFAULT_CHUNK_SIZE
+#define    ARENA_DEFAULT_CHUNK_SIZE  (1024*1024)
+#endif
+
+void           Kwr_InitArena    (Kwr_Arena *arena, size_t chunk_size);
+void          *Kwr_ArenaAlloc   (Kwr_Arena *arena, size_t size);
+void          *Kwr_ArenaResize  (Kwr_Arena *arena, void *ptr, size_t old_size, size_t new_size);
+Kwr_ArenaMark  Kwr_ArenaGetMark (Kwr_Arena *arena);
+void           Kwr_ArenaReset   (Kwr_Arena *arena, Kwr_ArenaMark mark);
+void           Kwr_DisposeArena (Kwr_Arena *arena);
+
+#define Kwr_ClearArena(arena_)   Kwr_ArenaReset((arena_), (Kwr_ArenaMark){0})
+
+// Pool: fixed-size objects allocated from slabs and recycled through an
+// intrusive free list.  The pool is guarded by a spin lock; threads with
+// high alloc/free rates can put a Kwr_PoolCache in front of it, which
+// moves objects to and from the pool in batches.  The live and peak 
+// counts include cache allocations as of the cache's last batch, so
+// the live count can dip below zero when an object from a cache is
+// freed to the pool first.
+
+typedef struct Kwr_PoolItem Kwr_PoolItem;
+typedef struct Kwr_PoolSlab Kwr_PoolSlab;
+
+typedef struct Kwr_Pool {
+    size_t item_size;
+    size_t items_per_slab;
+    Kwr_PoolItem *free_list;
+    Kwr_PoolSlab *slabs;
+    atomic_flag   lock;
+    ptrdiff_t live_count;
+    ptrdiff_t peak_count;
+} Kwr_Pool;
+
+typedef struct Kwr_PoolCache {
+    Kwr_Pool *pool;
+    Kwr_PoolItem *free_list;
+    size_t free_count;
+    ptrdiff_t live_delta;   // allocs minus frees since last batch
+} Kwr_PoolCache;
+
+#ifndef POOL_DEFAULT_SLAB_ITEMS
+#define    POOL_DEFAULT_SLAB_ITEMS  256
+#endif
+
+#ifndef POOL_CACHE_BATCH
+#define    POOL_CACHE_BATCH  32
+#endif
+
+void   Kwr_InitPool         (Kwr_Pool *pool, size_t item_size, size_t items_per_slab);
+void  *Kwr_PoolAlloc        (Kwr_Pool *pool);
+void   Kwr_PoolFree         (Kwr_Pool *pool, void *item);
+void   Kwr_DisposePool      (Kwr_Pool *pool);
+void   Kwr_InitPoolCache    (Kwr_PoolCache *cache, Kwr_Pool *pool);
+void  *Kwr_PoolCacheAlloc   (Kwr_PoolCache *cache);
+void   Kwr_PoolCacheFree    (Kwr_PoolCache *cache, void *item);
+void   Kwr_DisposePoolCache (Kwr_PoolCache *cache);
 
 
 //------------------------------------------------------------
@@ -90,27 +217,489 @@ void *kalloc(void *ptr, size_t size);
 //------------------------------------------------------------
 //# Dynamically Sized Arrays 
 
-#define dynarray(TYPE)  struct {  TYPE *top; TYPE *end; TYPE begin[]; }
+// The header holds sizes rather than pointers into the block, so a 
+// dynarray stays valid wherever realloc or mremap moves it.  Release
+// with Dynarray_Dispose(), which handles both heap and mapped arrays.
+#define dynarray(TYPE)  struct {  size_t length, capacity, map_size, map_flags; TYPE begin[]; }
 
 void  *Dynarray_Alloc(void *a, size_t item_size, size_t num_items);
-
-#define length(da_)     (size_t)((da_)->top - (da_)->begin)
-#define capacity(da_)   (size_t)((da_)->end - (da_)->begin)
-#define remaining(da_)  (size_t)((da_)->end - (da_)->top)
-#define is_empty(da_)   (_Bool)((da_)->top == (da_)->begin)
-#define is_full(da_)    (_Bool)((da_)->top == (da_)->end)
+void  *Dynarray_ArenaAlloc(Kwr_Arena *arena, void *a, size_t item_size, size_t num_items);
+void  *Dynarray_Map(size_t item_size, size_t max_items, unsigned flags);
+void   Dynarray_Dispose(void *a);
+void  *Dynarray_Grow(void *a, size_t item_size, size_t num_items);
+void  *Dynarray_Append(void *a, size_t item_size, const void *items, size_t num_items);
+void  *Dynarray_ShrinkToFit(void *a, size_t item_size);
+
+#define length(da_)     (size_t)((da_)->length)
+#define capacity(da_)   (size_t)((da_)->capacity)
+#define remaining(da_)  (size_t)((da_)->capacity - (da_)->length)
+#define is_empty(da_)   (_Bool)((da_)->length == 0)
+#define is_full(da_)    (_Bool)((da_)->length == (da_)->capacity)
 #define da_get(da_, at_)   (requires(at_ < length(da_)), (da_)->begin[(at_)])
 #define da_set(da_, at_, val_)   (requires((at_) < length(da_)), (da_)->begin[(at_)] = (val_))
-#define push(da_, val_)       (*(da_)->top++ = (val_))
+#define push(da_, val_)       ((da_)->begin[(da_)->length++] = (val_))
 
 #ifndef ARRAY_DEFAULT_SIZE  
 #define    ARRAY_DEFAULT_SIZE  64
 #endif 
 
-#define new_dynarray(...)                    Dynarray_Alloc(NULL, sizeof(PARAM_0(__VA_ARGS__)), PARAM_1(__VA_ARGS__, ARRAY_DEFAULT_SIZE))
-#define enlarge_x(dynarray_, growth_, ...)   Dynarray_Alloc((dynarray_), sizeof(*(dynarray_)->begin), capacity(dynarray_) + (growth_))
+#define new_dynarray(...)                    KWR_ALLOC_SITE(Dynarray_Alloc(NULL, sizeof(PARAM_0(__VA_ARGS__)), PARAM_1(__VA_ARGS__, ARRAY_DEFAULT_SIZE)))
+#define enlarge_x(dynarray_, growth_, ...)   KWR_ALLOC_SITE(Dynarray_Alloc((dynarray_), sizeof(*(dynarray_)->begin), capacity(dynarray_) + (growth_)))
 #define enlarge(...)                         enlarge_x(__VA_ARGS__, capacity(PARAM_0(__VA_ARGS__)))
 
+// Growing operations reassign the dynarray variable because the array
+// may move.  Capacity grows geometrically, so pushes are amortized O(1).
+// They abort if the allocation fails.  reserve(da, n) makes room for n
+// more items past the current length; it is not a total capacity as
+// with std::vector::reserve.  These use the heap, so they require an
+// array that is not in an arena.
+#define push_grow(da_, val_)     (is_full(da_)? (void)((da_) = KWR_ALLOC_SITE(Dynarray_Grow((da_), sizeof(*(da_)->begin), 1))): (void)0, push((da_), (val_)))
+#define reserve(da_, n_)         ((da_) = KWR_ALLOC_SITE(Dynarray_Grow((da_), sizeof(*(da_)->begin), (n_))))
+#define append_n(da_, ptr_, n_)  ((void)sizeof((da_)->begin[0] = *(ptr_)), (da_) = KWR_ALLOC_SITE(Dynarray_Append((da_), sizeof(*(da_)->begin), (ptr_), (n_))))
+#define extend(da_, other_)      append_n((da_), (other_)->begin, length(other_))
+#define shrink_to_fit(da_)       ((da_) = KWR_ALLOC_SITE(Dynarray_ShrinkToFit((da_), sizeof(*(da_)->begin))))
+
+// Same as above, allocating from an arena instead of the heap.  Arena
+// arrays grow only with enlarge_in, and Dynarray_Dispose leaves them
+// to the arena.
+#define new_dynarray_in(arena_, ...)              Dynarray_ArenaAlloc((arena_), NULL, sizeof(PARAM_0(__VA_ARGS__)), PARAM_1(__VA_ARGS__, ARRAY_DEFAULT_SIZE))
+#define enlarge_in_x(arena_, dynarray_, growth_, ...)  Dynarray_ArenaAlloc((arena_), (dynarray_), sizeof(*(dynarray_)->begin), capacity(dynarray_) + (growth_))
+#define enlarge_in(arena_, ...)                   enlarge_in_x((arena_), __VA_ARGS__, capacity(PARAM_0(__VA_ARGS__)))
+
+// Large arrays backed by a private memory mapping.  Address space for 
+// max_items is reserved up front and pages are committed on first touch,
+// so growing within the reservation never copies or moves the array.
+// Growing past it remaps (zero-copy on Linux).  Falls back to the heap 
+// where memory mapping is not available.
+enum {
+    Dynarray_HugePages = 1 << 0,   // advise transparent huge pages
+    Dynarray_InArena   = 1 << 1,   // set on arena arrays, not a mapping flag
+};
+
+#define new_mapped_dynarray(...)   Dynarray_Map(sizeof(PARAM_0(__VA_ARGS__)), PARAM_1(__VA_ARGS__, 0), PARAM_2(__VA_ARGS__, 0, 0))
+
+
+
+//------------------------------------------------------------
+//# Hash Maps
+//
+// Open addressing in one block, in the manner of a dynarray: a small
+// header, the slots, then one control byte per slot.  A control byte
+// says empty, deleted, or holds 7 bits of the key's hash, and lookups
+// compare a group of 16 of them at once (SSE2 where available), so
+// only slots with a matching byte are read (Swiss tables, Abseil).
+//
+// SLOT is a struct whose first member is `key`: an integer, a pointer
+// or a C string.  String keys are hashed and compared by contents and
+// not copied; other keys by value.  A NULL map is empty, and growing
+// operations reassign the map variable because the map may move.
+//
+//     typedef struct { Maze_Cell *key; int distance; } CellDistance;
+//     hashmap(CellDistance) *distances = NULL;
+//     hashmap_insert(distances, cell)->distance = 3;   // zeroed if new
+//     CellDistance *found = hashmap_find(distances, cell);   // or NULL
+//     hashmap_each(distances, i)  total += distances->slots[i].distance;
+//     hashmap_dispose(distances);
+//
+// Maps reserved with hashmap_reserve_in live in the arena, and so do
+// their later tables; disposing them does nothing.
+
+#define hashmap(SLOT)  struct {  size_t count, capacity, used; Kwr_Arena *arena; SLOT slots[]; }
+
+uint64_t  Kwr_HashInt    (uint64_t value);
+uint64_t  Kwr_HashString (const char *string);
+
+enum { Kwr_HashStringKey = 0 };     // key_size of string keys
+
+// Filled plus deleted slots allowed before the table grows: 7/8
+#define Kwr_HashMapMaxLoad(capacity_)  ((capacity_) - (capacity_) / 8)
+
+void   *Kwr_HashMapFind    (const void *map, size_t slot_size, size_t key_size, uint64_t key);
+size_t  Kwr_HashMapInsert  (void *map, size_t slot_size, size_t key_size, uint64_t key);
+_Bool   Kwr_HashMapRemove  (void *map, size_t slot_size, size_t key_size, uint64_t key);
+void   *Kwr_HashMapReserve (void *map, Kwr_Arena *arena, size_t slot_size, size_t key_size, size_t num_keys);
+void   *Kwr_HashMapRehash  (void *map, size_t slot_size, size_t key_size, size_t num_keys);
+size_t  Kwr_HashMapNext    (const void *map, size_t slot_size, size_t index);
+void    Kwr_HashMapClear   (void *map, size_t slot_size);
+void    Kwr_HashMapDispose (void *map);
+
+#define KWR_HASHMAP_SIZES(m_) \
+    sizeof(*(m_)->slots), \
+    _Generic((m_)->slots->key, char *: Kwr_HashStringKey, const char *: Kwr_HashStringKey, default: sizeof((m_)->slots->key))
+
+#define KWR_HASHMAP_KEY(key_) \
+    _Generic((key_), char *: (uint64_t)(uintptr_t)(key_), const char *: (uint64_t)(uintptr_t)(key_), default: (uint64_t)(key_))
+
+#define hashmap_count(m_)     (size_t)((m_)? (m_)->count: 0)
+#define hashmap_capacity(m_)  (size_t)((m_)? (m_)->capacity: 0)
+
+// Slot with the key, or NULL
+#define hashmap_find(m_, key_)   Kwr_HashMapFind((m_), KWR_HASHMAP_SIZES(m_), KWR_HASHMAP_KEY(key_))
+
+// Slot with the key, added (zeroed, count going up) if missing
+#define hashmap_insert(m_, key_) \
+    (hashmap_reserve((m_), 1), &(m_)->slots[Kwr_HashMapInsert((m_), KWR_HASHMAP_SIZES(m_), KWR_HASHMAP_KEY(key_))])
+
+#define hashmap_remove(m_, key_)       Kwr_HashMapRemove((m_), KWR_HASHMAP_SIZES(m_), KWR_HASHMAP_KEY(key_))
+#define hashmap_contains(m_, key_)     (_Bool)(hashmap_find((m_), (key_)) != NULL)
+
+// Room for n more keys without moving; the _in form puts a new map in an arena
+#define hashmap_reserve(m_, n_) \
+    ((m_) && (m_)->used + (n_) <= Kwr_HashMapMaxLoad((m_)->capacity)? (void)0: \
+        (void)((m_) = KWR_ALLOC_SITE(Kwr_HashMapReserve((m_), NULL, KWR_HASHMAP_SIZES(m_), (n_)))))
+#define hashmap_reserve_in(arena_, m_, n_) ((m_) = Kwr_HashMapReserve((m_), (arena_), KWR_HASHMAP_SIZES(m_), (n_)))
+
+// Rebuilt to hold n keys (at least the count), dropping deleted slots
+#define hashmap_rehash(m_, n_)   ((m_) = KWR_ALLOC_SITE(Kwr_HashMapRehash((m_), KWR_HASHMAP_SIZES(m_), (n_))))
+#define hashmap_clear(m_)        Kwr_HashMapClear((m_), sizeof(*(m_)->slots))
+#define hashmap_dispose(m_)      (Kwr_HashMapDispose(m_), (m_) = NULL)
+
+// Loop over the indexes of filled slots, in table order
+#define hashmap_each(m_, i_) \
+    for (size_t i_ = Kwr_HashMapNext((m_), sizeof(*(m_)->slots), 0); i_ < hashmap_capacity(m_); \
+         i_ = Kwr_HashMapNext((m_), sizeof(*(m_)->slots), i_ + 1))
+
+
+//------------------------------------------------------------
+//# Formatting
+//
+// Numbers and strings appended as text, without printf.  Integers go
+// two digits at a time; doubles print the shortest digits that read
+// back to the same value (Ryu, Adams 2018), as fixed point for decimal
+// exponents -5..16 and as "1.5e+300" otherwise.
+//
+// A buffer either fills caller memory, truncating (length keeps
+// counting, as with snprintf), or grows a Kwr_Text dynarray.  Contents
+// are kept NUL-terminated.
+//
+//     char line[64];
+//     Kwr_Buffer buf = Kwr_FixedBuffer(line);
+//     Kwr_AppendString(&buf, "cells/s = ");
+//     Kwr_AppendDouble(&buf, rate);
+
+typedef dynarray(char) Kwr_Text;
+
+typedef struct Kwr_Buffer {
+    char     *begin;
+    size_t    length;      // of the whole output, even past capacity
+    size_t    capacity;    // not counting the NUL
+    Kwr_Text *text;        // grown instead of truncating, when set
+} Kwr_Buffer;
+
+enum {
+    Kwr_IntChars    = 20,   // most chars of a formatted integer
+    Kwr_DoubleChars = 24,   // ...and of a formatted double
+};
+
+#define Kwr_FixedBuffer(array_)  Kwr_InitBuffer((array_), sizeof(array_))
+#define Kwr_BufferTruncated(buf_)  (_Bool)((buf_)->length > (buf_)->capacity)
+
+Kwr_Buffer Kwr_InitBuffer     (char *memory, size_t size);
+Kwr_Buffer Kwr_InitTextBuffer (Kwr_Text *text);    // NULL to start a new one
+
+// Format into out without a NUL; return the number of chars
+size_t  Kwr_FormatUnsigned (char out[Kwr_IntChars], uint64_t value);
+size_t  Kwr_FormatInt      (char out[Kwr_IntChars], int64_t value);
+size_t  Kwr_FormatDouble   (char out[Kwr_DoubleChars], double value);
+
+void  Kwr_AppendBytes      (Kwr_Buffer *buf, const char *bytes, size_t n);
+void  Kwr_AppendString     (Kwr_Buffer *buf, const char *string);   // NULL as "(null)"
+void  Kwr_AppendChar       (Kwr_Buffer *buf, char c);
+void  Kwr_AppendUnsigned   (Kwr_Buffer *buf, uint64_t value);
+void  Kwr_AppendInt        (Kwr_Buffer *buf, int64_t value);
+void  Kwr_AppendZeroPadded (Kwr_Buffer *buf, uint64_t value, int width);
+void  Kwr_AppendDouble     (Kwr_Buffer *buf, double value);
+void  Kwr_AppendHex        (Kwr_Buffer *buf, uint64_t value);       // "0x..."
+void  Kwr_AppendStatus     (Kwr_Buffer *buf, const Status *stat);
+
+
+//------------------------------------------------------------
+//# Bit Sets
+//
+// Arrays of uint64_t words, one bit per item.
+
+#define bitset_words(n_)         (((n_) + 63) / 64)
+#define bitset_test(bits_, i_)   (_Bool)(((bits_)[(i_) / 64] >> ((i_) % 64)) & 1)
+#define bitset_set(bits_, i_)    ((bits_)[(i_) / 64] |= UINT64_C(1) << ((i_) % 64))
+#define bitset_clear(bits_, i_)  ((bits_)[(i_) / 64] &= ~(UINT64_C(1) << ((i_) % 64)))
+
+
+//------------------------------------------------------------
+//# Priority Queue
+//
+// Binary min-heap of item ids in [0, capacity), each with a 64-bit
+// priority.  The heap slot of every item is tracked, so pushing an item
+// already queued lowers its priority in place (decrease-key).  Clearing
+// touches only queued items, so one heap serves many searches.
+
+typedef struct Kwr_IndexHeap {
+    uint32_t  capacity, count;
+    uint32_t *items;        // heap order
+    uint32_t *slots;        // by item: heap slot, or Kwr_HeapAbsent
+    uint64_t *priorities;   // by item
+} Kwr_IndexHeap;
+
+#define Kwr_HeapAbsent  UINT32_MAX
+
+ErrorCode  Kwr_InitIndexHeap    (Kwr_IndexHeap *heap, uint32_t capacity);
+void       Kwr_DisposeIndexHeap (Kwr_IndexHeap *heap);
+void       Kwr_HeapClear        (Kwr_IndexHeap *heap);
+_Bool      Kwr_HeapPush         (Kwr_IndexHeap *heap, uint32_t item, uint64_t priority);
+uint32_t   Kwr_HeapPop          (Kwr_IndexHeap *heap);
+
+#define Kwr_HeapIsEmpty(heap_)         (_Bool)((heap_)->count == 0)
+#define Kwr_HeapContains(heap_, item_) (_Bool)((heap_)->slots[(item_)] != Kwr_HeapAbsent)
+
+
+//------------------------------------------------------------
+//# Images
+//
+// In-memory framebuffer of 8-bit gray (1 channel) or RGBA (4 channels)
+// pixels, rows stride bytes apart.  Set width, height and channels,
+// then call Kwr_InitImage; pixels start out zero.  Kwr_WriteImage saves
+// binary PGM for gray and PPM for RGBA (alpha is dropped).
+
+typedef struct Kwr_Image {
+    int width, height, channels;
+    size_t stride;
+    uint8_t *pixels;
+} Kwr_Image;
+
+ErrorCode  Kwr_InitImage     (Kwr_Image *image);
+void       Kwr_DisposeImage  (Kwr_Image *image);
+void       Kwr_ImageFillRect (Kwr_Image *image, int x, int y, int w, int h, const uint8_t *color);
+ErrorCode  Kwr_WriteImage    (Kwr_Image *image, const char *path);
+
+#define Kwr_ImageRow(image_, y_)  ((image_)->pixels + (size_t)(y_) * (image_)->stride)
+
+
+//------------------------------------------------------------
+//# Mapped Files
+//
+// Maps a whole file copy-on-write: pages are shared through the page
+// cache until written, and writes never reach the file.  Falls back to
+// reading the file into the heap where memory mapping is not available.
+// Release with Kwr_UnmapFile.
+
+ErrorCode  Kwr_MapFile   (const char *path, void **data, size_t *size);
+void       Kwr_UnmapFile (void *data, size_t size);
+
+
+//------------------------------------------------------------
+//# Concurrency
+
+// Run fn(data, task) for every task in [0, num_tasks) on up to 
+// num_threads threads (0 = one per CPU).  Tasks are handed out in order
+// from a shared counter; returns when all tasks are done.
+typedef void (*Kwr_TaskFn)(void *data, size_t task);
+
+#ifndef KWR_MAX_THREADS
+#define    KWR_MAX_THREADS  256
+#endif
+
+int   Kwr_CountCpus   (void);
+void  Kwr_ParallelFor (size_t num_tasks, int num_threads, Kwr_TaskFn fn, void *data);
+
+
+//------------------------------------------------------------
+//# Clock and Profiling
+//
+// Kwr_ClockNow: monotonic nanoseconds on the CLOCK_MONOTONIC time line.
+// Where the CPU has an invariant time stamp counter it is read directly
+// and scaled, after a few milliseconds of calibration on first use;
+// otherwise this is clock_gettime.
+//
+// PROFILE_ZONE times the statement or block that follows it.  Each zone
+// keeps a count, total, min, max and a log2 histogram of its times, 
+// shared by all threads and listed by Kwr_PrintProfile.
+//
+//     PROFILE_ZONE("Maze_Eller") {
+//         ...
+//     }
+//
+// The zone is a declaration followed by a for statement, so it cannot
+// be the unbraced body of an if or loop.  It also captures break and
+// continue written directly in its body: they leave the zone, not an
+// enclosing loop, and only continue records the time.  Return and goto
+// skip the measurement.  Where the body has to break out of an outer
+// loop, call Kwr_EnterZone and Kwr_LeaveZone on a static zone (min_ns
+// starting at UINT64_MAX) instead.  Build with KWR_PROFILE=0 to 
+// compile zones out.
+
+uint64_t    Kwr_ClockNow    (void);
+const char *Kwr_ClockSource (void);    // "tsc" or "clock_gettime"
+
+#ifndef KWR_PROFILE
+#define KWR_PROFILE  1
+#endif
+
+#define    KWR_PROFILE_BUCKETS  48    // bucket b counts times in [2^b, 2^(b+1)) ns
+
+typedef struct Kwr_ProfileZone Kwr_ProfileZone;
+struct Kwr_ProfileZone {
+    const char *name;
+    atomic_uint_least64_t count, total_ns, min_ns, max_ns;
+    atomic_uint_least64_t buckets[KWR_PROFILE_BUCKETS];
+    atomic_bool      registered;
+    Kwr_ProfileZone *next;
+};
+
+uint64_t  Kwr_EnterZone (Kwr_ProfileZone *zone);
+void      Kwr_LeaveZone (Kwr_ProfileZone *zone, uint64_t start);
+
+Kwr_ProfileZone *Kwr_FindProfileZone (const char *name);
+void  Kwr_ResetProfile       (void);
+void  Kwr_PrintProfile       (void *file);    // FILE *; NULL for stdout
+void  Kwr_PrintProfileAtExit (void);          // to stderr
+
+#if KWR_PROFILE
+#define PROFILE_ZONE(name_) \
+    static Kwr_ProfileZone EXPAND_CONCAT(kwr_zone_, __LINE__) = { .name = (name_), .min_ns = UINT64_MAX }; \
+    for (uint64_t EXPAND_CONCAT(kwr_zone_start_, __LINE__) = Kwr_EnterZone(&EXPAND_CONCAT(kwr_zone_, __LINE__)), \
+                  EXPAND_CONCAT(kwr_zone_once_, __LINE__) = 1; \
+         EXPAND_CONCAT(kwr_zone_once_, __LINE__); \
+         EXPAND_CONCAT(kwr_zone_once_, __LINE__) = 0, \
+         Kwr_LeaveZone(&EXPAND_CONCAT(kwr_zone_, __LINE__), EXPAND_CONCAT(kwr_zone_start_, __LINE__)))
+#else
+#define PROFILE_ZONE(name_)
+#endif
+
+
+//------------------------------------------------------------
+//# Logging
+//
+// Asynchronous logger.  A log call only stores a fixed-size record
+// (time, level, category, format and up to KWR_LOG_MAX_ARGS arguments)
+// in a lock-free ring owned by the calling thread; a background thread
+// formats and writes the records.  When a ring is full the record is
+// dropped and counted, so logging never blocks or makes a system call.
+//
+// Formats use "{}" for each argument, in order.  Integers, floats,
+// characters and strings are accepted, and pointers of any other type
+// print in hex (so char * is always a string).  Strings are kept by
+// pointer, so they must stay valid until written: pass literals or
+// call Kwr_FlushLog before changing them.
+//
+//     Kwr_LogInfo("maze", "{} x {} grid in {} s", rows, columns, seconds);
+//
+// Calls below KWR_LOG_LEVEL compile out, arguments and all.  Calls at
+// or above it are still filtered by the threshold given to Kwr_OpenLog.
+
+#define KWR_LOG_TRACE  0
+#define KWR_LOG_DEBUG  1
+#define KWR_LOG_INFO   2
+#define KWR_LOG_WARN   3
+#define KWR_LOG_ERROR  4
+
+#ifndef KWR_LOG_LEVEL
+#ifdef DEBUG
+#define KWR_LOG_LEVEL  KWR_LOG_DEBUG
+#else
+#define KWR_LOG_LEVEL  KWR_LOG_INFO
+#endif
+#endif
+
+#ifndef KWR_LOG_RING_RECORDS
+#define    KWR_LOG_RING_RECORDS  1024   // per thread, a power of two
+#endif
+
+#define    KWR_LOG_MAX_ARGS  4
+
+typedef enum Kwr_LogLevel {
+    Kwr_LogLevel_Trace = KWR_LOG_TRACE,
+    Kwr_LogLevel_Debug = KWR_LOG_DEBUG,
+    Kwr_LogLevel_Info  = KWR_LOG_INFO,
+    Kwr_LogLevel_Warn  = KWR_LOG_WARN,
+    Kwr_LogLevel_Error = KWR_LOG_ERROR,
+} Kwr_LogLevel;
+
+typedef enum Kwr_LogArgType {
+    Kwr_LogArg_Int, Kwr_LogArg_Unsigned, Kwr_LogArg_Double, Kwr_LogArg_Char,
+    Kwr_LogArg_Bool, Kwr_LogArg_String, Kwr_LogArg_Pointer,
+} Kwr_LogArgType;
+
+typedef union Kwr_LogValue {
+    long long   i;
+    unsigned long long u;
+    double      d;
+    const char *s;
+    const void *p;
+} Kwr_LogValue;
+
+typedef struct Kwr_LogArg {
+    Kwr_LogArgType type;
+    Kwr_LogValue   value;
+} Kwr_LogArg;
+
+ErrorCode  Kwr_OpenLog   (const char *path, Kwr_LogLevel threshold);   // NULL path logs to stderr
+void       Kwr_FlushLog  (void);
+void       Kwr_CloseLog  (void);
+uint64_t   Kwr_LogDropped(void);
+
+void  Kwr_Log (Kwr_LogLevel level, const char *category, const char *format, int num_args, const Kwr_LogArg *args);
+void  Kwr_AppendLogArg (Kwr_Buffer *buf, Kwr_LogArg arg);
+
+static inline Kwr_LogArg Kwr_LogInt      (long long v)           { return (Kwr_LogArg){ Kwr_LogArg_Int,      .value.i = v }; }
+static inline Kwr_LogArg Kwr_LogUnsigned (unsigned long long v)  { return (Kwr_LogArg){ Kwr_LogArg_Unsigned, .value.u = v }; }
+static inline Kwr_LogArg Kwr_LogDouble   (double v)              { return (Kwr_LogArg){ Kwr_LogArg_Double,   .value.d = v }; }
+static inline Kwr_LogArg Kwr_LogChar     (char v)                { return (Kwr_LogArg){ Kwr_LogArg_Char,     .value.i = v }; }
+static inline Kwr_LogArg Kwr_LogBool     (_Bool v)               { return (Kwr_LogArg){ Kwr_LogArg_Bool,     .value.u = v }; }
+static inline Kwr_LogArg Kwr_LogString   (const char *v)         { return (Kwr_LogArg){ Kwr_LogArg_String,   .value.s = v }; }
+static inline Kwr_LogArg Kwr_LogPointer  (const void *v)         { return (Kwr_LogArg){ Kwr_LogArg_Pointer,  .value.p = v }; }
+
+#define Kwr_LogArgOf(v_)  _Generic((v_), \
+            _Bool:               Kwr_LogBool, \
+            char:                Kwr_LogChar, \
+            signed char:         Kwr_LogInt, \
+            short:               Kwr_LogInt, \
+            int:                 Kwr_LogInt, \
+            long:                Kwr_LogInt, \
+            long long:           Kwr_LogInt, \
+            unsigned char:       Kwr_LogUnsigned, \
+            unsigned short:      Kwr_LogUnsigned, \
+            unsigned int:        Kwr_LogUnsigned, \
+            unsigned long:       Kwr_LogUnsigned, \
+            unsigned long long:  Kwr_LogUnsigned, \
+            float:               Kwr_LogDouble, \
+            double:              Kwr_LogDouble, \
+            char*:               Kwr_LogString, \
+            const char*:         Kwr_LogString, \
+            default:             Kwr_LogPointer \
+            ) (v_)
+
+// Kwr_LogArgs_n(format, args...) for n-1 arguments
+#define Kwr_LogArgs_1(f_)                  f_, 0, NULL
+#define Kwr_LogArgs_2(f_, a_)              f_, 1, (Kwr_LogArg[]){ Kwr_LogArgOf(a_) }
+#define Kwr_LogArgs_3(f_, a_, b_)          f_, 2, (Kwr_LogArg[]){ Kwr_LogArgOf(a_), Kwr_LogArgOf(b_) }
+#define Kwr_LogArgs_4(f_, a_, b_, c_)      f_, 3, (Kwr_LogArg[]){ Kwr_LogArgOf(a_), Kwr_LogArgOf(b_), Kwr_LogArgOf(c_) }
+#define Kwr_LogArgs_5(f_, a_, b_, c_, d_)  f_, 4, (Kwr_LogArg[]){ Kwr_LogArgOf(a_), Kwr_LogArgOf(b_), Kwr_LogArgOf(c_), Kwr_LogArgOf(d_) }
+#define Kwr_LogArgs_n(n_)  Kwr_LogArgs_##n_
+#define Kwr_LogArgs(n_)    Kwr_LogArgs_n(n_)
+
+#define Kwr_LogAt(level_, category_, ...)  \
+    Kwr_Log((level_), (category_), Kwr_LogArgs(COUNT_PARMS(__VA_ARGS__))(__VA_ARGS__))
+
+#if KWR_LOG_LEVEL <= KWR_LOG_TRACE
+#define Kwr_LogTrace(category_, ...)  Kwr_LogAt(Kwr_LogLevel_Trace, (category_), __VA_ARGS__)
+#else
+#define Kwr_LogTrace(category_, ...)  NOOP
+#endif
+#if KWR_LOG_LEVEL <= KWR_LOG_DEBUG
+#define Kwr_LogDebug(category_, ...)  Kwr_LogAt(Kwr_LogLevel_Debug, (category_), __VA_ARGS__)
+#else
+#define Kwr_LogDebug(category_, ...)  NOOP
+#endif
+#if KWR_LOG_LEVEL <= KWR_LOG_INFO
+#define Kwr_LogInfo(category_, ...)   Kwr_LogAt(Kwr_LogLevel_Info, (category_), __VA_ARGS__)
+#else
+#define Kwr_LogInfo(category_, ...)   NOOP
+#endif
+#if KWR_LOG_LEVEL <= KWR_LOG_WARN
+#define Kwr_LogWarn(category_, ...)   Kwr_LogAt(Kwr_LogLevel_Warn, (category_), __VA_ARGS__)
+#else
+#define Kwr_LogWarn(category_, ...)   NOOP
+#endif
+#define Kwr_LogError(category_, ...)  Kwr_LogAt(Kwr_LogLevel_Error, (category_), __VA_ARGS__)
 
 
 //------------------------------------------------------------
@@ -124,3 +713,52 @@ typedef struct XorShiftState {
 void XorShift_Init(XorShift *state, uint32_t seed, int params_num);
 uint32_t XorShift_Rand(XorShift *state);
 
+// Fill out[0..n) with random numbers from XorShift_Lanes independent 
+// generators run side by side (AVX2, SSE2 or scalar code; all produce 
+// the same output).  Lanes are seeded from the next XorShift_Rand(state),
+// so successive calls give different numbers.  Common shift triples use
+// kernels with the shifts fixed at compile time.
+enum { XorShift_Lanes = 8 };
+
+void XorShift_Fill(XorShift *state, uint32_t *out, size_t n);
+
+// xoshiro256** (Blackman & Vigna): 256 bits of state, period 2^256-1.
+// Jump advances 2^128 steps and LongJump 2^192 steps, so streams split
+// off one seed never overlap.  InitStream gives stream k of a seed: k
+// jumps past the start, e.g. one stream per thread or grid tile.  Each
+// jump costs about 256 Rand calls, so stream k takes O(k) time; to set
+// up many streams, copy each one and Jump the copy for the next, as the
+// band generators do.
+
+typedef struct Xoshiro256 {
+    uint64_t s[4];
+} Xoshiro256;
+
+uint64_t SplitMix64_Next       (uint64_t *state);
+void     Xoshiro256_Init       (Xoshiro256 *state, uint64_t seed);
+void     Xoshiro256_InitStream (Xoshiro256 *state, uint64_t seed, uint64_t stream);
+uint64_t Xoshiro256_Rand       (Xoshiro256 *state);
+void     Xoshiro256_Jump       (Xoshiro256 *state);
+void     Xoshiro256_LongJump   (Xoshiro256 *state);
+
+// Unbiased random integers in [0, n) by multiply-shift with rejection
+// (Lemire), without a division in the common case.  Requires n > 0.
+uint32_t XorShift_RandBelow   (XorShift *state, uint32_t n);
+uint64_t Xoshiro256_RandBelow (Xoshiro256 *state, uint64_t n);
+void     XorShift_Shuffle     (XorShift *state, void *items, size_t count, size_t item_size);
+void     Xoshiro256_Shuffle   (Xoshiro256 *state, void *items, size_t count, size_t item_size);
+
+#define Kwr_RandBelow(state_, n_)  _Generic((state_), \
+            XorShift*:    XorShift_RandBelow, \
+            Xoshiro256*:  Xoshiro256_RandBelow \
+            ) ((state_), (n_))
+
+#define Kwr_Shuffle(state_, ...)  _Generic((state_), \
+            XorShift*:    XorShift_Shuffle, \
+            Xoshiro256*:  Xoshiro256_Shuffle \
+            ) ((state_), __VA_ARGS__)
+
+// Dynarray helpers: Fisher-Yates shuffle and uniform random element
+#define shuffle(da_, rng_)        Kwr_Shuffle((rng_), (da_)->begin, length(da_), sizeof(*(da_)->begin))
+#define random_choice(da_, rng_)  (requires(!is_empty(da_)), (da_)->begin[Kwr_RandBelow((rng_), length(da_))])
+
@@ -1,5 +1,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "kwrlib.h"
 #include "kwrmaze.h"
@@ -37,22 +39,81 @@ void Maze_UnlinkCells(Maze_Cell *cell, Maze_Cell *cell_b)
     if ((link = Maze_FindLink(cell_b, cell)))  *link = NULL;
 }
 
+static void *Maze_Alloc(Kwr_Arena *arena, size_t size)
+{
+    return arena? Kwr_ArenaAlloc(arena, size): kalloc(NULL, size);
+}
+
+static void Maze_Free(Kwr_Arena *arena, void *ptr)
+{
+    if (!arena && ptr)  kfree(ptr);  // arena memory is freed by resetting the arena
+}
+
+static int Maze_TilesFor(int cells)
+{
+    return (cells + Maze_TileSize - 1) >> Maze_TileShift;
+}
+
+// Spread the low bits of x to the even bit positions
+static inline size_t Maze_SpreadBits(unsigned x)
+{
+    x = (x | (x << 2)) & 0x33;
+    x = (x | (x << 1)) & 0x55;
+    return x;
+}
+
+// Index into grid->cells, including the padding of tiled layouts
+size_t Maze_GridCellIndex(Maze_Grid *grid, int row, int col)
+{
+    requires(grid);
+    if (grid->layout == Maze_Layout_RowMajor)  return (size_t)row * grid->num_columns + col;
+
+    size_t tile = (size_t)(row >> Maze_TileShift) * grid->tiles_across + (col >> Maze_TileShift);
+    unsigned in_row = row & (Maze_TileSize-1), in_col = col & (Maze_TileSize-1);
+    size_t in_tile = (grid->layout == Maze_Layout_Morton)
+        ? Maze_SpreadBits(in_row) << 1 | Maze_SpreadBits(in_col)
+        : in_row << Maze_TileShift | in_col;
+    return tile << (2 * Maze_TileShift) | in_tile;
+}
+
+// Number of cells stored, including padding
+size_t Maze_GridStorage(Maze_Grid *grid)
+{
+    requires(grid);
+    if (grid->layout == Maze_Layout_RowMajor)  return (size_t)grid->num_rows * grid->num_columns;
+    return (size_t)Maze_TilesFor(grid->num_rows) * Maze_TilesFor(grid->num_columns) << (2 * Maze_TileShift);
+}
+
 void Maze_InitGrid(Maze_Grid *grid)
 {
     requires(grid);
+    requires(Maze_Layout_RowMajor <= grid->layout && grid->layout <= Maze_Layout_Morton);
 
-    int num_cells = grid->num_rows * grid->num_columns;
-    grid->cells   = malloc(num_cells * sizeof(Maze_Cell));
-    grid->rows    = malloc(grid->num_rows * sizeof(Maze_Cell*));
+    PROFILE_ZONE("Maze_InitGrid") {
+        grid->tiles_across = Maze_TilesFor(grid->num_columns);
+        size_t storage = Maze_GridStorage(grid);
+        grid->cells    = Maze_Alloc(grid->arena, storage * sizeof(Maze_Cell));
+        grid->rows     = NULL;
 
-    Maze_Cell *cell = grid->cells;
-    for (int r = 0; r < grid->num_rows; ++r) {
-        grid->rows[r] = cell;
-        for (int c = 0; c < grid->num_columns; ++c) {
-            *cell++ = (Maze_Cell){ .row = r, .column = c };
+        if (grid->layout == Maze_Layout_RowMajor) {
+            grid->rows = Maze_Alloc(grid->arena, grid->num_rows * sizeof(Maze_Cell*));
+            Maze_Cell *cell = grid->cells;
+            for (int r = 0; r < grid->num_rows; ++r) {
+                grid->rows[r] = cell;
+                for (int c = 0; c < grid->num_columns; ++c) {
+                    *cell++ = (Maze_Cell){ .row = r, .column = c };
+                }
+            }
+        }
+        else {
+            for (size_t i = 0; i < storage; ++i)  grid->cells[i] = (Maze_Cell){ .row = -1, .column = -1 };
+            for (int r = 0; r < grid->num_rows; ++r) {
+                for (int c = 0; c < grid->num_columns; ++c) {
+                    grid->cells[Maze_GridCellIndex(grid, r, c)] = (Maze_Cell){ .row = r, .column = c };
+                }
+            }
         }
     }
-
 }
 
 Maze_Cell *Maze_GridCellAt(Maze_Grid *grid, int row, int col)
@@ -61,7 +122,7 @@ Maze_Cell *Maze_GridCellAt(Maze_Grid *grid, int row, int col)
     
     if (row < 0 || row >= grid->num_rows)     return NULL;
     if (col < 0 || col >= grid->num_columns)  return NULL;
-    return &grid->rows[row][col];
+    return &grid->cells[Maze_GridCellIndex(grid, row, col)];
 }
 
 int Maze_CountGridCells(Maze_Grid *grid)
@@ -74,6 +135,7 @@ void Maze_ForEachGridRow(Maze_Grid *grid, Maze_GridRowFn row_op, void *pass)
 {
     requires(grid);
     requires(row_op);
+    requires_m(grid->layout == Maze_Layout_RowMajor, "rows are contiguous only in row-major grids");
 
     for (int r = 0; r < grid->num_rows; ++r) {
         row_op(grid->rows[r], pass);
@@ -83,8 +145,8 @@ void Maze_ForEachGridRow(Maze_Grid *grid, Maze_GridRowFn row_op, void *pass)
 void Maze_DisposeGrid(Maze_Grid *grid)
 {
     if (grid) {  // okay to pass NULL, just ignore it
-        if (grid->cells)   free(grid->cells);
-        if (grid->rows)     free(grid->rows);
+        Maze_Free(grid->arena, grid->cells);
+        Maze_Free(grid->arena, grid->rows);
         *grid = (Maze_Grid){0};
     }
 }
@@ -93,13 +155,1437 @@ Maze_Cell *Maze_GoNorth(Maze_Grid *grid, Maze_Cell *cell)
 {
     requires(grid);
     requires(cell);
-    return (cell->row > 0)? &grid->rows[cell->row-1][cell->column]: NULL;
+    return (cell->row > 0)? &grid->cells[Maze_GridCellIndex(grid, cell->row-1, cell->column)]: NULL;
 }
 
 Maze_Cell *Maze_GoEast(Maze_Grid *grid, Maze_Cell *cell)
 {
     requires(grid);
     requires(cell);
-    return (cell->column < grid->num_columns-1)? &grid->rows[cell->row][cell->column+1]: NULL;
+    return (cell->column < grid->num_columns-1)? &grid->cells[Maze_GridCellIndex(grid, cell->row, cell->column+1)]: NULL;
+}
+
+Maze_Cell *Maze_GoSouth(Maze_Grid *grid, Maze_Cell *cell)
+{
+    requires(grid);
+    requires(cell);
+    return (cell->row < grid->num_rows-1)? &grid->cells[Maze_GridCellIndex(grid, cell->row+1, cell->column)]: NULL;
+}
+
+Maze_Cell *Maze_GoWest(Maze_Grid *grid, Maze_Cell *cell)
+{
+    requires(grid);
+    requires(cell);
+    return (cell->column > 0)? &grid->cells[Maze_GridCellIndex(grid, cell->row, cell->column-1)]: NULL;
+}
+
+
+
+//------------------------------------------------------------
+//# Compact Grid
+
+size_t Maze_CompactRowBytes(int num_columns)
+{
+    requires(num_columns > 0);
+    return ((size_t)num_columns + Maze_CellsPerByte - 1) / Maze_CellsPerByte;
+}
+
+void Maze_InitCompactGrid(Maze_CompactGrid *grid)
+{
+    requires(grid);
+    requires(grid->num_rows > 0 && grid->num_columns > 0);
+
+    grid->row_bytes = Maze_CompactRowBytes(grid->num_columns);
+    size_t size     = grid->row_bytes * grid->num_rows;
+    grid->passages  = Maze_Alloc(grid->arena, size);
+    if (grid->passages)  memset(grid->passages, 0, size);
+}
+
+void Maze_DisposeCompactGrid(Maze_CompactGrid *grid)
+{
+    if (grid) {  // okay to pass NULL, just ignore it
+        if (grid->mapping)  Kwr_UnmapFile(grid->mapping, grid->mapping_size);
+        else                Maze_Free(grid->arena, grid->passages);
+        *grid = (Maze_CompactGrid){0};
+    }
+}
+
+uint8_t *Maze_CompactGridRow(Maze_CompactGrid *grid, int row)
+{
+    requires(grid);
+    requires(0 <= row && row < grid->num_rows);
+    return grid->passages + grid->row_bytes * row;
+}
+
+static inline unsigned Maze_CompactShift(int col)
+{
+    return (col % Maze_CellsPerByte) * Maze_Passage_Bits;
+}
+
+unsigned Maze_CompactCellBits(Maze_CompactGrid *grid, int row, int col)
+{
+    requires(0 <= col && col < grid->num_columns);
+    uint8_t *row_bits = Maze_CompactGridRow(grid, row);
+    return (row_bits[col / Maze_CellsPerByte] >> Maze_CompactShift(col)) & Maze_Passage_Mask;
+}
+
+// South and west passages are stored in the neighboring cell, so move
+// (row, col) to the cell that owns the passage bit and return the bit.
+static unsigned Maze_CompactPassageOwner(Maze_CompactGrid *grid, int *row, int *col, Maze_Dir dir)
+{
+    requires(grid);
+    requires(0 <= *row && *row < grid->num_rows);
+    requires(0 <= *col && *col < grid->num_columns);
+    requires(Maze_Dir_First <= dir && dir < Maze_Dir_End);
+
+    switch (dir) {
+        case Maze_Dir_North:
+            requires_m(*row > 0, "no cell north of row 0");
+            return Maze_Passage_North;
+        case Maze_Dir_East:
+            requires_m(*col < grid->num_columns-1, "no cell east of last column");
+            return Maze_Passage_East;
+        case Maze_Dir_South:
+            requires_m(*row < grid->num_rows-1, "no cell south of last row");
+            ++*row;
+            return Maze_Passage_North;
+        case Maze_Dir_West:
+            requires_m(*col > 0, "no cell west of column 0");
+            --*col;
+            return Maze_Passage_East;
+        default:
+            return 0;
+    }
+}
+
+void Maze_CompactLinkCells(Maze_CompactGrid *grid, int row, int col, Maze_Dir dir)
+{
+    unsigned bit = Maze_CompactPassageOwner(grid, &row, &col, dir);
+    Maze_CompactGridRow(grid, row)[col / Maze_CellsPerByte] |= bit << Maze_CompactShift(col);
+}
+
+void Maze_CompactUnlinkCells(Maze_CompactGrid *grid, int row, int col, Maze_Dir dir)
+{
+    unsigned bit = Maze_CompactPassageOwner(grid, &row, &col, dir);
+    Maze_CompactGridRow(grid, row)[col / Maze_CellsPerByte] &= ~(bit << Maze_CompactShift(col));
 }
 
+_Bool Maze_CompactIsLinked(Maze_CompactGrid *grid, int row, int col, Maze_Dir dir)
+{
+    requires(grid);
+
+    // Edge cells are never linked to the outside
+    if ((dir == Maze_Dir_North && row == 0) ||
+        (dir == Maze_Dir_South && row == grid->num_rows-1) ||
+        (dir == Maze_Dir_West  && col == 0) ||
+        (dir == Maze_Dir_East  && col == grid->num_columns-1))  return false;
+
+    unsigned bit = Maze_CompactPassageOwner(grid, &row, &col, dir);
+    return (Maze_CompactCellBits(grid, row, col) & bit) != 0;
+}
+
+_Bool Maze_CompactGoNorth(Maze_CompactGrid *grid, int *row, int *col)
+{
+    requires(grid);
+    requires(row && col);
+    if (*row <= 0)  return false;
+    --*row;
+    return true;
+}
+
+_Bool Maze_CompactGoEast(Maze_CompactGrid *grid, int *row, int *col)
+{
+    requires(grid);
+    requires(row && col);
+    if (*col >= grid->num_columns-1)  return false;
+    ++*col;
+    return true;
+}
+
+_Bool Maze_CompactGoSouth(Maze_CompactGrid *grid, int *row, int *col)
+{
+    requires(grid);
+    requires(row && col);
+    if (*row >= grid->num_rows-1)  return false;
+    ++*row;
+    return true;
+}
+
+_Bool Maze_CompactGoWest(Maze_CompactGrid *grid, int *row, int *col)
+{
+    requires(grid);
+    requires(row && col);
+    if (*col <= 0)  return false;
+    --*col;
+    return true;
+}
+
+
+
+//------------------------------------------------------------
+//# Maze Generation
+
+// Replace the passage bits of one cell in a compact grid row
+static inline void Maze_PutCellBits(uint8_t *row_bits, int col, unsigned bits)
+{
+    uint8_t *byte = &row_bits[col / Maze_CellsPerByte];
+    unsigned shift = Maze_CompactShift(col);
+    *byte = (*byte & ~(Maze_Passage_Mask << shift)) | (bits << shift);
+}
+
+static inline void Maze_AddCellBits(uint8_t *row_bits, int col, unsigned bits)
+{
+    row_bits[col / Maze_CellsPerByte] |= bits << Maze_CompactShift(col);
+}
+
+// Keep the unused cells in the last byte of a row blank
+static inline void Maze_ClearRowPadding(uint8_t *row_bits, int num_columns)
+{
+    int used = num_columns % Maze_CellsPerByte;
+    if (used)  row_bits[num_columns / Maze_CellsPerByte] &= (1u << (used * Maze_Passage_Bits)) - 1;
+}
+
+// The top row of Binary Tree and Sidewinder mazes is one long corridor
+static void Maze_OpenRowEast(uint8_t *row_bits, size_t row_bytes, int num_columns)
+{
+    memset(row_bits, 0xAA, row_bytes);  // 0b10 = Maze_Passage_East in every cell
+    Maze_PutCellBits(row_bits, num_columns-1, 0);
+    Maze_ClearRowPadding(row_bits, num_columns);
+}
+
+typedef void (*Maze_RowFn)(uint8_t *row_bits, size_t row_bytes, int row, int num_columns, Xoshiro256 *rng);
+
+// Every cell links north or east, one random bit per cell.  A byte of
+// four cells is looked up from four random bits.
+#define MAZE_BT_CELL(n_, i_)  ((((n_) >> (i_)) & 1? Maze_Passage_East: Maze_Passage_North) << ((i_) * Maze_Passage_Bits))
+#define MAZE_BT_BYTE(n_)      (MAZE_BT_CELL(n_, 0) | MAZE_BT_CELL(n_, 1) | MAZE_BT_CELL(n_, 2) | MAZE_BT_CELL(n_, 3))
+
+static void Maze_BinaryTreeRow(uint8_t *row_bits, size_t row_bytes, int row, int num_columns, Xoshiro256 *rng)
+{
+    static const uint8_t choose[16] = {
+        MAZE_BT_BYTE(0),  MAZE_BT_BYTE(1),  MAZE_BT_BYTE(2),  MAZE_BT_BYTE(3), 
+        MAZE_BT_BYTE(4),  MAZE_BT_BYTE(5),  MAZE_BT_BYTE(6),  MAZE_BT_BYTE(7), 
+        MAZE_BT_BYTE(8),  MAZE_BT_BYTE(9),  MAZE_BT_BYTE(10), MAZE_BT_BYTE(11), 
+        MAZE_BT_BYTE(12), MAZE_BT_BYTE(13), MAZE_BT_BYTE(14), MAZE_BT_BYTE(15), 
+    };
+
+    if (row == 0) {
+        Maze_OpenRowEast(row_bits, row_bytes, num_columns);
+        return;
+    }
+
+    uint64_t bits = 0;
+    for (size_t i = 0; i < row_bytes; ++i, bits >>= 4) {
+        if (i % 16 == 0)  bits = Xoshiro256_Rand(rng);
+        row_bits[i] = choose[bits & 15];
+    }
+
+    // The east column can only link north
+    Maze_PutCellBits(row_bits, num_columns-1, Maze_Passage_North);
+    Maze_ClearRowPadding(row_bits, num_columns);
+}
+
+// Carve east in runs; closing a run links one random cell of the run north
+static void Maze_SidewinderRow(uint8_t *row_bits, size_t row_bytes, int row, int num_columns, Xoshiro256 *rng)
+{
+    if (row == 0) {
+        Maze_OpenRowEast(row_bits, row_bytes, num_columns);
+        return;
+    }
+
+    memset(row_bits, 0, row_bytes);
+
+    uint64_t bits = 0;
+    int run_start = 0;
+    for (int col = 0; col < num_columns; ++col, bits >>= 1) {
+        if (col % 64 == 0)  bits = Xoshiro256_Rand(rng);
+
+        if (col == num_columns-1 || (bits & 1)) {
+            int pick = run_start + (int)Xoshiro256_RandBelow(rng, col - run_start + 1);
+            Maze_AddCellBits(row_bits, pick, Maze_Passage_North);
+            run_start = col + 1;
+        }
+        else {
+            Maze_AddCellBits(row_bits, col, Maze_Passage_East);
+        }
+    }
+}
+
+typedef struct Maze_BandJob {
+    Maze_CompactGrid *grid;
+    Maze_RowFn row_fn;
+    Xoshiro256 *streams;
+} Maze_BandJob;
+
+static void Maze_GenerateBand(void *data, size_t band)
+{
+    Maze_BandJob *job = data;
+    Maze_CompactGrid *grid = job->grid;
+    Xoshiro256 rng = job->streams[band];
+
+    int first = (int)band * Maze_BandRows;
+    int end   = first + Maze_BandRows < grid->num_rows? first + Maze_BandRows: grid->num_rows;
+    for (int row = first; row < end; ++row) {
+        job->row_fn(Maze_CompactGridRow(grid, row), grid->row_bytes, row, grid->num_columns, &rng);
+    }
+}
+
+static ErrorCode Maze_GenerateBands(Maze_CompactGrid *grid, uint64_t seed, int num_threads, Maze_RowFn row_fn)
+{
+    requires(grid);
+    requires(grid->passages);
+
+    size_t num_bands = ((size_t)grid->num_rows + Maze_BandRows - 1) / Maze_BandRows;
+    Xoshiro256 *streams = kalloc(NULL, num_bands * sizeof(*streams));
+    if (!streams)  return ErrorCode_AllocationFailed;
+
+    Xoshiro256_Init(&streams[0], seed);
+    for (size_t band = 1; band < num_bands; ++band) {
+        streams[band] = streams[band-1];
+        Xoshiro256_Jump(&streams[band]);
+    }
+
+    Maze_BandJob job = { .grid = grid, .row_fn = row_fn, .streams = streams };
+    Kwr_ParallelFor(num_bands, num_threads, Maze_GenerateBand, &job);
+
+    kfree(streams);
+    return ErrorCode_OK;
+}
+
+ErrorCode Maze_BinaryTree(Maze_CompactGrid *grid, uint64_t seed, int num_threads)
+{
+    ErrorCode error;
+    PROFILE_ZONE("Maze_BinaryTree")  error = Maze_GenerateBands(grid, seed, num_threads, Maze_BinaryTreeRow);
+    return error;
+}
+
+ErrorCode Maze_Sidewinder(Maze_CompactGrid *grid, uint64_t seed, int num_threads)
+{
+    ErrorCode error;
+    PROFILE_ZONE("Maze_Sidewinder")  error = Maze_GenerateBands(grid, seed, num_threads, Maze_SidewinderRow);
+    return error;
+}
+
+
+
+//------------------------------------------------------------
+//# Streaming Maze Generation
+
+const char *Maze_AlgorithmName(Maze_Algorithm algorithm)
+{
+#define X(Name)  [Maze_Algorithm_##Name] = #Name,
+    static const char *algorithm_names[] = {
+        MAZE_ALGORITHM_X_TABLE
+    };
+#undef X
+
+    return (algorithm < Maze_Algorithm_Count)? algorithm_names[algorithm]: "Unknown";
+}
+
+Maze_Algorithm Maze_AlgorithmFromName(const char *name)
+{
+    requires(name);
+    for (Maze_Algorithm algorithm = Maze_Algorithm_First; algorithm < Maze_Algorithm_End; ++algorithm) {
+        if (!strcmp(name, Maze_AlgorithmName(algorithm)))  return algorithm;
+    }
+    return Maze_Algorithm_End;
+}
+
+ErrorCode Maze_CopyRowToGrid(void *grid, int row, const uint8_t *row_bits, size_t row_bytes)
+{
+    Maze_CompactGrid *dest = grid;
+    requires(dest && dest->passages);
+    requires(row_bytes == dest->row_bytes);
+
+    memcpy(Maze_CompactGridRow(dest, row), row_bits, row_bytes);
+    return ErrorCode_OK;
+}
+
+ErrorCode Maze_WriteRowToFile(void *file, int row, const uint8_t *row_bits, size_t row_bytes)
+{
+    requires(file);
+    UNUSED(row);
+    return fwrite(row_bits, 1, row_bytes, file) == row_bytes? ErrorCode_OK: ErrorCode_Failure;
+}
+
+// Band streams advance by one jump every Maze_BandRows rows, matching
+// the streams of the in-memory generators
+static ErrorCode Maze_StreamBands(Maze_RowFn row_fn, int num_rows, int num_columns, uint64_t seed, Maze_RowSink sink)
+{
+    size_t row_bytes = Maze_CompactRowBytes(num_columns);
+    uint8_t *row_bits = kalloc(NULL, row_bytes);
+    if (!row_bits)  return ErrorCode_AllocationFailed;
+
+    Xoshiro256 band_start, rng;
+    Xoshiro256_Init(&band_start, seed);
+
+    ErrorCode error = ErrorCode_OK;
+    for (int row = 0; row < num_rows && !error; ++row) {
+        if (row % Maze_BandRows == 0) {
+            if (row)  Xoshiro256_Jump(&band_start);
+            rng = band_start;
+        }
+        row_fn(row_bits, row_bytes, row, num_columns, &rng);
+        error = sink.put_row(sink.data, row, row_bits, row_bytes);
+    }
+
+    kfree(row_bits);
+    return error;
+}
+
+static int Maze_EllerFind(int *parent, int label)
+{
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+// Eller's algorithm keeps the set of every cell in the current row.  
+// Adjacent cells of different sets are randomly joined east, then every
+// set sends at least one cell south, which becomes the north passage of
+// the next row.  The last row joins every remaining set.  Set labels are
+// kept in [0, num_columns) so a row needs only O(columns) memory.
+static ErrorCode Maze_StreamEller(int num_rows, int num_columns, uint64_t seed, Maze_RowSink sink)
+{
+    size_t n = num_columns;
+    size_t row_bytes = Maze_CompactRowBytes(num_columns);
+    int *label = kalloc(NULL, 4 * n * sizeof(int));
+    uint8_t *bits = kalloc(NULL, 2 * row_bytes);
+    if (!label || !bits) {
+        kfree(label);
+        kfree(bits);
+        return ErrorCode_AllocationFailed;
+    }
+
+    int *parent    = label + n;    // union-find over labels
+    int *remaining = parent + n;   // cells of a set not yet visited; then labels in use
+    int *went_south = remaining + n;
+    uint8_t *row_bits = bits, *next_bits = bits + row_bytes;
+    memset(row_bits, 0, row_bytes);
+    for (int c = 0; c < num_columns; ++c)  label[c] = c;
+
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, seed);
+    uint64_t random = 0;
+    int random_bits = 0;
+#define MAZE_ELLER_COIN()  (random_bits? 0: (random = Xoshiro256_Rand(&rng), random_bits = 64), --random_bits, (random >> random_bits) & 1)
+
+    ErrorCode error = ErrorCode_OK;
+    for (int row = 0; row < num_rows && !error; ++row) {
+        _Bool last_row = (row == num_rows-1);
+
+        for (int c = 0; c < num_columns; ++c)  parent[c] = c;
+        for (int c = 0; c+1 < num_columns; ++c) {
+            int a = Maze_EllerFind(parent, label[c]);
+            int b = Maze_EllerFind(parent, label[c+1]);
+            if (a != b && (last_row || MAZE_ELLER_COIN())) {
+                parent[b] = a;
+                Maze_AddCellBits(row_bits, c, Maze_Passage_East);
+            }
+        }
+
+        if (!last_row) {
+            memset(next_bits, 0, row_bytes);
+            memset(remaining, 0, n * sizeof(int));
+            for (int c = 0; c < num_columns; ++c)  ++remaining[Maze_EllerFind(parent, label[c])];
+
+            // A set's last cell goes south if none of the others did
+            memset(went_south, 0, n * sizeof(int));
+            for (int c = 0; c < num_columns; ++c) {
+                int root = Maze_EllerFind(parent, label[c]);
+                --remaining[root];
+                if (MAZE_ELLER_COIN() || (!remaining[root] && !went_south[root])) {
+                    Maze_AddCellBits(next_bits, c, Maze_Passage_North);
+                    went_south[root] = 1;
+                    label[c] = root;
+                }
+                else {
+                    label[c] = -1;
+                }
+            }
+
+            // Cells that did not come from above start new sets
+            memset(remaining, 0, n * sizeof(int));
+            for (int c = 0; c < num_columns; ++c)  if (label[c] >= 0)  remaining[label[c]] = 1;
+            for (int c = 0, free_label = 0; c < num_columns; ++c) {
+                if (label[c] >= 0)  continue;
+                while (remaining[free_label])  ++free_label;
+                remaining[free_label] = 1;
+                label[c] = free_label;
+            }
+        }
+
+        Maze_ClearRowPadding(row_bits, num_columns);
+        error = sink.put_row(sink.data, row, row_bits, row_bytes);
+
+        uint8_t *swap = row_bits;
+        row_bits  = next_bits;
+        next_bits = swap;
+    }
+#undef MAZE_ELLER_COIN
+
+    kfree(label);
+    kfree(bits);
+    return error;
+}
+
+ErrorCode Maze_StreamMaze(Maze_Algorithm algorithm, int num_rows, int num_columns, uint64_t seed, Maze_RowSink sink)
+{
+    requires(num_rows > 0 && num_columns > 0);
+    requires(sink.put_row);
+
+    switch (algorithm) {
+        case Maze_Algorithm_BinaryTree:  return Maze_StreamBands(Maze_BinaryTreeRow, num_rows, num_columns, seed, sink);
+        case Maze_Algorithm_Sidewinder:  return Maze_StreamBands(Maze_SidewinderRow, num_rows, num_columns, seed, sink);
+        case Maze_Algorithm_Eller:       return Maze_StreamEller(num_rows, num_columns, seed, sink);
+        default:                         return ErrorCode_Error;
+    }
+}
+
+ErrorCode Maze_Eller(Maze_CompactGrid *grid, uint64_t seed)
+{
+    requires(grid && grid->passages);
+
+    ErrorCode error;
+    PROFILE_ZONE("Maze_Eller")  error = Maze_StreamEller(grid->num_rows, grid->num_columns, seed, (Maze_RowSink){ Maze_CopyRowToGrid, grid });
+    return error;
+}
+
+
+
+//------------------------------------------------------------
+//# Random Walk Generators
+
+typedef dynarray(uint32_t) Maze_CellStack;
+
+// Cell position kept as both index and (row, col) to avoid divisions
+typedef struct Maze_Walker {
+    uint32_t cell;
+    int row, col;
+} Maze_Walker;
+
+static inline _Bool Maze_CanGo(Maze_CompactGrid *grid, Maze_Walker *at, Maze_Dir dir)
+{
+    switch (dir) {
+        case Maze_Dir_North:  return at->row > 0;
+        case Maze_Dir_East:   return at->col < grid->num_columns-1;
+        case Maze_Dir_West:   return at->col > 0;
+        case Maze_Dir_South:  return at->row < grid->num_rows-1;
+        default:              return false;
+    }
+}
+
+// Requires Maze_CanGo(grid, at, dir)
+static inline Maze_Walker Maze_Step(Maze_CompactGrid *grid, Maze_Walker at, Maze_Dir dir)
+{
+    switch (dir) {
+        case Maze_Dir_North:  return (Maze_Walker){ at.cell - grid->num_columns, at.row-1, at.col };
+        case Maze_Dir_East:   return (Maze_Walker){ at.cell + 1, at.row, at.col+1 };
+        case Maze_Dir_West:   return (Maze_Walker){ at.cell - 1, at.row, at.col-1 };
+        default:              return (Maze_Walker){ at.cell + grid->num_columns, at.row+1, at.col };
+    }
+}
+
+static inline Maze_Walker Maze_WalkerAt(Maze_CompactGrid *grid, uint32_t cell)
+{
+    return (Maze_Walker){ cell, (int)(cell / grid->num_columns), (int)(cell % grid->num_columns) };
+}
+
+// Open the passage from `at` toward dir, without the public API's checks
+static inline void Maze_OpenPassage(Maze_CompactGrid *grid, Maze_Walker at, Maze_Dir dir)
+{
+    int row = at.row, col = at.col;
+    unsigned bit = Maze_Passage_North;
+    switch (dir) {
+        case Maze_Dir_North:  break;
+        case Maze_Dir_East:   bit = Maze_Passage_East;  break;
+        case Maze_Dir_West:   bit = Maze_Passage_East;  --col;  break;
+        default:              ++row;  break;
+    }
+    Maze_AddCellBits(grid->passages + grid->row_bytes * row, col, bit);
+}
+
+// Random directions, two bits at a time, redrawn until the move is legal
+typedef struct Maze_RandomDirs {
+    Xoshiro256 rng;
+    uint64_t bits;
+    int count;
+} Maze_RandomDirs;
+
+static inline Maze_Dir Maze_RandomDir(Maze_RandomDirs *dirs, Maze_CompactGrid *grid, Maze_Walker *at)
+{
+    for (;;) {
+        if (!dirs->count) {
+            dirs->bits  = Xoshiro256_Rand(&dirs->rng);
+            dirs->count = 32;
+        }
+        Maze_Dir dir = (Maze_Dir)(dirs->bits & 3);
+        dirs->bits >>= 2;
+        --dirs->count;
+        if (Maze_CanGo(grid, at, dir))  return dir;
+    }
+}
+
+static void Maze_FinishStats(Maze_GenStats *stats, Maze_CompactGrid *grid, uint64_t steps, uint64_t start)
+{
+    if (stats) {
+        double seconds = (Kwr_ClockNow() - start) * 1e-9;
+        *stats = (Maze_GenStats){
+            .cells   = (uint64_t)grid->num_rows * grid->num_columns,
+            .steps   = steps,
+            .seconds = seconds,
+            .cells_per_second = seconds > 0? (double)grid->num_rows * grid->num_columns / seconds: 0,
+        };
+    }
+}
+
+// Clear passages and allocate a visited bit set; returns NULL on failure
+static uint64_t *Maze_StartWalk(Maze_CompactGrid *grid, Maze_RandomDirs *dirs, uint64_t seed)
+{
+    requires(grid && grid->passages);
+    requires_m((uint64_t)grid->num_rows * grid->num_columns <= UINT32_MAX, "random walk generators support up to 2^32 cells");
+
+    memset(grid->passages, 0, grid->row_bytes * grid->num_rows);
+    *dirs = (Maze_RandomDirs){0};
+    Xoshiro256_Init(&dirs->rng, seed);
+
+    size_t words = bitset_words((size_t)grid->num_rows * grid->num_columns);
+    uint64_t *visited = kalloc(NULL, words * sizeof(uint64_t));
+    if (visited)  memset(visited, 0, words * sizeof(uint64_t));
+    return visited;
+}
+
+ErrorCode Maze_Backtracker(Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats)
+{
+    uint64_t start = Kwr_ClockNow();
+    Maze_RandomDirs dirs;
+    uint64_t *visited = Maze_StartWalk(grid, &dirs, seed);
+    Maze_CellStack *stack = new_dynarray(uint32_t, 1024);
+    if (!visited || !stack) {
+        kfree(visited);
+        Dynarray_Dispose(stack);
+        return ErrorCode_AllocationFailed;
+    }
+
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    uint32_t first = (uint32_t)Xoshiro256_RandBelow(&dirs.rng, num_cells);
+    bitset_set(visited, first);
+    push(stack, first);
+
+    uint64_t steps = 0;
+    PROFILE_ZONE("Maze_Backtracker") while (!is_empty(stack)) {
+        Maze_Walker at = Maze_WalkerAt(grid, stack->begin[length(stack)-1]);
+
+        Maze_Dir open[Maze_Dir_End];
+        int num_open = 0;
+        for (Maze_Dir dir = Maze_Dir_First; dir < Maze_Dir_End; ++dir) {
+            if (Maze_CanGo(grid, &at, dir) && !bitset_test(visited, Maze_Step(grid, at, dir).cell))  open[num_open++] = dir;
+        }
+
+        if (!num_open) {
+            --stack->length;  // dead end, back up
+            continue;
+        }
+
+        Maze_Dir dir = open[num_open > 1? Xoshiro256_RandBelow(&dirs.rng, num_open): 0];
+        Maze_Walker next = Maze_Step(grid, at, dir);
+        Maze_OpenPassage(grid, at, dir);
+        bitset_set(visited, next.cell);
+        push_grow(stack, next.cell);
+        ++steps;
+    }
+
+    Dynarray_Dispose(stack);
+    kfree(visited);
+    Maze_FinishStats(stats, grid, steps, start);
+    return ErrorCode_OK;
+}
+
+ErrorCode Maze_AldousBroder(Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats)
+{
+    uint64_t start = Kwr_ClockNow();
+    Maze_RandomDirs dirs;
+    uint64_t *visited = Maze_StartWalk(grid, &dirs, seed);
+    if (!visited)  return ErrorCode_AllocationFailed;
+
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    Maze_Walker at = Maze_WalkerAt(grid, (uint32_t)Xoshiro256_RandBelow(&dirs.rng, num_cells));
+    bitset_set(visited, at.cell);
+
+    uint64_t steps = 0;
+    PROFILE_ZONE("Maze_AldousBroder") for (uint32_t unvisited = num_cells - 1; unvisited; ++steps) {
+        Maze_Dir dir = Maze_RandomDir(&dirs, grid, &at);
+        Maze_Walker next = Maze_Step(grid, at, dir);
+        if (!bitset_test(visited, next.cell)) {
+            Maze_OpenPassage(grid, at, dir);
+            bitset_set(visited, next.cell);
+            --unvisited;
+        }
+        at = next;
+    }
+
+    kfree(visited);
+    Maze_FinishStats(stats, grid, steps, start);
+    return ErrorCode_OK;
+}
+
+// Wilson: walk randomly from a cell outside the maze until the walk hits
+// the maze, remembering the last direction taken out of each cell.  
+// Following those directions from the start traces the loop-erased path,
+// which is added to the maze.  Directions take 2 bits per cell.
+static inline void Maze_PutExitDir(uint8_t *exits, uint32_t cell, Maze_Dir dir)
+{
+    uint8_t *byte = &exits[cell / 4];
+    unsigned shift = (cell % 4) * 2;
+    *byte = (*byte & ~(3u << shift)) | (dir << shift);
+}
+
+static inline Maze_Dir Maze_GetExitDir(const uint8_t *exits, uint32_t cell)
+{
+    return (Maze_Dir)((exits[cell / 4] >> ((cell % 4) * 2)) & 3);
+}
+
+ErrorCode Maze_Wilson(Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats)
+{
+    uint64_t start = Kwr_ClockNow();
+    Maze_RandomDirs dirs;
+    uint64_t *in_maze = Maze_StartWalk(grid, &dirs, seed);
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    uint8_t *exits = kalloc(NULL, num_cells / 4 + 1);
+    if (!in_maze || !exits) {
+        kfree(in_maze);
+        kfree(exits);
+        return ErrorCode_AllocationFailed;
+    }
+
+    bitset_set(in_maze, (uint32_t)Xoshiro256_RandBelow(&dirs.rng, num_cells));
+
+    uint64_t steps = 0;
+    PROFILE_ZONE("Maze_Wilson") for (uint32_t cell = 0; cell < num_cells; ++cell) {
+        if (bitset_test(in_maze, cell))  continue;
+
+        Maze_Walker first = Maze_WalkerAt(grid, cell);
+        for (Maze_Walker at = first; !bitset_test(in_maze, at.cell); ++steps) {
+            Maze_Dir dir = Maze_RandomDir(&dirs, grid, &at);
+            Maze_PutExitDir(exits, at.cell, dir);
+            at = Maze_Step(grid, at, dir);
+        }
+
+        for (Maze_Walker at = first; !bitset_test(in_maze, at.cell); ) {
+            Maze_Dir dir = Maze_GetExitDir(exits, at.cell);
+            bitset_set(in_maze, at.cell);
+            Maze_OpenPassage(grid, at, dir);
+            at = Maze_Step(grid, at, dir);
+        }
+    }
+
+    kfree(exits);
+    kfree(in_maze);
+    Maze_FinishStats(stats, grid, steps, start);
+    return ErrorCode_OK;
+}
+
+ErrorCode Maze_Generate(Maze_CompactGrid *grid, Maze_Algorithm algorithm, uint64_t seed, int num_threads, Maze_GenStats *stats)
+{
+    uint64_t start = Kwr_ClockNow();
+    ErrorCode error;
+
+    switch (algorithm) {
+        case Maze_Algorithm_BinaryTree:    error = Maze_BinaryTree(grid, seed, num_threads);  break;
+        case Maze_Algorithm_Sidewinder:    error = Maze_Sidewinder(grid, seed, num_threads);  break;
+        case Maze_Algorithm_Eller:         error = Maze_Eller(grid, seed);  break;
+        case Maze_Algorithm_Backtracker:   return Maze_Backtracker(grid, seed, stats);
+        case Maze_Algorithm_AldousBroder:  return Maze_AldousBroder(grid, seed, stats);
+        case Maze_Algorithm_Wilson:        return Maze_Wilson(grid, seed, stats);
+        default:                           return ErrorCode_Error;
+    }
+
+    if (!error)  Maze_FinishStats(stats, grid, 0, start);
+    return error;
+}
+
+
+
+//------------------------------------------------------------
+//# Distances
+
+static inline unsigned Maze_RowCellBits(const uint8_t *row_bits, int col)
+{
+    return (row_bits[col / Maze_CellsPerByte] >> Maze_CompactShift(col)) & Maze_Passage_Mask;
+}
+
+// Open directions of a cell, as a mask of (1 << Maze_Dir)
+static inline unsigned Maze_OpenDirs(Maze_CompactGrid *grid, Maze_Walker at)
+{
+    const uint8_t *row_bits = grid->passages + grid->row_bytes * at.row;
+    unsigned own  = Maze_RowCellBits(row_bits, at.col);
+    unsigned dirs = 0;
+
+    if ((own & Maze_Passage_North) && at.row > 0)                  dirs |= 1u << Maze_Dir_North;
+    if ((own & Maze_Passage_East) && at.col < grid->num_columns-1)  dirs |= 1u << Maze_Dir_East;
+    if (at.col > 0 && (Maze_RowCellBits(row_bits, at.col-1) & Maze_Passage_East))  dirs |= 1u << Maze_Dir_West;
+    if (at.row < grid->num_rows-1 && (Maze_RowCellBits(row_bits + grid->row_bytes, at.col) & Maze_Passage_North))  dirs |= 1u << Maze_Dir_South;
+    return dirs;
+}
+
+static uint32_t Maze_StartSearch(Maze_CompactGrid *grid, const uint32_t *sources, size_t num_sources, uint32_t *distances, uint32_t *queue)
+{
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    for (uint32_t cell = 0; cell < num_cells; ++cell)  distances[cell] = Maze_Unreached;
+
+    uint32_t tail = 0;
+    for (size_t i = 0; i < num_sources; ++i) {
+        requires(sources[i] < num_cells);
+        if (distances[sources[i]] == Maze_Unreached) {
+            distances[sources[i]] = 0;
+            queue[tail++] = sources[i];
+        }
+    }
+    return tail;
+}
+
+// Expand the queue entries [head, end) by one level, appending at *tail
+static void Maze_ExpandQueue(Maze_CompactGrid *grid, uint32_t *distances, uint32_t *queue, uint32_t head, uint32_t end, uint32_t *tail)
+{
+    for (; head < end; ++head) {
+        Maze_Walker at = Maze_WalkerAt(grid, queue[head]);
+        uint32_t next_distance = distances[at.cell] + 1;
+        for (unsigned dirs = Maze_OpenDirs(grid, at); dirs; dirs &= dirs - 1) {
+            Maze_Dir dir = (Maze_Dir)__builtin_ctz(dirs);
+            uint32_t next = Maze_Step(grid, at, dir).cell;
+            if (distances[next] == Maze_Unreached) {
+                distances[next] = next_distance;
+                queue[(*tail)++] = next;
+            }
+        }
+    }
+}
+
+ErrorCode Maze_Distances(Maze_CompactGrid *grid, const uint32_t *sources, size_t num_sources, uint32_t *distances, uint32_t *farthest)
+{
+    requires(grid && grid->passages);
+    requires(sources || !num_sources);
+    requires(distances);
+    requires_m((uint64_t)grid->num_rows * grid->num_columns <= UINT32_MAX, "distances support up to 2^32 cells");
+
+    uint32_t *queue = kalloc(NULL, (size_t)grid->num_rows * grid->num_columns * sizeof(uint32_t));
+    if (!queue)  return ErrorCode_AllocationFailed;
+
+    uint32_t tail = Maze_StartSearch(grid, sources, num_sources, distances, queue);
+    uint32_t head = 0;
+    while (head < tail) {
+        uint32_t end = tail;
+        Maze_ExpandQueue(grid, distances, queue, head, end, &tail);
+        head = end;
+    }
+
+    if (farthest)  *farthest = tail? queue[tail-1]: Maze_Unreached;
+    kfree(queue);
+    return ErrorCode_OK;
+}
+
+// Bit-parallel search works on row-aligned bit sets: one bit per cell,
+// each row starting on a new word.
+typedef struct Maze_RowBits {
+    size_t row_words;
+    uint64_t *north, *east;         // open passages owned by the cell
+    uint64_t *visited, *frontier, *next;
+} Maze_RowBits;
+
+// Gather the even (north) and odd (east) bits of 32 packed cells
+static inline void Maze_SplitPassages(uint64_t packed, uint32_t *north, uint32_t *east)
+{
+    uint64_t n = packed & 0x5555555555555555u, e = (packed >> 1) & 0x5555555555555555u;
+    n = (n | (n >> 1)) & 0x3333333333333333u;   e = (e | (e >> 1)) & 0x3333333333333333u;
+    n = (n | (n >> 2)) & 0x0F0F0F0F0F0F0F0Fu;   e = (e | (e >> 2)) & 0x0F0F0F0F0F0F0F0Fu;
+    n = (n | (n >> 4)) & 0x00FF00FF00FF00FFu;   e = (e | (e >> 4)) & 0x00FF00FF00FF00FFu;
+    n = (n | (n >> 8)) & 0x0000FFFF0000FFFFu;   e = (e | (e >> 8)) & 0x0000FFFF0000FFFFu;
+    *north = (uint32_t)(n | (n >> 16));
+    *east  = (uint32_t)(e | (e >> 16));
+}
+
+static uint64_t Maze_LoadPacked(const uint8_t *row_bits, size_t row_bytes, size_t at)
+{
+    uint64_t packed = 0;
+    size_t n = at >= row_bytes? 0: row_bytes - at < 8? row_bytes - at: 8;
+    for (size_t i = 0; i < n; ++i)  packed |= (uint64_t)row_bits[at + i] << (8 * i);
+    return packed;
+}
+
+static void Maze_BuildRowBits(Maze_CompactGrid *grid, Maze_RowBits *bits)
+{
+    for (int row = 0; row < grid->num_rows; ++row) {
+        const uint8_t *row_bits = grid->passages + grid->row_bytes * row;
+        uint64_t *north = bits->north + bits->row_words * row;
+        uint64_t *east  = bits->east  + bits->row_words * row;
+
+        for (size_t w = 0; w < bits->row_words; ++w) {
+            uint32_t n_lo, e_lo, n_hi, e_hi;
+            Maze_SplitPassages(Maze_LoadPacked(row_bits, grid->row_bytes, w * 16),     &n_lo, &e_lo);
+            Maze_SplitPassages(Maze_LoadPacked(row_bits, grid->row_bytes, w * 16 + 8), &n_hi, &e_hi);
+            north[w] = (uint64_t)n_hi << 32 | n_lo;
+            east[w]  = (uint64_t)e_hi << 32 | e_lo;
+        }
+
+        // No passages out of the grid, nor from padding bits
+        int last = grid->num_columns - 1;
+        uint64_t valid = ~UINT64_C(0) >> (63 - last % 64);
+        north[last / 64] &= valid;
+        east[last / 64]  &= valid & ~(UINT64_C(1) << (last % 64));
+        if (row == 0)  memset(north, 0, bits->row_words * sizeof(uint64_t));
+    }
+}
+
+// One bottom-up level: every unvisited cell joins the next frontier if
+// a linked neighbor is in the frontier.  Returns the new frontier size.
+static uint32_t Maze_BottomUpLevel(Maze_CompactGrid *grid, Maze_RowBits *bits, uint32_t distance, uint32_t *distances)
+{
+    size_t words = bits->row_words;
+    uint32_t found = 0;
+
+    for (int row = 0; row < grid->num_rows; ++row) {
+        size_t at = words * row;
+        const uint64_t *frontier = bits->frontier + at;
+        const uint64_t *east     = bits->east + at;
+        uint64_t *next = bits->next + at;
+
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t west_in  = frontier[w] & east[w];                 // reached by moving east
+            uint64_t carry_in = w? (frontier[w-1] & east[w-1]) >> 63: 0;
+            uint64_t east_in  = (frontier[w] >> 1) & east[w];          // reached by moving west
+            if (w+1 < words)  east_in |= (frontier[w+1] << 63) & east[w];
+
+            uint64_t reached = (west_in << 1) | carry_in | east_in;
+            if (row > 0)                reached |= bits->frontier[at - words + w] & bits->north[at + w];
+            if (row < grid->num_rows-1) reached |= bits->frontier[at + words + w] & bits->north[at + words + w];
+
+            reached &= ~bits->visited[at + w];
+            next[w] = reached;
+            bits->visited[at + w] |= reached;
+
+            for (uint64_t r = reached; r; r &= r - 1) {
+                distances[(uint32_t)row * grid->num_columns + w * 64 + __builtin_ctzll(r)] = distance;
+                ++found;
+            }
+        }
+    }
+
+    uint64_t *swap = bits->frontier;
+    bits->frontier = bits->next;
+    bits->next     = swap;
+    return found;
+}
+
+#ifndef MAZE_BOTTOM_UP_RATIO
+#define    MAZE_BOTTOM_UP_RATIO  32   // search bottom-up when frontier > cells / ratio
+#endif
+
+ErrorCode Maze_DistancesHybrid(Maze_CompactGrid *grid, const uint32_t *sources, size_t num_sources, uint32_t *distances, uint32_t *farthest)
+{
+    requires(grid && grid->passages);
+    requires(sources || !num_sources);
+    requires(distances);
+    requires_m((uint64_t)grid->num_rows * grid->num_columns <= UINT32_MAX, "distances support up to 2^32 cells");
+
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    Maze_RowBits bits  = { .row_words = bitset_words((size_t)grid->num_columns) };
+    size_t set_words   = bits.row_words * grid->num_rows;
+    uint32_t *queue    = kalloc(NULL, (size_t)num_cells * sizeof(uint32_t));
+    uint64_t *sets     = kalloc(NULL, 5 * set_words * sizeof(uint64_t));
+    if (!queue || !sets) {
+        kfree(queue);
+        kfree(sets);
+        return ErrorCode_AllocationFailed;
+    }
+
+    bits.north    = sets;
+    bits.east     = sets + set_words;
+    bits.visited  = sets + set_words * 2;
+    bits.frontier = sets + set_words * 3;
+    bits.next     = sets + set_words * 4;
+    memset(bits.visited, 0, 3 * set_words * sizeof(uint64_t));
+    Maze_BuildRowBits(grid, &bits);
+
+#define MAZE_ROW_BIT(cell_)  (((cell_) / grid->num_columns) * bits.row_words * 64 + (cell_) % grid->num_columns)
+
+    uint32_t tail = Maze_StartSearch(grid, sources, num_sources, distances, queue);
+    for (uint32_t i = 0; i < tail; ++i)  bitset_set(bits.visited, MAZE_ROW_BIT(queue[i]));
+
+    // The frontier is either queue[head, tail) or the frontier bit set
+    uint32_t head = 0, frontier_size = tail, distance = 0, last_cell = tail? queue[tail-1]: Maze_Unreached;
+    _Bool in_queue = true;
+    while (frontier_size) {
+        ++distance;
+        if (frontier_size > num_cells / MAZE_BOTTOM_UP_RATIO) {
+            if (in_queue) {
+                memset(bits.frontier, 0, set_words * sizeof(uint64_t));
+                for (uint32_t i = head; i < tail; ++i)  bitset_set(bits.frontier, MAZE_ROW_BIT(queue[i]));
+                in_queue = false;
+            }
+            frontier_size = Maze_BottomUpLevel(grid, &bits, distance, distances);
+        }
+        else {
+            if (!in_queue) {
+                head = tail = 0;
+                for (int row = 0; row < grid->num_rows; ++row) {
+                    for (size_t w = 0; w < bits.row_words; ++w) {
+                        for (uint64_t f = bits.frontier[row * bits.row_words + w]; f; f &= f - 1) {
+                            queue[tail++] = (uint32_t)row * grid->num_columns + w * 64 + __builtin_ctzll(f);
+                        }
+                    }
+                }
+                in_queue = true;
+            }
+
+            uint32_t end = tail;
+            for (; head < end; ++head) {
+                Maze_Walker at = Maze_WalkerAt(grid, queue[head]);
+                for (unsigned dirs = Maze_OpenDirs(grid, at); dirs; dirs &= dirs - 1) {
+                    uint32_t next = Maze_Step(grid, at, (Maze_Dir)__builtin_ctz(dirs)).cell;
+                    if (distances[next] == Maze_Unreached) {
+                        distances[next] = distance;
+                        queue[tail++] = next;
+                        bitset_set(bits.visited, MAZE_ROW_BIT(next));
+                    }
+                }
+            }
+            frontier_size = tail - head;
+        }
+
+        // Remember a cell of the deepest level reached so far
+        if (frontier_size) {
+            if (in_queue)  last_cell = queue[tail-1];
+            else {
+                for (size_t w = set_words; w--; ) {
+                    if (bits.frontier[w]) {
+                        uint32_t row = (uint32_t)(w / bits.row_words);
+                        last_cell = row * grid->num_columns + (w % bits.row_words) * 64 + 63 - __builtin_clzll(bits.frontier[w]);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+#undef MAZE_ROW_BIT
+
+    if (farthest)  *farthest = last_cell;
+    kfree(queue);
+    kfree(sets);
+    return ErrorCode_OK;
+}
+
+ErrorCode Maze_LongestPath(Maze_CompactGrid *grid, uint32_t *from, uint32_t *to, uint32_t *length)
+{
+    requires(grid);
+    requires(from && to);
+
+    uint32_t *distances = kalloc(NULL, (size_t)grid->num_rows * grid->num_columns * sizeof(uint32_t));
+    if (!distances)  return ErrorCode_AllocationFailed;
+
+    // In a tree the cell farthest from anywhere is one end of the longest
+    // path.  With loops this double sweep only approximates it.
+    uint32_t start = 0;
+    ErrorCode error = Maze_Distances(grid, &start, 1, distances, from);
+    if (!error)  error = Maze_Distances(grid, from, 1, distances, to);
+    if (!error && length)  *length = distances[*to];
+
+    kfree(distances);
+    return error;
+}
+
+
+
+//------------------------------------------------------------
+//# Path Finding
+
+ErrorCode Maze_InitPathFinder(Maze_PathFinder *finder, Maze_CompactGrid *grid)
+{
+    requires(finder);
+    requires(grid && grid->passages);
+    requires_m((uint64_t)grid->num_rows * grid->num_columns < UINT32_MAX, "path finding supports up to 2^32-1 cells");
+
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    *finder = (Maze_PathFinder){ .grid = grid };
+    ErrorCode error = Kwr_InitIndexHeap(&finder->open, num_cells);
+    if (error)  return error;
+
+    finder->costs     = kalloc(NULL, (size_t)num_cells * sizeof(uint32_t));
+    finder->stamps    = kcalloc(num_cells, sizeof(uint32_t));
+    finder->came_from = kalloc(NULL, num_cells);
+    if (!finder->costs || !finder->stamps || !finder->came_from) {
+        Maze_DisposePathFinder(finder);
+        return ErrorCode_AllocationFailed;
+    }
+    return ErrorCode_OK;
+}
+
+void Maze_DisposePathFinder(Maze_PathFinder *finder)
+{
+    if (finder) {  // okay to pass NULL, just ignore it
+        Kwr_DisposeIndexHeap(&finder->open);
+        kfree(finder->costs);
+        kfree(finder->stamps);
+        kfree(finder->came_from);
+        *finder = (Maze_PathFinder){0};
+    }
+}
+
+static inline uint32_t Maze_Manhattan(Maze_Walker a, Maze_Walker b)
+{
+    return (uint32_t)abs(a.row - b.row) + (uint32_t)abs(a.col - b.col);
+}
+
+// Order by estimated total cost, then prefer cells nearer the goal
+static inline uint64_t Maze_PathPriority(uint32_t cost, uint32_t estimate)
+{
+    return (uint64_t)(cost + estimate) << 32 | estimate;
+}
+
+static void Maze_NextGeneration(Maze_PathFinder *finder)
+{
+    if (++finder->generation == 0) {
+        uint32_t num_cells = (uint32_t)finder->grid->num_rows * finder->grid->num_columns;
+        memset(finder->stamps, 0, (size_t)num_cells * sizeof(uint32_t));
+        finder->generation = 1;
+    }
+    Kwr_HeapClear(&finder->open);
+    finder->expanded = 0;
+}
+
+static void Maze_TracePath(Maze_PathFinder *finder, Maze_Walker to, Maze_Path **path)
+{
+    size_t count = (size_t)finder->costs[to.cell] + 1;
+    (*path)->length = 0;
+    reserve(*path, count);
+    (*path)->length = count;
+
+    Maze_Walker at = to;
+    for (size_t i = count; i--; ) {
+        (*path)->begin[i] = at.cell;
+        if (i)  at = Maze_Step(finder->grid, at, (Maze_Dir)(Maze_Dir_Last - finder->came_from[at.cell]));
+    }
+}
+
+ErrorCode Maze_FindPath(Maze_PathFinder *finder, uint32_t from, uint32_t to, Maze_Path **path)
+{
+    requires(finder && finder->grid);
+    requires(path);
+
+    Maze_CompactGrid *grid = finder->grid;
+    uint32_t num_cells = (uint32_t)grid->num_rows * grid->num_columns;
+    requires(from < num_cells && to < num_cells);
+
+    if (!*path)  *path = new_dynarray(uint32_t);
+    if (!*path)  return ErrorCode_AllocationFailed;
+    (*path)->length = 0;
+    Maze_NextGeneration(finder);
+
+    Maze_Walker goal = Maze_WalkerAt(grid, to);
+    Maze_Walker start = Maze_WalkerAt(grid, from);
+    finder->stamps[from] = finder->generation;
+    finder->costs[from]  = 0;
+    Kwr_HeapPush(&finder->open, from, Maze_PathPriority(0, Maze_Manhattan(start, goal)));
+
+    // The heuristic is consistent, so a cell's cost is final once popped
+    while (!Kwr_HeapIsEmpty(&finder->open)) {
+        Maze_Walker at = Maze_WalkerAt(grid, Kwr_HeapPop(&finder->open));
+        if (at.cell == to) {
+            Maze_TracePath(finder, goal, path);
+            return ErrorCode_OK;
+        }
+        ++finder->expanded;
+
+        uint32_t next_cost = finder->costs[at.cell] + 1;
+        for (unsigned dirs = Maze_OpenDirs(grid, at); dirs; dirs &= dirs - 1) {
+            Maze_Dir dir = (Maze_Dir)__builtin_ctz(dirs);
+            Maze_Walker next = Maze_Step(grid, at, dir);
+            if (finder->stamps[next.cell] == finder->generation && finder->costs[next.cell] <= next_cost)  continue;
+
+            finder->stamps[next.cell]    = finder->generation;
+            finder->costs[next.cell]     = next_cost;
+            finder->came_from[next.cell] = (uint8_t)dir;
+            Kwr_HeapPush(&finder->open, next.cell, Maze_PathPriority(next_cost, Maze_Manhattan(next, goal)));
+        }
+    }
+    return ErrorCode_Failure;
+}
+
+
+
+//------------------------------------------------------------
+//# Rasterizing
+
+void Maze_RasterSize(Maze_CompactGrid *grid, int cell_size, int margin, int *width, int *height)
+{
+    requires(grid);
+    requires(width && height);
+
+    *width  = 2*margin + grid->num_columns * cell_size + 1;
+    *height = 2*margin + grid->num_rows * cell_size + 1;
+}
+
+// Set the color channels of pixel x to value; alpha stays opaque.
+// Branch-free callers pass 0 or 0xFF rather than skipping the store.
+static inline void Maze_RasterPut(uint8_t *line, size_t x, int channels, uint8_t value)
+{
+    uint8_t *pixel = line + x * channels;
+    pixel[0] = value;
+    if (channels == 4)  pixel[1] = pixel[2] = value;
+}
+
+// Scanline through the inside of row r: west walls and the east border
+static void Maze_RasterWestWalls(Maze_CompactGrid *grid, int r, uint8_t *line, int cell_size, int margin, int channels)
+{
+    const uint8_t *row_bits = grid->passages + grid->row_bytes * r;
+    Maze_RasterPut(line, (size_t)margin, channels, 0xFF);
+    for (int c = 1; c < grid->num_columns; ++c) {
+        uint8_t wall = (Maze_RowCellBits(row_bits, c-1) & Maze_Passage_East)? 0: 0xFF;
+        Maze_RasterPut(line, (size_t)margin + (size_t)c * cell_size, channels, wall);
+    }
+    Maze_RasterPut(line, (size_t)margin + (size_t)grid->num_columns * cell_size, channels, 0xFF);
+}
+
+// North walls of row r (or the south border when r == num_rows) over a
+// line already holding the wall ends.  Corners join the walls on either side.
+static void Maze_RasterNorthWalls(Maze_CompactGrid *grid, int r, uint8_t *line, int cell_size, int margin, int channels)
+{
+    const uint8_t *row_bits = (r > 0 && r < grid->num_rows)? grid->passages + grid->row_bytes * r: NULL;
+    uint8_t previous = 0;
+    for (int c = 0; c < grid->num_columns; ++c) {
+        uint8_t wall = (row_bits && (Maze_RowCellBits(row_bits, c) & Maze_Passage_North))? 0: 0xFF;
+        size_t x = (size_t)margin + (size_t)c * cell_size;
+        line[x * channels] |= wall | previous;
+        if (channels == 4)  line[x*4 + 1] = line[x*4 + 2] = line[x*4];
+        for (int i = 1; i < cell_size; ++i)  Maze_RasterPut(line, x + i, channels, wall);
+        previous = wall;
+    }
+    size_t x = (size_t)margin + (size_t)grid->num_columns * cell_size;
+    line[x * channels] |= previous;
+    if (channels == 4)  line[x*4 + 1] = line[x*4 + 2] = line[x*4];
+}
+
+static void Maze_RasterOr(uint8_t *dest, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dest + i, 8);
+        memcpy(&b, src + i, 8);
+        a |= b;
+        memcpy(dest + i, &a, 8);
+    }
+    for (; i < n; ++i)  dest[i] |= src[i];
+}
+
+typedef struct Maze_RasterJob {
+    Maze_CompactGrid *grid;
+    Kwr_Image *image;
+    int cell_size, margin;
+    const uint8_t *blank;
+    uint8_t *scanlines;     // two per band
+} Maze_RasterJob;
+
+// Draws cell rows [first, end) of a band, plus the south border in the
+// last band.  Walls are all-ones bytes on a black, opaque background, so
+// scanlines combine with OR.
+static void Maze_RasterBand(void *data, size_t band)
+{
+    Maze_RasterJob *job = data;
+    Maze_CompactGrid *grid = job->grid;
+    Kwr_Image *image = job->image;
+    int channels = image->channels, cell_size = job->cell_size, margin = job->margin;
+    size_t line_bytes = image->stride;
+    uint8_t *inside = job->scanlines + 2 * band * line_bytes;
+    uint8_t *above  = inside + line_bytes;
+
+    int first = (int)band * Maze_BandRows;
+    int end   = first + Maze_BandRows <= grid->num_rows? first + Maze_BandRows: grid->num_rows + 1;
+
+    memcpy(above, job->blank, line_bytes);
+    if (first > 0)  Maze_RasterWestWalls(grid, first - 1, above, cell_size, margin, channels);
+
+    for (int r = first; r < end; ++r) {
+        int top = margin + r * cell_size;
+        memcpy(inside, job->blank, line_bytes);
+        if (r < grid->num_rows)  Maze_RasterWestWalls(grid, r, inside, cell_size, margin, channels);
+
+        // The wall line is shared with the row above: keep its wall ends
+        uint8_t *line = Kwr_ImageRow(image, top);
+        memcpy(line, inside, line_bytes);
+        Maze_RasterOr(line, above, line_bytes);
+        Maze_RasterNorthWalls(grid, r, line, cell_size, margin, channels);
+
+        for (int y = top + 1; r < grid->num_rows && y < top + cell_size; ++y) {
+            memcpy(Kwr_ImageRow(image, y), inside, line_bytes);
+        }
+
+        uint8_t *swap = above;
+        above  = inside;
+        inside = swap;
+    }
+}
+
+ErrorCode Maze_Rasterize(Maze_CompactGrid *grid, Kwr_Image *image, int cell_size, int margin, int num_threads)
+{
+    requires(grid && grid->passages);
+    requires(image && image->pixels);
+    requires(cell_size >= 1 && margin >= 0);
+
+    int width, height;
+    Maze_RasterSize(grid, cell_size, margin, &width, &height);
+    requires(image->width >= width && image->height >= height);
+
+    size_t num_bands  = ((size_t)grid->num_rows + Maze_BandRows) / Maze_BandRows;  // + the south border
+    size_t line_bytes = image->stride;
+    uint8_t *blank     = kcalloc(1, line_bytes);
+    uint8_t *scanlines = kalloc(NULL, 2 * num_bands * line_bytes);
+    if (!blank || !scanlines) {
+        kfree(blank);
+        kfree(scanlines);
+        return ErrorCode_AllocationFailed;
+    }
+
+    if (image->channels == 4) {
+        for (int x = 0; x < image->width; ++x)  blank[4*x + 3] = 0xFF;
+    }
+    for (int y = 0; y < image->height; ++y) {
+        if (y < margin || y >= height - margin)  memcpy(Kwr_ImageRow(image, y), blank, line_bytes);
+    }
+
+    Maze_RasterJob job = { .grid = grid, .image = image, .cell_size = cell_size, .margin = margin, .blank = blank, .scanlines = scanlines };
+    Kwr_ParallelFor(num_bands, num_threads, Maze_RasterBand, &job);
+
+    kfree(blank);
+    kfree(scanlines);
+    return ErrorCode_OK;
+}
+
+
+
+//------------------------------------------------------------
+//# Maze Files
+
+_Static_assert(sizeof(Maze_FileHeader) == 64, "maze file header layout");
+
+ErrorCode Maze_OpenFileWriter(Maze_FileWriter *writer, const char *path, Maze_Algorithm algorithm, int num_rows, int num_columns, uint64_t seed)
+{
+    requires(writer);
+    requires(path);
+    requires(num_rows > 0 && num_columns > 0);
+
+    size_t row_bytes = Maze_CompactRowBytes(num_columns);
+    *writer = (Maze_FileWriter){ .header = {
+        .magic          = MAZE_FILE_MAGIC,
+        .version        = Maze_FileVersion,
+        .byte_order     = Maze_FileByteOrder,
+        .header_size    = sizeof(Maze_FileHeader),
+        .algorithm      = (uint32_t)algorithm,
+        .num_rows       = num_rows,
+        .num_columns    = num_columns,
+        .seed           = seed,
+        .row_bytes      = row_bytes,
+        .payload_offset = Maze_FilePayloadAlign,
+        .payload_size   = (uint64_t)row_bytes * num_rows,
+    }};
+
+    FILE *file = fopen(path, "wb");
+    if (!file)  return ErrorCode_Error;
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    static const uint8_t padding[Maze_FilePayloadAlign];
+    _Bool ok = fwrite(&writer->header, sizeof(Maze_FileHeader), 1, file) == 1
+            && fwrite(padding, 1, Maze_FilePayloadAlign - sizeof(Maze_FileHeader), file) == Maze_FilePayloadAlign - sizeof(Maze_FileHeader);
+    if (!ok) {
+        fclose(file);
+        return ErrorCode_Error;
+    }
+    writer->file = file;
+    return ErrorCode_OK;
+}
+
+// A Maze_RowSinkFn; rows must come in order
+ErrorCode Maze_FileWriterPutRow(void *data, int row, const uint8_t *row_bits, size_t row_bytes)
+{
+    Maze_FileWriter *writer = data;
+    requires(writer && writer->file);
+    requires(row == writer->rows_written && row < writer->header.num_rows);
+    requires(row_bytes == writer->header.row_bytes);
+
+    if (fwrite(row_bits, 1, row_bytes, writer->file) != row_bytes)  return ErrorCode_Error;
+    ++writer->rows_written;
+    return ErrorCode_OK;
+}
+
+// Fails if the write failed or not every row was written
+ErrorCode Maze_CloseFileWriter(Maze_FileWriter *writer)
+{
+    requires(writer);
+    if (!writer->file)  return ErrorCode_Error;
+
+    _Bool complete = writer->rows_written == writer->header.num_rows;
+    _Bool ok = fclose(writer->file) == 0;
+    writer->file = NULL;
+    return !ok? ErrorCode_Error: complete? ErrorCode_OK: ErrorCode_Failure;
+}
+
+ErrorCode Maze_SaveMaze(Maze_CompactGrid *grid, const char *path, Maze_Algorithm algorithm, uint64_t seed)
+{
+    requires(grid && grid->passages);
+
+    Maze_FileWriter writer;
+    ErrorCode error = Maze_OpenFileWriter(&writer, path, algorithm, grid->num_rows, grid->num_columns, seed);
+    for (int row = 0; !error && row < grid->num_rows; ++row) {
+        error = Maze_FileWriterPutRow(&writer, row, Maze_CompactGridRow(grid, row), grid->row_bytes);
+    }
+    if (writer.file) {
+        ErrorCode close_error = Maze_CloseFileWriter(&writer);
+        if (!error)  error = close_error;
+    }
+    return error;
+}
+
+static _Bool Maze_ValidFileHeader(const Maze_FileHeader *header, size_t file_size)
+{
+    return !memcmp(header->magic, MAZE_FILE_MAGIC, sizeof(header->magic))
+        && header->version == Maze_FileVersion
+        && header->byte_order == Maze_FileByteOrder
+        && header->header_size >= sizeof(Maze_FileHeader)
+        && header->num_rows > 0 && header->num_columns > 0
+        && header->row_bytes == Maze_CompactRowBytes(header->num_columns)
+        && header->payload_size == header->row_bytes * (uint64_t)header->num_rows
+        && header->payload_offset >= header->header_size
+        && header->payload_offset <= file_size
+        && header->payload_size <= file_size - header->payload_offset;
+}
+
+// Replaces *grid, which should be empty or disposed.  header (optional)
+// receives the file header, e.g. for the algorithm and seed.
+ErrorCode Maze_LoadMaze(Maze_CompactGrid *grid, const char *path, Maze_FileHeader *header)
+{
+    requires(grid);
+    requires(path);
+
+    void *data;
+    size_t size;
+    ErrorCode error = Kwr_MapFile(path, &data, &size);
+    if (error)  return error;
+
+    const Maze_FileHeader *file_header = data;
+    if (size < sizeof(Maze_FileHeader) || !Maze_ValidFileHeader(file_header, size)) {
+        Kwr_UnmapFile(data, size);
+        return ErrorCode_Failure;
+    }
+
+    if (header)  *header = *file_header;
+    *grid = (Maze_CompactGrid){
+        .num_rows     = file_header->num_rows,
+        .num_columns  = file_header->num_columns,
+        .row_bytes    = file_header->row_bytes,
+        .passages     = (uint8_t *)data + file_header->payload_offset,
+        .mapping      = data,
+        .mapping_size = size,
+    };
+    return ErrorCode_OK;
+}
@@ -15,10 +15,27 @@ typedef struct Maze_Cell {
     vector_n(struct Maze_Cell, *links, *north, *east, *west, *south);
 } Maze_Cell;
 
+// Cell storage order.  Row-major grids also get a table of row pointers.
+// Tiled grids store square tiles of Maze_TileSize cells a side, one after
+// another, so vertical neighbors are a few cells apart instead of a whole
+// row; Morton grids also order the cells within a tile along a Z curve.
+// Tiled layouts pad the grid to whole tiles; padding cells have row and
+// column -1 and are never returned.
+typedef enum {
+    Maze_Layout_RowMajor,
+    Maze_Layout_Tiled,
+    Maze_Layout_Morton,
+} Maze_Layout;
+
+enum { Maze_TileShift = 3, Maze_TileSize = 1 << Maze_TileShift };
+
 typedef struct Maze_Grid {
     int num_rows, num_columns;
     Maze_Cell *cells;
-    Maze_Cell **rows;
+    Maze_Cell **rows;   // row-major only
+    Kwr_Arena *arena;   // optional, allocate from arena instead of heap
+    Maze_Layout layout;
+    int tiles_across;
 } Maze_Grid;
 
 typedef void (*Maze_GridRowFn)(Maze_Cell *row, void *data);
@@ -28,9 +45,244 @@ void         Maze_LinkCells      (Maze_Cell *cell, Maze_Dir dir, Maze_Cell *to_c
 void         Maze_UnlinkCells    (Maze_Cell *cell, Maze_Cell *cell_b);
 void         Maze_InitGrid       (Maze_Grid *grid);
 Maze_Cell   *Maze_GridCellAt     (Maze_Grid *grid, int row, int col);
+size_t       Maze_GridCellIndex  (Maze_Grid *grid, int row, int col);
+size_t       Maze_GridStorage    (Maze_Grid *grid);
 int          Maze_CountGridCells (Maze_Grid *grid);
-void         Maze_ForEachGridRow (Maze_Grid *grid, Maze_GridRowFn row_op, void *pass);
+void         Maze_ForEachGridRow (Maze_Grid *grid, Maze_GridRowFn row_op, void *pass);  // row-major only
 void         Maze_DisposeGrid    (Maze_Grid *grid);
 Maze_Cell   *Maze_GoNorth        (Maze_Grid *grid, Maze_Cell *cell);
 Maze_Cell   *Maze_GoEast         (Maze_Grid *grid, Maze_Cell *cell);
+Maze_Cell   *Maze_GoSouth        (Maze_Grid *grid, Maze_Cell *cell);
+Maze_Cell   *Maze_GoWest         (Maze_Grid *grid, Maze_Cell *cell);
+
+
+
+//------------------------------------------------------------
+//# Compact Grid
+//
+// Stores only the passages leaving each cell to the north and east, 
+// packed 2 bits per cell.  South and west passages are read from the 
+// neighboring cell.  Each row starts on a byte boundary.
+
+enum {
+    Maze_Passage_North = 1 << 0,
+    Maze_Passage_East  = 1 << 1,
+    Maze_Passage_Bits  = 2,
+    Maze_Passage_Mask  = (1 << Maze_Passage_Bits) - 1,
+    Maze_CellsPerByte  = 8 / Maze_Passage_Bits
+};
+
+typedef struct Maze_CompactGrid {
+    int num_rows, num_columns;
+    size_t row_bytes;
+    uint8_t *passages;
+    Kwr_Arena *arena;   // optional, allocate from arena instead of heap
+    void *mapping;      // file mapping holding passages, see Maze_LoadMaze
+    size_t mapping_size;
+} Maze_CompactGrid;
+
+size_t    Maze_CompactRowBytes    (int num_columns);
+void      Maze_InitCompactGrid    (Maze_CompactGrid *grid);
+void      Maze_DisposeCompactGrid (Maze_CompactGrid *grid);
+uint8_t  *Maze_CompactGridRow     (Maze_CompactGrid *grid, int row);
+unsigned  Maze_CompactCellBits    (Maze_CompactGrid *grid, int row, int col);
+void      Maze_CompactLinkCells   (Maze_CompactGrid *grid, int row, int col, Maze_Dir dir);
+void      Maze_CompactUnlinkCells (Maze_CompactGrid *grid, int row, int col, Maze_Dir dir);
+_Bool     Maze_CompactIsLinked    (Maze_CompactGrid *grid, int row, int col, Maze_Dir dir);
+_Bool     Maze_CompactGoNorth     (Maze_CompactGrid *grid, int *row, int *col);
+_Bool     Maze_CompactGoEast      (Maze_CompactGrid *grid, int *row, int *col);
+_Bool     Maze_CompactGoSouth     (Maze_CompactGrid *grid, int *row, int *col);
+_Bool     Maze_CompactGoWest      (Maze_CompactGrid *grid, int *row, int *col);
+
+
+//------------------------------------------------------------
+//# Maze Generation
+//
+// Generators overwrite every passage in the grid.  Rows are generated in
+// bands of Maze_BandRows; band k draws from stream k of the seed (see 
+// Xoshiro256_InitStream), so a seed produces the same maze no matter 
+// how many threads run the bands.  num_threads = 0 uses every CPU.
+
+enum { Maze_BandRows = 64 };
+
+ErrorCode  Maze_BinaryTree  (Maze_CompactGrid *grid, uint64_t seed, int num_threads);
+ErrorCode  Maze_Sidewinder  (Maze_CompactGrid *grid, uint64_t seed, int num_threads);
+
+
+//------------------------------------------------------------
+//# Streaming Maze Generation
+//
+// Row-local algorithms can generate a maze one row at a time into a 
+// sink, using O(columns) memory for any number of rows.  Rows are passed
+// to the sink in order, packed like a Maze_CompactGrid row.  Binary Tree
+// and Sidewinder produce the same maze as the in-memory generators for
+// the same seed.  A sink returning an error stops the stream.
+// Streaming supports the row-local algorithms: Binary Tree, Sidewinder
+// and Eller.
+
+#define MAZE_ALGORITHM_X_TABLE \
+  X(BinaryTree) \
+  X(Sidewinder) \
+  X(Eller) \
+  X(Backtracker) \
+  X(AldousBroder) \
+  X(Wilson)
+
+#define X(Name)  Maze_Algorithm_##Name,
+typedef enum {
+    MAZE_ALGORITHM_X_TABLE
+    STANDARD_ENUM_VALUES(Maze_Algorithm)
+} Maze_Algorithm;
+#undef X
+
+typedef ErrorCode (*Maze_RowSinkFn)(void *data, int row, const uint8_t *row_bits, size_t row_bytes);
+
+typedef struct Maze_RowSink {
+    Maze_RowSinkFn put_row;
+    void *data;
+} Maze_RowSink;
+
+const char     *Maze_AlgorithmName      (Maze_Algorithm algorithm);
+Maze_Algorithm  Maze_AlgorithmFromName  (const char *name);
+ErrorCode       Maze_StreamMaze         (Maze_Algorithm algorithm, int num_rows, int num_columns, uint64_t seed, Maze_RowSink sink);
+ErrorCode       Maze_Eller              (Maze_CompactGrid *grid, uint64_t seed);
+
+// Sinks: data is a Maze_CompactGrid* or a FILE* respectively
+ErrorCode       Maze_CopyRowToGrid      (void *grid, int row, const uint8_t *row_bits, size_t row_bytes);
+ErrorCode       Maze_WriteRowToFile     (void *file, int row, const uint8_t *row_bits, size_t row_bytes);
+
+
+//------------------------------------------------------------
+//# Random Walk Generators
+//
+// Recursive backtracker, Aldous-Broder and Wilson's loop-erased random
+// walk produce unbiased (AB, Wilson) or long-corridor (backtracker) 
+// mazes.  They run iteratively, with the backtracker's stack in a 
+// dynarray and visited cells in a bit set, so 10^8-cell grids neither 
+// overflow the C stack nor need per-cell pointers.  Grids are limited
+// to 2^32 cells.  Optional stats report the generation throughput.
+
+typedef struct Maze_GenStats {
+    uint64_t cells;
+    uint64_t steps;            // random walk steps, 0 for row generators
+    double   seconds;
+    double   cells_per_second;
+} Maze_GenStats;
+
+ErrorCode  Maze_Backtracker  (Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats);
+ErrorCode  Maze_AldousBroder (Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats);
+ErrorCode  Maze_Wilson       (Maze_CompactGrid *grid, uint64_t seed, Maze_GenStats *stats);
+
+// Run any algorithm; num_threads applies to Binary Tree and Sidewinder
+ErrorCode  Maze_Generate     (Maze_CompactGrid *grid, Maze_Algorithm algorithm, uint64_t seed, int num_threads, Maze_GenStats *stats);
+
+
+//------------------------------------------------------------
+//# Distances
+//
+// Breadth-first search from one or more source cells.  distances must
+// hold num_rows * num_columns values and is indexed by 
+// row * num_columns + col; cells that cannot be reached are set to
+// Maze_Unreached.  farthest (optional) receives a reached cell with the
+// largest distance.
+//
+// Maze_LongestPath searches twice, from cell 0 and then from the cell
+// farthest from it.  That finds the longest path of a perfect maze; in
+// braided or open mazes, which have loops, it gives a long path that
+// may fall short of the longest.
+//
+// Maze_DistancesHybrid switches to a bit-parallel bottom-up search, 64
+// cells per operation, while the frontier is large (braided or open
+// mazes), and back to the queue when it shrinks.  Results are the same.
+
+#define Maze_Unreached  UINT32_MAX
+
+ErrorCode  Maze_Distances       (Maze_CompactGrid *grid, const uint32_t *sources, size_t num_sources, uint32_t *distances, uint32_t *farthest);
+ErrorCode  Maze_DistancesHybrid (Maze_CompactGrid *grid, const uint32_t *sources, size_t num_sources, uint32_t *distances, uint32_t *farthest);
+ErrorCode  Maze_LongestPath     (Maze_CompactGrid *grid, uint32_t *from, uint32_t *to, uint32_t *length);
+
+
+//------------------------------------------------------------
+//# Path Finding
+//
+// A* search with the Manhattan distance heuristic.  A path finder keeps
+// its scratch buffers between queries: per-cell costs are tagged with a
+// search generation instead of being reset, so a query only touches the
+// cells it explores.  The path, from and to inclusive, replaces the
+// contents of *path (allocated if NULL).  Returns ErrorCode_Failure with
+// an empty path when to cannot be reached.
+
+typedef dynarray(uint32_t) Maze_Path;
+
+typedef struct Maze_PathFinder {
+    Maze_CompactGrid *grid;
+    Kwr_IndexHeap     open;
+    uint32_t         *costs;        // by cell, valid where stamps match generation
+    uint32_t         *stamps;
+    uint8_t          *came_from;    // Maze_Dir taken into the cell
+    uint32_t          generation;
+    size_t            expanded;     // cells expanded by the last query
+} Maze_PathFinder;
+
+ErrorCode  Maze_InitPathFinder    (Maze_PathFinder *finder, Maze_CompactGrid *grid);
+void       Maze_DisposePathFinder (Maze_PathFinder *finder);
+ErrorCode  Maze_FindPath          (Maze_PathFinder *finder, uint32_t from, uint32_t to, Maze_Path **path);
+
+
+//------------------------------------------------------------
+//# Rasterizing
+//
+// Draws white 1-pixel walls on black into a gray or RGBA image of at
+// least Maze_RasterSize pixels, without a display.  Each cell row is
+// built once as a scanline and copied to the pixel rows it covers.
+// Bands of Maze_BandRows rows are drawn on up to num_threads threads.
+
+void       Maze_RasterSize (Maze_CompactGrid *grid, int cell_size, int margin, int *width, int *height);
+ErrorCode  Maze_Rasterize  (Maze_CompactGrid *grid, Kwr_Image *image, int cell_size, int margin, int num_threads);
+
+
+//------------------------------------------------------------
+//# Maze Files
+//
+// A fixed-size header followed by the packed rows of a compact grid,
+// starting at a page-aligned offset so the loader can use the mapped
+// file in place: no parsing and no copy, and processes loading the same
+// file share its pages.  Loaded grids are copy-on-write; changes are 
+// not saved.  Integers are in the byte order of the writer, and the
+// loader rejects files whose byte order mark does not match.
+//
+// The writer streams rows in order and is usable as a Maze_RowSink:
+//     Maze_StreamMaze(algorithm, rows, cols, seed, (Maze_RowSink){ Maze_FileWriterPutRow, &writer });
+
+#define MAZE_FILE_MAGIC  "KWRMAZE"
+
+enum {
+    Maze_FileVersion     = 1,
+    Maze_FileByteOrder   = 0x01020304,
+    Maze_FilePayloadAlign = 4096
+};
+
+typedef struct Maze_FileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t algorithm;       // Maze_Algorithm
+    int32_t  num_rows, num_columns;
+    uint64_t seed;
+    uint64_t row_bytes;
+    uint64_t payload_offset;
+    uint64_t payload_size;
+} Maze_FileHeader;
+
+typedef struct Maze_FileWriter {
+    void *file;               // FILE*
+    Maze_FileHeader header;
+    int rows_written;
+} Maze_FileWriter;
 
+ErrorCode  Maze_OpenFileWriter   (Maze_FileWriter *writer, const char *path, Maze_Algorithm algorithm, int num_rows, int num_columns, uint64_t seed);
+ErrorCode  Maze_FileWriterPutRow (void *writer, int row, const uint8_t *row_bits, size_t row_bytes);
+ErrorCode  Maze_CloseFileWriter  (Maze_FileWriter *writer);
+ErrorCode  Maze_SaveMaze         (Maze_CompactGrid *grid, const char *path, Maze_Algorithm algorithm, uint64_t seed);
+ErrorCode  Maze_LoadMaze         (Maze_CompactGrid *grid, const char *path, Maze_FileHeader *header);
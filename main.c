@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 
 #include "kwrlib.h"
@@ -28,7 +29,7 @@ ErrorCode Game_Init(Game_Driver *driver, Status *stat)
     driver->window   = SDL_CreateWindow("Hello World", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 800, SDL_WINDOW_SHOWN);
     if (!driver->window) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
 
-    driver->renderer = SDL_CreateRenderer(driver->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    driver->renderer = SDL_CreateRenderer(driver->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
     if (!driver->renderer) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
 
     return ErrorCode_OK;
@@ -41,33 +42,304 @@ void Game_Dispose(Game_Driver *driver)
     SDL_Quit();
 }
 
-void Maze_BinaryTree(Maze_Grid *grid, XorShift *xorshift)
+// The visible part of the maze is drawn into a texture and the texture
+// is copied to the screen each frame; it is redrawn only when dirty,
+// i.e. when the camera moves or the render targets are reset.
+//
+// The camera maps maze coordinates (in cells) to the screen: (x, y) is
+// the maze point at the top left of the window, zoom is pixels per cell.
+// Only the cells inside the window are drawn.  Zoomed in, walls are 
+// 1-pixel rects, with runs along a row or column merged, in one batch.
+// Zoomed out below Game_LodZoom, each pixel instead shows the wall
+// density of the cells under it, from a pyramid of 2x2 averages.
+typedef dynarray(SDL_Rect) Game_Rects;
+
+typedef struct Game_Camera {
+    double x, y, zoom;
+} Game_Camera;
+
+#define Game_LodZoom   4.0     // pixels per cell below which walls become density
+#define Game_MinZoom   (1.0 / 4096)
+#define Game_MaxZoom   256.0
+
+typedef struct Game_WallPyramid {
+    int num_levels;
+    int rows[32], columns[32];
+    uint8_t *density[32];      // level k averages 2^k x 2^k cells; level 0 is not stored
+} Game_WallPyramid;
+
+typedef struct Game_MazeView {
+    Maze_CompactGrid *grid;
+    Game_Camera camera;
+    int width, height, margin;
+    Game_Rects *walls;
+    Game_WallPyramid pyramid;
+    SDL_Texture *texture;       // wall rects, drawn as render target
+    SDL_Texture *lod_texture;   // wall density, written pixel by pixel
+    uint32_t *lod_pixels;
+    _Bool lod, dirty;
+} Game_MazeView;
+
+// Wall density of one cell: its north and west walls, plus the borders
+static unsigned Game_CellWalls(Maze_CompactGrid *grid, int r, int c)
 {
-    Maze_Cell *cell = grid->cells; 
-    int count = Maze_CountGridCells(grid);
-    while (count--) {
+    unsigned walls = !Maze_CompactIsLinked(grid, r, c, Maze_Dir_North) + !Maze_CompactIsLinked(grid, r, c, Maze_Dir_West);
+    return walls * 127;
+}
 
-        struct Cell_Neighbor { Maze_Dir dir; Maze_Cell *cell; } neighbors[2];
-        int num = 0;
+static void Game_DisposePyramid(Game_WallPyramid *pyramid)
+{
+    for (int k = 1; k < pyramid->num_levels; ++k)  kfree(pyramid->density[k]);
+    *pyramid = (Game_WallPyramid){0};
+}
 
-        Maze_Cell *neighbor;
-        if ( (neighbor = Maze_GoNorth(grid, cell)) ) {
-            neighbors[num++] = (struct Cell_Neighbor){ Maze_Dir_North, neighbor };
+static ErrorCode Game_BuildPyramid(Game_WallPyramid *pyramid, Maze_CompactGrid *grid)
+{
+    *pyramid = (Game_WallPyramid){ .num_levels = 1, .rows[0] = grid->num_rows, .columns[0] = grid->num_columns };
+
+    for (int k = 1; pyramid->rows[k-1] > 1 || pyramid->columns[k-1] > 1; ++k) {
+        int rows = (pyramid->rows[k-1] + 1) / 2, cols = (pyramid->columns[k-1] + 1) / 2;
+        uint8_t *level = kalloc(NULL, (size_t)rows * cols);
+        if (!level)  return ErrorCode_AllocationFailed;
+
+        pyramid->rows[k] = rows;
+        pyramid->columns[k] = cols;
+        pyramid->density[k] = level;
+        pyramid->num_levels = k + 1;
+
+        const uint8_t *below = pyramid->density[k-1];
+        int below_rows = pyramid->rows[k-1], below_cols = pyramid->columns[k-1];
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                unsigned sum = 0, count = 0;
+                for (int dr = 0; dr < 2; ++dr) {
+                    for (int dc = 0; dc < 2; ++dc) {
+                        int br = 2*r + dr, bc = 2*c + dc;
+                        if (br >= below_rows || bc >= below_cols)  continue;
+                        sum += (k == 1)? Game_CellWalls(grid, br, bc): below[(size_t)br * below_cols + bc];
+                        ++count;
+                    }
+                }
+                level[(size_t)r * cols + c] = (uint8_t)(sum / count);
+            }
         }
+    }
+    return ErrorCode_OK;
+}
 
-        if ( (neighbor = Maze_GoEast(grid, cell)) ) {
-            neighbors[num++] = (struct Cell_Neighbor){ Maze_Dir_East, neighbor };
+static int Game_ScreenX(Game_MazeView *view, int col)  { return (int)floor((col - view->camera.x) * view->camera.zoom); }
+static int Game_ScreenY(Game_MazeView *view, int row)  { return (int)floor((row - view->camera.y) * view->camera.zoom); }
+
+static int Game_Clamp(int value, int low, int high)
+{
+    return value < low? low: value > high? high: value;
+}
+
+// Wall rects for the cells inside the window
+static void Game_BuildWalls(Game_MazeView *view)
+{
+    Maze_CompactGrid *grid = view->grid;
+    Game_Camera *camera = &view->camera;
+    int c0 = Game_Clamp((int)floor(camera->x), 0, grid->num_columns);
+    int r0 = Game_Clamp((int)floor(camera->y), 0, grid->num_rows);
+    int c1 = Game_Clamp((int)ceil(camera->x + view->width / camera->zoom), 0, grid->num_columns);
+    int r1 = Game_Clamp((int)ceil(camera->y + view->height / camera->zoom), 0, grid->num_rows);
+    view->walls->length = 0;
+
+    // Horizontal walls: north of each row, plus the bottom border
+    for (int r = r0; r <= r1; ++r) {
+        for (int c = c0, run = -1; c <= c1; ++c) {
+            _Bool wall = c < c1 && (r == grid->num_rows || !Maze_CompactIsLinked(grid, r, c, Maze_Dir_North));
+            if (wall && run < 0)   run = c;
+            if (!wall && run >= 0) {
+                int x = Game_ScreenX(view, run);
+                push_grow(view->walls, ((SDL_Rect){ x, Game_ScreenY(view, r), Game_ScreenX(view, c) - x + 1, 1 }));
+                run = -1;
+            }
         }
+    }
 
-        if (num) {
-            int choose = XorShift_Rand(xorshift) % num;
-            Maze_LinkCells(cell, neighbors[choose].dir, neighbors[choose].cell);
+    // Vertical walls: west of each column, plus the right border
+    for (int c = c0; c <= c1; ++c) {
+        for (int r = r0, run = -1; r <= r1; ++r) {
+            _Bool wall = r < r1 && (c == grid->num_columns || !Maze_CompactIsLinked(grid, r, c, Maze_Dir_West));
+            if (wall && run < 0)   run = r;
+            if (!wall && run >= 0) {
+                int y = Game_ScreenY(view, run);
+                push_grow(view->walls, ((SDL_Rect){ Game_ScreenX(view, c), y, 1, Game_ScreenY(view, r) - y + 1 }));
+                run = -1;
+            }
         }
+    }
+}
 
-        ++cell;
+// One pixel per sample of the pyramid level closest to the zoom
+static void Game_BuildDensity(Game_MazeView *view)
+{
+    Game_Camera *camera = &view->camera;
+    Game_WallPyramid *pyramid = &view->pyramid;
+    int level = 0;
+    while (level + 1 < pyramid->num_levels && (double)(2 << level) * camera->zoom <= 1.0)  ++level;
+
+    double scale = 1.0 / (camera->zoom * (1 << level));
+    for (int y = 0; y < view->height; ++y) {
+        uint32_t *pixels = view->lod_pixels + (size_t)y * view->width;
+        double row = (camera->y + y / camera->zoom) / (1 << level);
+        int r = (int)floor(row);
+        for (int x = 0; x < view->width; ++x) {
+            int c = (int)floor((camera->x / (1 << level)) + x * scale);
+            unsigned gray = 0;
+            if (r >= 0 && r < pyramid->rows[level] && c >= 0 && c < pyramid->columns[level]) {
+                gray = level? pyramid->density[level][(size_t)r * pyramid->columns[level] + c]: Game_CellWalls(view->grid, r, c);
+            }
+            pixels[x] = 0xFF000000u | gray << 16 | gray << 8 | gray;
+        }
     }
 }
 
+void Game_FitCamera(Game_MazeView *view)
+{
+    Maze_CompactGrid *grid = view->grid;
+    double zoom_x = (double)(view->width  - 2*view->margin) / grid->num_columns;
+    double zoom_y = (double)(view->height - 2*view->margin) / grid->num_rows;
+    double zoom = zoom_x < zoom_y? zoom_x: zoom_y;
+
+    view->camera = (Game_Camera){ .zoom = zoom, .x = -view->margin / zoom, .y = -view->margin / zoom };
+    view->dirty = true;
+}
+
+// Zoom by factor, keeping the maze point under screen (sx, sy) in place
+void Game_ZoomCamera(Game_MazeView *view, double factor, int sx, int sy)
+{
+    Game_Camera *camera = &view->camera;
+    double zoom = camera->zoom * factor;
+    if (zoom < Game_MinZoom || zoom > Game_MaxZoom)  return;
+
+    camera->x += sx / camera->zoom - sx / zoom;
+    camera->y += sy / camera->zoom - sy / zoom;
+    camera->zoom = zoom;
+    view->dirty = true;
+}
+
+void Game_PanCamera(Game_MazeView *view, int dx, int dy)
+{
+    view->camera.x -= dx / view->camera.zoom;
+    view->camera.y -= dy / view->camera.zoom;
+    view->dirty = true;
+}
+
+ErrorCode Game_InitMazeView(Game_MazeView *view, Game_Driver *driver, Maze_CompactGrid *grid, int margin, Status *stat)
+{
+    requires(view && driver && grid);
+
+    *view = (Game_MazeView){ .grid = grid, .margin = margin };
+    SDL_GetRendererOutputSize(driver->renderer, &view->width, &view->height);
+    view->walls      = new_dynarray(SDL_Rect);
+    view->lod_pixels = kalloc(NULL, (size_t)view->width * view->height * sizeof(uint32_t));
+    if (!view->lod_pixels || Game_BuildPyramid(&view->pyramid, grid) != ErrorCode_OK) {
+        return (*stat = MakeError(ErrorCode_AllocationFailed, "Out of memory for the maze view")).error;
+    }
+    Game_FitCamera(view);
+
+    view->texture = SDL_CreateTexture(driver->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, view->width, view->height);
+    if (!view->texture) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
+
+    view->lod_texture = SDL_CreateTexture(driver->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, view->width, view->height);
+    if (!view->lod_texture) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
+    return ErrorCode_OK;
+}
+
+void Game_DisposeMazeView(Game_MazeView *view)
+{
+    if (view) {  // okay to pass NULL, just ignore it
+        if (view->texture)      SDL_DestroyTexture(view->texture);
+        if (view->lod_texture)  SDL_DestroyTexture(view->lod_texture);
+        Game_DisposePyramid(&view->pyramid);
+        Dynarray_Dispose(view->walls);
+        kfree(view->lod_pixels);
+        *view = (Game_MazeView){0};
+    }
+}
+
+ErrorCode Game_RenderMaze(Game_Driver *driver, Game_MazeView *view, Status *stat)
+{
+    requires(driver && view);
+
+    if (view->dirty) {
+        view->lod = view->camera.zoom < Game_LodZoom;
+        if (view->lod) {
+            Game_BuildDensity(view);
+            if (SDL_UpdateTexture(view->lod_texture, NULL, view->lod_pixels, view->width * (int)sizeof(uint32_t))) {
+                return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
+            }
+        }
+        else {
+            Game_BuildWalls(view);
+            if (SDL_SetRenderTarget(driver->renderer, view->texture)) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
+            SDL_SetRenderDrawColor(driver->renderer, 0, 0, 0, 255);
+            SDL_RenderClear(driver->renderer);
+            SDL_SetRenderDrawColor(driver->renderer, 255, 255, 255, 255);
+            SDL_RenderFillRects(driver->renderer, view->walls->begin, (int)length(view->walls));
+            SDL_SetRenderTarget(driver->renderer, NULL);
+        }
+        view->dirty = false;
+    }
+
+    SDL_Texture *texture = view->lod? view->lod_texture: view->texture;
+    if (SDL_RenderCopy(driver->renderer, texture, NULL, NULL)) return (*stat = MakeError(ErrorCode_Error, SDL_GetError())).error;
+    return ErrorCode_OK;
+}
+
+static const char *Game_StringArg(const char *arg)
+{
+    return arg;
+}
+
+// Load the maze from load_path, or generate it into the grid's size;
+// then save it to save_path when given
+ErrorCode Game_MakeMaze(Maze_CompactGrid *grid, Maze_Algorithm algorithm, long seed, int threads, const char *load_path, const char *save_path, Status *stat)
+{
+    if (load_path) {
+        Maze_FileHeader header;
+        if (Maze_LoadMaze(grid, load_path, &header) != ErrorCode_OK) {
+            return (*stat = MakeError(ErrorCode_Error, "Could not load the maze file")).error;
+        }
+        algorithm = (Maze_Algorithm)header.algorithm;
+        seed      = (long)header.seed;
+        printf("%s: %d x %d loaded from %s\n", Maze_AlgorithmName(algorithm), grid->num_rows, grid->num_columns, load_path);
+    }
+    else {
+        Maze_InitCompactGrid(grid);
+        Maze_GenStats gen_stats;
+        if (Maze_Generate(grid, algorithm, seed, threads, &gen_stats) != ErrorCode_OK) {
+            return (*stat = MakeError(ErrorCode_Error, "Unknown maze algorithm")).error;
+        }
+        printf("%s: %d x %d in %.3f s (%.0f cells/s)\n", Maze_AlgorithmName(algorithm), 
+               grid->num_rows, grid->num_columns, gen_stats.seconds, gen_stats.cells_per_second);
+    }
+
+    if (save_path && Maze_SaveMaze(grid, save_path, algorithm, (uint64_t)seed) != ErrorCode_OK) {
+        return (*stat = MakeError(ErrorCode_Error, "Could not save the maze file")).error;
+    }
+    return ErrorCode_OK;
+}
+
+// Without a display: rasterize and save the maze to output, as a
+// binary PGM image
+ErrorCode Game_RenderHeadless(Maze_CompactGrid *grid, int cell_size, int threads, const char *output, Status *stat)
+{
+    Kwr_Image image = { .channels = 1 };
+    Maze_RasterSize(grid, cell_size, 2, &image.width, &image.height);
+    ErrorCode error = Kwr_InitImage(&image);
+    if (!error)  error = Maze_Rasterize(grid, &image, cell_size, 2, threads);
+    if (!error)  error = Kwr_WriteImage(&image, output);
+    if (error)   *stat = MakeError(error, "Could not render the maze image");
+    else         printf("Written to %s (%d x %d pixels)\n", output, image.width, image.height);
+
+    Kwr_DisposeImage(&image);
+    return error;
+}
+
 int main(int argc, char* argv[])
 {
     Status stat = { ErrorCode_OK };
@@ -76,7 +348,14 @@ int main(int argc, char* argv[])
 #define COMMAND_LINE_ARGS \
     X(int,  rows,    10, atoi) \
     X(int,  columns, 10, atoi) \
-    X(long, seed,    12314, atol)
+    X(long, seed,    12314, atol) \
+    X(int,  threads, 0,  atoi) \
+    X(Maze_Algorithm, algorithm, Maze_Algorithm_BinaryTree, Maze_AlgorithmFromName) \
+    X(const char *, output, NULL, Game_StringArg) \
+    X(int,  cell,    4,  atoi) \
+    X(const char *, load, NULL, Game_StringArg) \
+    X(const char *, save, NULL, Game_StringArg) \
+    X(int,  profile, 0,  atoi)
 
 #define X(type, var, def, fn)  type var = def;
     COMMAND_LINE_ARGS
@@ -92,77 +371,82 @@ int main(int argc, char* argv[])
     }
 
     srand(seed);
+    if (profile)  Kwr_PrintProfileAtExit();
 
-    if (ErrorCode_OK != Game_Init(&driver, &stat)) {
+    Maze_CompactGrid grid = { .num_rows = rows, .num_columns = columns };
+    if (ErrorCode_OK != Game_MakeMaze(&grid, algorithm, seed, threads, load, save, &stat)) {
+        Status_Print(&stat);
+    }
+    else if (output) {
+        if (ErrorCode_OK != Game_RenderHeadless(&grid, cell, threads, output, &stat)) {
+            Status_Print(&stat);
+        }
+    }
+    else if (ErrorCode_OK != Game_Init(&driver, &stat)) {
         Status_Print(&stat);
+        Game_Dispose(&driver);
     }
     else {
-        XorShift xor;
-        XorShift_Init(&xor, seed, 4);
-
-        Maze_Grid grid = { .num_rows = rows, .num_columns = columns };
-        Maze_InitGrid(&grid);
-        Maze_BinaryTree(&grid, &xor);
-
-        int win_height = 800;
-        int margin     = 20;
-        int cell_size  = (win_height - margin*2) / rows;
-        printf("cell_size = %d\n", cell_size);
+        Game_MazeView view;
+        if (ErrorCode_OK != Game_InitMazeView(&view, &driver, &grid, 20, &stat)) {
+            Status_Print(&stat);
+            driver.running = false;
+        }
+        else {
+            printf("zoom = %.3f pixels per cell\n", view.camera.zoom);
+            driver.running = true;
+        }
 
-        //setup();
-        for (driver.running = true; driver.running; ) {
+        while (driver.running) {
 
-            for (SDL_Event event; SDL_PollEvent(&event) != 0; ) {
+            PROFILE_ZONE("Game_HandleEvents") for (SDL_Event event; SDL_PollEvent(&event) != 0; ) {
                 if (event.type == SDL_QUIT) {
                     driver.running = false;
                 }
+                else if (event.type == SDL_RENDER_TARGETS_RESET) {
+                    view.dirty = true;   // texture contents were lost
+                }
+                else if (event.type == SDL_MOUSEWHEEL) {
+                    int mx, my;
+                    SDL_GetMouseState(&mx, &my);
+                    Game_ZoomCamera(&view, event.wheel.y > 0? 1.25: 0.8, mx, my);
+                }
+                else if (event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_LMASK)) {
+                    Game_PanCamera(&view, event.motion.xrel, event.motion.yrel);
+                }
+                else if (event.type == SDL_KEYDOWN) {
+                    int step = view.width / 8;
+                    switch (event.key.keysym.sym) {
+                        case SDLK_EQUALS:
+                        case SDLK_PLUS:   Game_ZoomCamera(&view, 1.25, view.width/2, view.height/2);  break;
+                        case SDLK_MINUS:  Game_ZoomCamera(&view, 0.8,  view.width/2, view.height/2);  break;
+                        case SDLK_LEFT:   Game_PanCamera(&view,  step, 0);  break;
+                        case SDLK_RIGHT:  Game_PanCamera(&view, -step, 0);  break;
+                        case SDLK_UP:     Game_PanCamera(&view, 0,  step);  break;
+                        case SDLK_DOWN:   Game_PanCamera(&view, 0, -step);  break;
+                        case SDLK_HOME:   Game_FitCamera(&view);  break;
+                        default:          break;
+                    }
+                }
             }
 
-            // update game state
-
-            // clear back buffer
-            SDL_SetRenderDrawColor(driver.renderer, 0, 0, 0, 255);
-            SDL_RenderClear(driver.renderer);
-
             // render & display frame
-
-            // check return code
-            SDL_SetRenderDrawColor(driver.renderer, 255, 255, 255, 255);
-
-            // check return code
-            for (int r = 0; r < grid.num_rows; ++r) {
-                for (int c = 0; c < grid.num_columns; ++c) {
-                    int x1 = (grid.rows[r][c].column) * cell_size + margin;
-                    int y1 = (grid.rows[r][c].row   ) * cell_size + margin;
-                    int x2 = x1 + cell_size;
-                    int y2 = y1 + cell_size;
-
-                    if (!grid.rows[r][c].north) {
-                        SDL_RenderDrawLine(driver.renderer, x1, y1, x2, y1);
-                    }
-
-                    if (!grid.rows[r][c].west) {
-                        SDL_RenderDrawLine(driver.renderer, x1, y1, x1, y2);
-                    }
-
-                    if (grid.rows[r][c].column == grid.num_columns-1) {
-                        SDL_RenderDrawLine(driver.renderer, x2, y1, x2, y2);
-                    }
-
-                    if (grid.rows[r][c].row == grid.num_rows-1) {
-                        SDL_RenderDrawLine(driver.renderer, x1, y2, x2, y2);
-                    }
-
-                }
+            ErrorCode error;
+            PROFILE_ZONE("Game_RenderMaze")  error = Game_RenderMaze(&driver, &view, &stat);
+            if (ErrorCode_OK != error) {
+                Status_Print(&stat);
+                driver.running = false;
             }
 
-            SDL_RenderPresent(driver.renderer);
+            PROFILE_ZONE("SDL_RenderPresent")  SDL_RenderPresent(driver.renderer);
         }
 
-        Maze_DisposeGrid(&grid);
+        Game_DisposeMazeView(&view);
+        Game_Dispose(&driver);
     }
 
-    Game_Dispose(&driver);
+    Maze_DisposeCompactGrid(&grid);
+    if (profile)  Kwr_PrintAllocStats(stderr);
 
     return stat.error;
 }
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L   // clock_gettime, nanosleep
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -5,6 +7,11 @@
 #include <string.h>
 #include <time.h>
 #include <stddef.h>
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "kwrlib.h"
 #include "kwrmaze.h"
@@ -12,19 +19,42 @@
 typedef struct Test_Runner {
     int   failure_count;
     int   test_count;
+    const char *case_name;
 } Test_Runner;
 
 void TestCase(Test_Runner *runner, bool passes, const char *message)
 {
     ++runner->test_count;
     if (!passes) {
-        printf("%s\n", message);
+        printf("[%s] %s\n", runner->case_name, message);
         ++runner->failure_count;
     }
 }
 
 #define test(EXPR)       TestCase(runner, (EXPR), SOURCE_LINE_STR ": Test \"" STRINGIFY(EXPR) "\" failed.")
 
+// Each case is a function run with its own runner; see TEST_CASES_X_TABLE
+#define TEST_CASE(Name)  static void Test_##Name(Test_Runner *runner)
+
+// Names a new empty file in the temp directory, for code that takes a
+// path, so cases running at once never share one.  Remove it when done.
+static void TestTempPath(char path[32])
+{
+    strcpy(path, "/tmp/kwrtest_XXXXXX");
+    int fd = mkstemp(path);
+    if (fd >= 0)  close(fd);
+}
+
+// Whole contents of a file written so far, NUL-terminated; free() it
+static char *TestReadBack(FILE *file)
+{
+    long size = ftell(file);
+    char *text = calloc(1, size + 1);
+    rewind(file);
+    if (text && fread(text, 1, size, file) != (size_t)size)  text[0] = '\0';
+    return text;
+}
+
 
 
 typedef struct TypeInfo {
@@ -58,10 +88,63 @@ void TestForEachGridRow(Maze_Cell *row, void *data)
 }
 
 
+// A perfect maze has exactly one path between any two cells: 
+// it is connected and has one passage fewer than it has cells.
+_Bool IsPerfectMaze(Maze_CompactGrid *grid)
+{
+    int num_cells = grid->num_rows * grid->num_columns;
+    int passages  = 0;
+    for (int r = 0; r < grid->num_rows; ++r) {
+        for (int c = 0; c < grid->num_columns; ++c) {
+            unsigned bits = Maze_CompactCellBits(grid, r, c);
+            passages += !!(bits & Maze_Passage_North) + !!(bits & Maze_Passage_East);
+        }
+    }
+    if (passages != num_cells - 1)  return false;
+
+    char *seen  = calloc(num_cells, 1);
+    int  *stack = malloc(num_cells * sizeof(int));
+    int top = 0, reached = 1;
+    stack[top++] = 0;
+    seen[0] = 1;
+    while (top) {
+        int cell = stack[--top];
+        for (Maze_Dir dir = Maze_Dir_First; dir < Maze_Dir_End; ++dir) {
+            int row = cell / grid->num_columns, col = cell % grid->num_columns;
+            if (!Maze_CompactIsLinked(grid, row, col, dir))  continue;
+            switch (dir) {
+                case Maze_Dir_North: Maze_CompactGoNorth(grid, &row, &col); break;
+                case Maze_Dir_East:  Maze_CompactGoEast(grid, &row, &col);  break;
+                case Maze_Dir_South: Maze_CompactGoSouth(grid, &row, &col); break;
+                case Maze_Dir_West:  Maze_CompactGoWest(grid, &row, &col);  break;
+                default: break;
+            }
+            int next = row * grid->num_columns + col;
+            if (!seen[next]) {
+                seen[next] = 1;
+                ++reached;
+                stack[top++] = next;
+            }
+        }
+    }
+
+    free(seen);
+    free(stack);
+    return reached == num_cells;
+}
+
+ErrorCode TestFailingRowSink(void *data, int row, const uint8_t *row_bits, size_t row_bytes)
+{
+    UNUSED(row_bits);
+    UNUSED(row_bytes);
+    ++*(int *)data;
+    return row == 3? ErrorCode_Failure: ErrorCode_OK;
+}
+
 //  enum     type         id  printf
 #define BASIC_TYPES_X \
   X(Int,     int,          i, "%d") \
-  X(Long,    long,         l, "%l") \
+  X(Long,    long,         l, "%ld") \
   X(Double,  double,       d, "%f") \
   X(CString, const char*,  s, "%s") \
   X(Char,    char,         c, "%c") 
@@ -123,9 +206,24 @@ const char *Any_GetPrintFormat(AnyVar v)
     return v.typeid->format_spec;
 }
 
+void Any_Append(Kwr_Buffer *buf, AnyVar v)
+{
+    switch (v.typeid->basic_type_id) {
+        case BasicType_Int:      Kwr_AppendInt(buf, v.value.i);     break;
+        case BasicType_Long:     Kwr_AppendInt(buf, v.value.l);     break;
+        case BasicType_Double:   Kwr_AppendDouble(buf, v.value.d);  break;
+        case BasicType_CString:  Kwr_AppendString(buf, v.value.s);  break;
+        case BasicType_Char:     Kwr_AppendChar(buf, v.value.c);    break;
+        default:                 Kwr_AppendString(buf, v.typeid->format_spec);  break;  // true, false
+    }
+}
+
 void Any_Print(AnyVar v)
 {
-    printf(Any_GetPrintFormat(v), v.value);
+    char text[64];
+    Kwr_Buffer buf = Kwr_FixedBuffer(text);
+    Any_Append(&buf, v);
+    fputs(text, stdout);
 }
 
 #define X(NAME_, TYPE_, MEM_, _0) \
@@ -149,316 +247,1619 @@ AnyVar Any_Bool(_Bool v)
             _Bool:        Any_Bool \
             ) (V)
 
-typedef struct {
-    FILE *file;
-    int   throttle;
-} TraceConfig;
+TEST_CASE(TypeIds)
+{
+    test(true);
+
+    TYPE_ID_DEFN(TypedFoo);
+
+    typedef struct TypedFoo {
+        TypeId type_info;
+        int x;
+    } TypedFoo;
 
-void trace(TraceConfig *tracer, const char *stamp, const char *category, int level, const char *message)
+    typedef struct UntypedFoo {
+        float y;
+    } UntypedFoo;
+
+    TypedFoo   *nfoo = NULL;
+    TypedFoo   tfoo = { .type_info = TypedFoo_TypeId, .x = 1 };
+    UntypedFoo ufoo = { .y = 0.5 };
+
+    test( !type_of(nfoo) );
+    test( type_of(&tfoo) == TypedFoo_TypeId );
+    test( type_of(&tfoo) != type_of(&ufoo) );
+}
+
+TEST_CASE(TupleMacro)
 {
-    // require trace not null
-    if (level <= tracer->throttle) {
-        fprintf(tracer->file, "%s %s %d \"%s\"\n", stamp, category, level, message);
-    }
+    vector(int, x, y, z) point = {{ 10, 11, 12 }};
+    test(vec_length(point) == 3);
+    test(point.x == 10);
+    test(point.y == 11);
+    test(point.z == 12);
+    test(point.components[0] == 10);
+    test(point.components[1] == 11);
+    test(point.components[2] == 12);
 }
 
-void debug(TraceConfig *tracer, int level, const char *sourceline, const char *message)
+TEST_CASE(Dynarray)
 {
-    trace(tracer, sourceline, "Debug", level, message);
+    test(sizeof(dynarray(int)) == sizeof(dynarray(char)));
+    test(offsetof(dynarray(int), length) == offsetof(dynarray(char), length));
+    test(offsetof(dynarray(int), capacity) == offsetof(dynarray(char), capacity));
+    test(offsetof(dynarray(long double), begin) == offsetof(dynarray(char), begin));
+    test(offsetof(dynarray(int), begin) == offsetof(dynarray(char), begin));
+
+    dynarray(int) *a = new_dynarray(int); 
+
+    test(capacity(a) == 64);
+    test(length(a) == 0);
+    test(remaining(a) == 64);
+    test(is_empty(a));
+    test(!is_full(a));
+
+    int x = 101;
+    int i = push(a, x++); // = x++;
+
+    // these don't compile because the macros are not L-values
+    //capacity(a) = 5;
+    //length(a) = 3;
+    //remaining(a) = 99;
+    //da_set(a, 0, 1000) = 0;
+
+    test(capacity(a) == 64);
+    test(length(a) == 1);
+    test(remaining(a) == 63);
+    test(!is_empty(a));
+    test(!is_full(a));
+    test(da_get(a, 0) == 101);
+    test(i == 101);
+
+    i = da_set(a, 0, 99);
+    test(a->begin[0] == 99);
+    test(i == 99);
+
+    for (int i = 47; i --> 0;)  push(a, x++); // = x++;
+
+    test(length(a) == 48);
+    test(remaining(a) == 16);
+    test(!is_empty(a));
+    test(!is_full(a));
+    test(da_get(a, 1) == 102);
+    test(da_get(a, 47) == 148);
+
+    int *ab = a->begin;
+    test(ab[2] == 103);
+    test(ab[46] == 147);
+
+    while (remaining(a))  push(a, x++); // = x++;
+
+    test(length(a) == 64);
+    test(remaining(a) == 0);
+    test(!is_empty(a));
+    test(is_full(a));
+    ab = a->begin;
+    test(ab[63] == 164);
+
+    void *b = enlarge(a);
+    test(b != NULL);
+    a = b;
+
+    test(capacity(a) == 128);
+    test(length(a) == 64);
+    test(remaining(a) == 64);
+    test(!is_empty(a));
+    test(!is_full(a));
+    
+    test(da_get(a, 1) == 102);
+    test(da_get(a, 40) == 141);
+    test(da_get(a, 63) == 164);
+
+    // Should assert
+    //int y = da_get(a, 129);
+    
+    a = enlarge(a, 44);
+    test(capacity(a) == 128+44);
+
+    Dynarray_Dispose(a);
 }
 
+TEST_CASE(DynarrayGrowth)
+{
+    dynarray(int) *a = new_dynarray(int, 2);
+
+    for (int i = 0; i < 1000; ++i)  push_grow(a, i);
+    test(length(a) == 1000);
+    test(capacity(a) == 1024);
+    test(da_get(a, 0) == 0);
+    test(da_get(a, 999) == 999);
+
+    reserve(a, 24);
+    test(capacity(a) == 1024);
+    reserve(a, 25);
+    test(capacity(a) == 2048);
+    test(length(a) == 1000);
+
+    int more[] = { -1, -2, -3 };
+    append_n(a, more, array_length(more));
+    test(length(a) == 1003);
+    test(da_get(a, 1000) == -1);
+    test(da_get(a, 1002) == -3);
+
+    dynarray(int) *b = new_dynarray(int, 1);
+    push_grow(b, 7);
+    extend(b, a);
+    test(length(b) == 1004);
+    test(da_get(b, 0) == 7);
+    test(da_get(b, 1) == 0);
+    test(da_get(b, 1003) == -3);
+
+    shrink_to_fit(b);
+    test(capacity(b) == 1004);
+    test(is_full(b));
+    test(da_get(b, 1003) == -3);
+
+    push_grow(b, 8);
+    test(capacity(b) == 2008);
+    test(da_get(b, 1004) == 8);
+
+    Dynarray_Dispose(a);
+    Dynarray_Dispose(b);
+}
 
+TEST_CASE(MappedDynarray)
+{
+    dynarray(int) *a = new_mapped_dynarray(int, 1000);
+    test(a != NULL);
+    test(capacity(a) == 1000);
+    test(length(a) == 0);
+
+    void *before = a;
+    for (int i = 0; i < 1000; ++i)  push_grow(a, i);
+    test((void*)a == before);
+    test(is_full(a));
+
+    push_grow(a, 1000);
+    test(capacity(a) >= 1001);
+    test(length(a) == 1001);
+    test(da_get(a, 0) == 0);
+    test(da_get(a, 999) == 999);
+    test(da_get(a, 1000) == 1000);
+
+    a = enlarge(a, 1000000);
+    test(capacity(a) >= 1001001);
+    test(length(a) == 1001);
+    test(da_get(a, 500) == 500);
+    a->begin[capacity(a)-1] = 7;
+
+    shrink_to_fit(a);
+    test(capacity(a) == 1001);
+    test(da_get(a, 1000) == 1000);
+
+    Dynarray_Dispose(a);
+
+    dynarray(double) *h = new_mapped_dynarray(double, 10, Dynarray_HugePages);
+    test(h != NULL);
+    push(h, 0.5);
+    test(da_get(h, 0) == 0.5);
+    Dynarray_Dispose(h);
+}
 
-#define error(stat_, error_code_, error_msg_)  \
-  (((stat_) = (Status){ .error=(error_code_), .debug_info=SOURCE_LINE_STR, .function=__func__, .message=(error_msg_) }).error)
+TEST_CASE(AllocStats)
+{
+    uint8_t *zeroed = kcalloc(100, 3);
+    test(zeroed && !zeroed[0] && !zeroed[299]);
+    kfree(zeroed);
+    kfree(NULL);
+
+    Kwr_AllocStats stats;
+#if KWR_ALLOC_STATS
+    char *block = kalloc(NULL, 100);  const char *site = SOURCE_LINE_STR;
+    Kwr_GetAllocStats(&stats, site);
+    test(stats.allocs == 1 && stats.live_bytes == 100 && stats.live_blocks == 1 && stats.bytes == 100);
+
+    FILE *file = tmpfile();
+    test(Kwr_PrintLeaks(file) >= 1);
+    char *text = TestReadBack(file);
+    fclose(file);
+    test(strstr(text, site) != NULL);
+    free(text);
+
+    block = kalloc(block, 1 << 20);  const char *grow_site = SOURCE_LINE_STR;
+    Kwr_GetAllocStats(&stats, site);
+    test(stats.live_bytes == 0 && stats.live_blocks == 0);   // the block went with the resize
+    Kwr_GetAllocStats(&stats, grow_site);
+    test(stats.resizes == 1 && stats.live_bytes == 1 << 20 && stats.moves <= 1);
+    Kwr_GetAllocStats(&stats, NULL);
+    test(stats.peak_bytes >= 1 << 20);
+    kfree(block);
+    Kwr_GetAllocStats(&stats, grow_site);
+    test(stats.frees == 1 && stats.live_bytes == 0 && stats.live_blocks == 0);
+
+    typedef dynarray(int) Test_Ints;
+    Test_Ints *ints = new_dynarray(int, 1);  const char *new_site = SOURCE_LINE_STR;
+    const char *push_site = SOURCE_LINE_STR;  for (int i = 0; i < 1000; ++i)  push_grow(ints, i);
+    Kwr_GetAllocStats(&stats, new_site);
+    test(stats.allocs == 1 && stats.live_blocks == 0);
+    Kwr_GetAllocStats(&stats, push_site);
+    test(stats.resizes == 10 && stats.moves <= 10 && stats.live_blocks == 1);
+    Dynarray_Dispose(ints);
+    Kwr_GetAllocStats(&stats, push_site);
+    test(stats.frees == 1 && stats.live_blocks == 0);
+#else
+    Kwr_GetAllocStats(&stats, NULL);
+    test(stats.allocs == 0 && stats.peak_bytes == 0);
+#endif
+}
 
+TEST_CASE(Arena)
+{
+    Kwr_Arena arena;
+    Kwr_InitArena(&arena, 1024);
+    test(arena.chunk_size == 1024);
+    test(arena.chunk == NULL);
+
+    char *p1 = Kwr_ArenaAlloc(&arena, 10);
+    char *p2 = Kwr_ArenaAlloc(&arena, 10);
+    test(p1 && p2);
+    test(p2 - p1 == _Alignof(max_align_t) * ((10 + _Alignof(max_align_t) - 1) / _Alignof(max_align_t)));
+    test((uintptr_t)p2 % _Alignof(max_align_t) == 0);
+
+    Kwr_ArenaMark mark = Kwr_ArenaGetMark(&arena);
+    char *p3 = Kwr_ArenaAlloc(&arena, 100);
+    test(Kwr_ArenaResize(&arena, p3, 100, 200) == p3);
+
+    char *big = Kwr_ArenaAlloc(&arena, 5000);
+    test(big != NULL);
+    test(Kwr_ArenaGetMark(&arena).chunk != mark.chunk);
+    memset(big, 0xAB, 5000);
+
+    Kwr_ArenaReset(&arena, mark);
+    test(arena.spare != NULL);
+    test(Kwr_ArenaAlloc(&arena, 100) == p3);
+
+    dynarray(int) *a = new_dynarray_in(&arena, int, 4);
+    test(capacity(a) == 4);
+    push(a, 1);
+    push(a, 2);
+    void *before = a;
+    a = enlarge_in(&arena, a);
+    test((void*)a == before);
+    test(capacity(a) == 8);
+    test(length(a) == 2);
+    test(da_get(a, 1) == 2);
+
+    char *p4 = Kwr_ArenaAlloc(&arena, 16);
+    a = enlarge_in(&arena, a, 8);
+    test((char*)a > p4);
+    test(capacity(a) == 16);
+    test(length(a) == 2);
+    test(da_get(a, 0) == 1);
+    test(da_get(a, 1) == 2);
+    test(a->map_flags & Dynarray_InArena);
+    Dynarray_Dispose(a);   // left to the arena
+
+    Maze_Grid grid = { .num_rows = 10, .num_columns = 10, .arena = &arena };
+    Maze_InitGrid(&grid);
+    test(grid.cells != NULL);
+    test(Maze_GridCellAt(&grid, 9, 9)->column == 9);
+    Maze_DisposeGrid(&grid);
+
+    Kwr_ClearArena(&arena);
+    test(arena.chunk == NULL);
+    test(arena.top == NULL);
+    test(Kwr_ArenaAlloc(&arena, 8) != NULL);
+
+    Kwr_DisposeArena(&arena);
+    test(arena.chunk == NULL);
+    test(arena.spare == NULL);
+}
 
-#define TIMESTAMP_STR_LEN 32
-typedef struct { char str[TIMESTAMP_STR_LEN]; } TimeStamp;
+TEST_CASE(Pool)
+{
+    typedef struct { int a, b, c; } Record;
+
+    Kwr_Pool pool;
+    Kwr_InitPool(&pool, sizeof(Record), 8);
+    test(pool.item_size >= sizeof(Record));
+    test(pool.item_size % _Alignof(max_align_t) == 0);
+    test(pool.live_count == 0);
+
+    Record *records[20];
+    for (int i = 0; i < 20; ++i) {
+        records[i] = Kwr_PoolAlloc(&pool);
+        *records[i] = (Record){ i, i, i };
+    }
+    test(pool.live_count == 20);
+    test(pool.peak_count == 20);
+    test(records[19]->c == 19);
+    test(records[1] != records[0]);
+
+    Record *last = records[19];
+    Kwr_PoolFree(&pool, records[19]);
+    test(pool.live_count == 19);
+    test(Kwr_PoolAlloc(&pool) == last);
+
+    for (int i = 0; i < 20; ++i)  Kwr_PoolFree(&pool, records[i]);
+    test(pool.live_count == 0);
+    test(pool.peak_count == 20);
+
+    Kwr_PoolCache cache;
+    Kwr_InitPoolCache(&cache, &pool);
+    Record *r1 = Kwr_PoolCacheAlloc(&cache);
+    Record *r2 = Kwr_PoolCacheAlloc(&cache);
+    test(r1 && r2 && r1 != r2);
+    test(cache.free_count == POOL_CACHE_BATCH - 2);
+    test(cache.live_delta == 2);
+
+    Kwr_PoolCacheFree(&cache, r2);
+    test(Kwr_PoolCacheAlloc(&cache) == r2);
+
+    Record *many[3 * POOL_CACHE_BATCH];
+    for (size_t i = 0; i < array_length(many); ++i)  many[i] = Kwr_PoolCacheAlloc(&cache);
+    for (size_t i = 0; i < array_length(many); ++i)  Kwr_PoolCacheFree(&cache, many[i]);
+    test(cache.free_count < 2 * POOL_CACHE_BATCH);
+    test(pool.peak_count >= 2 + 2 * POOL_CACHE_BATCH);
+
+    Kwr_PoolCacheFree(&cache, r1);
+    Kwr_PoolCacheFree(&cache, r2);
+    Kwr_DisposePoolCache(&cache);
+    test(pool.live_count == 0);
+
+    // Freed to the pool before the cache counts the allocation
+    ptrdiff_t peak = pool.peak_count;
+    Kwr_InitPoolCache(&cache, &pool);
+    Kwr_PoolFree(&pool, Kwr_PoolCacheAlloc(&cache));
+    test(pool.live_count == -1 && pool.peak_count == peak);
+    Kwr_DisposePoolCache(&cache);
+    test(pool.live_count == 0 && pool.peak_count == peak);
+
+    Kwr_DisposePool(&pool);
+    test(pool.slabs == NULL);
+}
 
-ErrorCode GetTimeStamp(TimeStamp *stamp, Status *stat)
+typedef struct { int key; uint32_t value; } Test_IntSlot;
+typedef hashmap(Test_IntSlot) Test_IntMap;
+
+typedef struct { const char *key; int count; } Test_WordSlot;
+typedef hashmap(Test_WordSlot) Test_WordMap;
+
+TEST_CASE(HashMaps)
 {
-    requires(stamp != NULL);
+    test(Kwr_HashInt(0) != Kwr_HashInt(1));
+    char copy[] = "maze walls";
+    test(Kwr_HashString("maze walls") == Kwr_HashString(copy) && Kwr_HashString("") != Kwr_HashString("a"));
+
+    Test_IntMap *empty = NULL;
+    test(hashmap_count(empty) == 0 && hashmap_find(empty, 3) == NULL && !hashmap_remove(empty, 3));
+    int visited = 0;
+    hashmap_each(empty, i)  ++visited;
+    test(visited == 0);
+    hashmap_dispose(empty);
+
+    // Random inserts and removes against a plain array of the same keys
+    enum { Keys = 20000 };
+    static uint32_t expected[Keys];   // value + 1, or 0 when absent
+    memset(expected, 0, sizeof(expected));
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 7);
+    Test_IntMap *map = NULL;
+    size_t live = 0;
+    _Bool agrees = true;
+    for (int i = 0; i < 200000; ++i) {
+        int key = (int)Xoshiro256_RandBelow(&rng, Keys);
+        if (Xoshiro256_RandBelow(&rng, 3)) {
+            Test_IntSlot *slot = hashmap_insert(map, key - Keys / 2);
+            agrees &= slot->key == key - Keys / 2 && (expected[key]? slot->value + 1 == expected[key]: slot->value == 0);
+            live += !expected[key];
+            slot->value = i;
+            expected[key] = i + 1;
+        }
+        else {
+            agrees &= hashmap_remove(map, key - Keys / 2) == (expected[key] != 0);
+            live -= expected[key] != 0;
+            expected[key] = 0;
+        }
+    }
+    test(agrees);
+    test(hashmap_count(map) == live && live > 0);
+    test(map->used <= Kwr_HashMapMaxLoad(map->capacity));
+
+    _Bool found_all = true;
+    for (int key = 0; key < Keys; ++key) {
+        Test_IntSlot *slot = hashmap_find(map, key - Keys / 2);
+        found_all &= expected[key]? slot && slot->value + 1 == expected[key]: slot == NULL;
+    }
+    test(found_all);
+    test(!hashmap_contains(map, Keys) && !hashmap_contains(map, -Keys));
 
-    time_t now = time(NULL);
-    if (now == (time_t)(-1)) {
-        return error(*stat, ErrorCode_Failure, "GetCurrentTime() returned -1");
+    size_t seen = 0;
+    hashmap_each(map, i) {
+        ++seen;
+        found_all &= expected[map->slots[i].key + Keys / 2] == map->slots[i].value + 1;
     }
+    test(seen == live && found_all);
 
-    struct tm *local_tm = localtime(&now);
-    if (!local_tm) {
-        return error(*stat, ErrorCode_Failure, "localtime() returned NULL");
+    // Shrinks to fit once most keys are gone
+    size_t big = hashmap_capacity(map);
+    for (int key = 0; key < Keys; ++key) {
+        if (key % 100 && expected[key])  hashmap_remove(map, key - Keys / 2), --live;
+    }
+    hashmap_rehash(map, 0);
+    test(hashmap_capacity(map) < big / 8 && hashmap_count(map) == live && map->used == live);
+    test(hashmap_contains(map, 0 - Keys / 2) == (expected[0] != 0));
+
+    // A remove-insert cycle reuses slots rather than growing
+    hashmap_clear(map);
+    test(hashmap_count(map) == 0 && !hashmap_contains(map, 0 - Keys / 2));
+    size_t small = hashmap_capacity(map);
+    for (int i = 0; i < 100000; ++i) {
+        hashmap_insert(map, i);
+        if (i >= 10)  hashmap_remove(map, i - 10);
+    }
+    test(hashmap_count(map) == 10 && hashmap_capacity(map) == small);
+    hashmap_dispose(map);
+    test(map == NULL);
+
+    // Narrow keys are matched on their own bits
+    typedef struct { int8_t key; } Test_ByteSlot;
+    hashmap(Test_ByteSlot) *bytes = NULL;
+    for (int key = -128; key < 128; ++key)  hashmap_insert(bytes, key);
+    test(hashmap_count(bytes) == 256 && hashmap_contains(bytes, -1) && hashmap_contains(bytes, 127));
+    test(((Test_ByteSlot*)hashmap_find(bytes, -128))->key == -128);
+    hashmap_dispose(bytes);
+
+    typedef struct { const int *key; } Test_PointerSlot;
+    hashmap(Test_PointerSlot) *pointers = NULL;
+    int cells[64];
+    for (int i = 0; i < 64; i += 2)  hashmap_insert(pointers, &cells[i]);
+    test(hashmap_count(pointers) == 32 && hashmap_contains(pointers, &cells[62]) && !hashmap_contains(pointers, &cells[1]));
+    hashmap_dispose(pointers);
+
+    // String keys match by contents; the map keeps the inserted pointer
+    static const char *words[] = { "north", "south", "east", "west", "north", "dead end", "south", "north" };
+    Test_WordMap *counts = NULL;
+    for (size_t i = 0; i < array_length(words); ++i)  ++hashmap_insert(counts, words[i])->count;
+    char north[] = "north";
+    Test_WordSlot *slot = hashmap_find(counts, north);
+    test(hashmap_count(counts) == 5 && slot && slot->count == 3 && slot->key == words[0]);
+    test(!hashmap_contains(counts, "nort") && !hashmap_contains(counts, "northeast"));
+    test(hashmap_remove(counts, "dead end") && !hashmap_contains(counts, "dead end"));
+    hashmap_dispose(counts);
+
+    // Arena maps move within the arena and are freed with it
+    Kwr_Arena arena;
+    Kwr_InitArena(&arena, 0);
+    Test_IntMap *in_arena = NULL;
+    hashmap_reserve_in(&arena, in_arena, 10);
+    test(in_arena && in_arena->arena == &arena && hashmap_capacity(in_arena) == 16);
+    for (int key = 0; key < 1000; ++key)  hashmap_insert(in_arena, key)->value = key * 2;
+    test(in_arena->arena == &arena && hashmap_count(in_arena) == 1000);
+    test(((Test_IntSlot*)hashmap_find(in_arena, 999))->value == 1998);
+    hashmap_dispose(in_arena);
+    Kwr_DisposeArena(&arena);
+}
+
+static _Bool TestFormatsDouble(double value, const char *expected)
+{
+    char out[Kwr_DoubleChars + 1];
+    out[Kwr_FormatDouble(out, value)] = '\0';
+    return !strcmp(out, expected);
+}
+
+// Digits from the first nonzero one to the last, before any exponent
+static int TestSignificantDigits(const char *text)
+{
+    int digits = 0, zeros = 0;
+    for (; *text && *text != 'e'; ++text) {
+        if (*text < '0' || *text > '9')  continue;
+        if (*text == '0')  zeros += digits > 0;
+        else  digits += zeros + 1, zeros = 0;
+    }
+    return digits;
+}
+
+TEST_CASE(Formatting)
+{
+    char out[Kwr_IntChars + 1], expected[32];
+    out[Kwr_FormatInt(out, 0)] = '\0';
+    test(!strcmp(out, "0"));
+    out[Kwr_FormatInt(out, INT64_MIN)] = '\0';
+    test(!strcmp(out, "-9223372036854775808"));
+    out[Kwr_FormatUnsigned(out, UINT64_MAX)] = '\0';
+    test(!strcmp(out, "18446744073709551615"));
+
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 99);
+    _Bool ints_match = true;
+    for (int i = 0; i < 10000; ++i) {
+        int64_t value = (int64_t)Xoshiro256_Rand(&rng) >> (i % 64);
+        out[Kwr_FormatInt(out, value)] = '\0';
+        snprintf(expected, sizeof(expected), "%lld", (long long)value);
+        ints_match &= !strcmp(out, expected);
+    }
+    test(ints_match);
+
+    test(TestFormatsDouble(0.0, "0") && TestFormatsDouble(-0.0, "-0"));
+    test(TestFormatsDouble(4.5, "4.5") && TestFormatsDouble(-100, "-100"));
+    test(TestFormatsDouble(0.1, "0.1") && TestFormatsDouble(0.1 + 0.2, "0.30000000000000004"));
+    test(TestFormatsDouble(1.0 / 3, "0.3333333333333333"));
+    test(TestFormatsDouble(123456.789, "123456.789"));
+    test(TestFormatsDouble(1e16, "10000000000000000") && TestFormatsDouble(1e17, "1e+17"));
+    test(TestFormatsDouble(0.00001, "0.00001") && TestFormatsDouble(1.5e-6, "1.5e-06"));
+    test(TestFormatsDouble(1e23, "1e+23") && TestFormatsDouble(9007199254740993.0, "9007199254740992"));
+    test(TestFormatsDouble(5e-324, "5e-324") && TestFormatsDouble(DBL_MIN, "2.2250738585072014e-308"));
+    test(TestFormatsDouble(DBL_MAX, "1.7976931348623157e+308"));
+    test(TestFormatsDouble(INFINITY, "inf") && TestFormatsDouble(-INFINITY, "-inf") && TestFormatsDouble(NAN, "nan"));
+
+    // Any bit pattern reads back the same, in no more digits than %.17g
+    _Bool doubles_round_trip = true;
+    for (int i = 0; i < 10000; ++i) {
+        uint64_t bits = Xoshiro256_Rand(&rng);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value))  continue;
+        char text[Kwr_DoubleChars + 1];
+        text[Kwr_FormatDouble(text, value)] = '\0';
+        doubles_round_trip &= strtod(text, NULL) == value && TestSignificantDigits(text) <= 17;
+    }
+    test(doubles_round_trip);
+
+    char small[8];
+    Kwr_Buffer fixed = Kwr_FixedBuffer(small);
+    Kwr_AppendString(&fixed, "hello ");
+    Kwr_AppendString(&fixed, "world");
+    test(!strcmp(small, "hello w") && fixed.length == 11 && Kwr_BufferTruncated(&fixed));
+
+    // Appends after truncating only count, leaving the memory past the buffer alone
+    struct { char text[8]; char guard[8]; } guarded;
+    memset(guarded.guard, 'g', sizeof(guarded.guard));
+    fixed = Kwr_FixedBuffer(guarded.text);
+    Kwr_AppendString(&fixed, "hello world");
+    Kwr_AppendString(&fixed, "!!");
+    Kwr_AppendChar(&fixed, '\n');
+    test(!strcmp(guarded.text, "hello w") && fixed.length == 14);
+    test(!memcmp(guarded.guard, "gggggggg", 8));
+
+    Kwr_Buffer grown = Kwr_InitTextBuffer(NULL);
+    for (int i = 0; i < 1000; ++i) {
+        Kwr_AppendInt(&grown, i);
+        Kwr_AppendChar(&grown, ',');
     }
+    test(!Kwr_BufferTruncated(&grown) && grown.text->length == grown.length);
+    test(grown.length == 10 * 2 + 90 * 3 + 900 * 4 && strlen(grown.begin) == grown.length);
+    test(!strncmp(grown.begin, "0,1,2,", 6) && !strcmp(grown.begin + grown.length - 4, "999,"));
+    Dynarray_Dispose(grown.text);
+
+    char line[128];
+    Kwr_Buffer buf = Kwr_FixedBuffer(line);
+    Kwr_AppendZeroPadded(&buf, 7, 3);
+    Kwr_AppendHex(&buf, 255);
+    Kwr_AppendHex(&buf, 0);
+    test(!strcmp(line, "0070xff0x0"));
+
+    buf = Kwr_FixedBuffer(line);
+    Status stat = MakeError(ErrorCode_Failure, "bad maze");
+    Kwr_AppendStatus(&buf, &stat);
+    test(!strcmp(line, "ErrorCode_Failure: \"bad maze\" in function Test_Formatting()"));
+
+    buf = Kwr_FixedBuffer(line);
+    Any_Append(&buf, any(42L));
+    Any_Append(&buf, any((char)' '));
+    Any_Append(&buf, any(2.5));
+    Any_Append(&buf, any((_Bool)true));
+    Any_Append(&buf, any((const char *)"!"));
+    test(!strcmp(line, "42 2.5true!"));
+    test(!strcmp(Any_GetPrintFormat(any(42L)), "%ld"));
+}
 
-    size_t strftime_returns = strftime(stamp->str, TIMESTAMP_STR_LEN, "%Y-%m-%d %H:%M:%S", local_tm);
+static void TestLogFromTask(void *data, size_t task)
+{
+    UNUSED(data);
+    for (int i = 0; i < 100; ++i)  Kwr_LogInfo("task", "task {} record {}", task, i);
+}
 
-    ensure(strftime_returns > 0);
-    return ErrorCode_OK;
+TEST_CASE(Logging)
+{
+    char path[32];
+    TestTempPath(path);
+    test(Kwr_OpenLog(path, Kwr_LogLevel_Debug) == ErrorCode_OK);
+
+    int evaluated = 0;
+    Kwr_LogTrace("test", "compiled out {}", ++evaluated);   // unless built with KWR_LOG_LEVEL at Trace
+    test(evaluated == (KWR_LOG_LEVEL <= KWR_LOG_TRACE));
+    Kwr_LogAt(Kwr_LogLevel_Trace, "test", "below the threshold");
+
+    Maze_Cell cell = {0};
+    Kwr_LogArg arg = Kwr_LogArgOf(&cell);
+    test(arg.type == Kwr_LogArg_Pointer && arg.value.p == &cell);
+
+    Kwr_LogDebug("test", "{} + {} = {}", 2, 2u, 4.5);
+    Kwr_LogInfo("test", "char {} bool {} string {}", (char)'x', (_Bool)true, "abc");
+    Kwr_LogWarn("test", "no argument for {}");
+    Kwr_LogError("test", "more {} than holes", 1, 2);
+    Kwr_ParallelFor(8, 4, TestLogFromTask, NULL);
+    Kwr_FlushLog();
+
+    void *data;
+    size_t size;
+    test(Kwr_MapFile(path, &data, &size) == ErrorCode_OK);
+    char *text = calloc(1, size + 1);
+    memcpy(text, data, size);
+    Kwr_UnmapFile(data, size);
+
+    int lines = 0;
+    for (char *at = text; (at = strchr(at, '\n')); ++at)  ++lines;
+    test(lines == 3 + 800 + (KWR_LOG_LEVEL <= KWR_LOG_DEBUG));
+    test(KWR_LOG_LEVEL > KWR_LOG_DEBUG || strstr(text, " test Debug \"2 + 2 = 4.5\"\n"));
+    test(strstr(text, " test Info \"char x bool true string abc\"\n"));
+    test(strstr(text, " test Warn \"no argument for {}\"\n"));
+    test(strstr(text, " test Error \"more 1 than holes\"\n"));
+    test(strstr(text, " task Info \"task 7 record 99\"\n"));
+    test(!strstr(text, "Trace"));
+    test(Kwr_LogDropped() == 0);
+    free(text);
+
+    Kwr_CloseLog();
+    Kwr_LogInfo("test", "not open");
+    remove(path);
 }
 
-void print_log(TraceConfig *tracer, int level, const char *message)
-{ 
-    Status stat;
-    TimeStamp timestamp = {0};
-    if (GetTimeStamp(&timestamp, &stat) != ErrorCode_OK) {
-        trace(tracer, stat.debug_info, ErrorCode_String(stat.error), 1, stat.message);
+TEST_CASE(Clock)
+{
+    uint64_t start = Kwr_ClockNow();
+    struct timespec start_ts;
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+
+    uint64_t last = start;
+    _Bool monotonic = true;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t now = Kwr_ClockNow();
+        monotonic &= now >= last;
+        last = now;
     }
-    trace(tracer, timestamp.str, "Debug", level, message);
+    test(monotonic);
+
+    nanosleep(&(struct timespec){ .tv_nsec = 20 * 1000000 }, NULL);
+    uint64_t elapsed = Kwr_ClockNow() - start;
+    struct timespec end_ts;
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    int64_t expected = (int64_t)(end_ts.tv_sec - start_ts.tv_sec) * 1000000000 + (end_ts.tv_nsec - start_ts.tv_nsec);
+    test(elapsed >= 20 * 1000000);
+    test(llabs((int64_t)elapsed - expected) < expected / 50 + 100000);
+    test(!strcmp(Kwr_ClockSource(), "tsc") || !strcmp(Kwr_ClockSource(), "clock_gettime"));
 }
 
+TEST_CASE(Profiling)
+{
+#if KWR_PROFILE
+    for (int i = 0; i < 10; ++i) {
+        PROFILE_ZONE("TestZone") {
+            nanosleep(&(struct timespec){ .tv_nsec = (i == 9? 2000000: 1000) }, NULL);
+        }
+    }
 
+    Kwr_ProfileZone *zone = Kwr_FindProfileZone("TestZone");
+    test(zone != NULL);
+    if (!zone)  return;
+    test(zone->count == 10);
+    test(zone->min_ns >= 1000 && zone->min_ns < zone->max_ns);
+    test(zone->max_ns >= 2000000 && zone->total_ns >= zone->max_ns + 9 * zone->min_ns);
+
+    uint64_t in_buckets = 0;
+    for (int b = 0; b < KWR_PROFILE_BUCKETS; ++b)  in_buckets += zone->buckets[b];
+    test(in_buckets == 10);
+    test(zone->buckets[63 - __builtin_clzll(zone->max_ns)] >= 1);
+    test(Kwr_FindProfileZone("NoSuchZone") == NULL);
+
+    FILE *file = tmpfile();
+    Kwr_PrintProfile(file);
+    char *text = TestReadBack(file);
+    fclose(file);
+    test(strstr(text, "\nTestZone ") != NULL);
+    free(text);
+#else
+    UNUSED(runner);   // zones compiled out
+#endif
+}
 
+// Scalar reference for XorShift_Fill: lanes seeded as kwrlib.c does,
+// each a plain XorShift, their numbers interleaved
+static void TestXorShiftFillReference(XorShift *state, uint32_t *out, size_t n)
+{
+    uint32_t seed = XorShift_Rand(state);
+    XorShift lanes[XorShift_Lanes];
+    for (uint32_t i = 0; i < XorShift_Lanes; ++i) {
+        uint32_t z = seed + (i + 1) * 0x9E3779B9u;
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        lanes[i] = *state;
+        lanes[i].x = z? z: i + 1;
+    }
+    for (size_t i = 0; i < n; ++i)  out[i] = XorShift_Rand(&lanes[i % XorShift_Lanes]);
+}
 
+TEST_CASE(XorShiftFill)
+{
+    XorShift xor_a, xor_b;
+    XorShift_Init(&xor_a, 12314, 4);
+    XorShift_Init(&xor_b, 12314, 4);
+
+    uint32_t nums[1000], more[13];
+    XorShift_Fill(&xor_a, nums, array_length(nums));
+    XorShift_Fill(&xor_b, more, array_length(more));
+    test(!memcmp(nums, more, sizeof(more)));
+    test(xor_a.x == xor_b.x);
+
+    XorShift_Fill(&xor_a, more, array_length(more));
+    test(memcmp(nums, more, sizeof(more)) != 0);
+
+    // Roughly half of all bits set, and no lanes stuck together
+    uint64_t sum = 0;
+    int bits = 0, repeats = 0;
+    for (size_t i = 0; i < array_length(nums); ++i) {
+        sum += nums[i];
+        for (uint32_t x = nums[i]; x; x &= x - 1)  ++bits;
+        if (i && nums[i] == nums[i-1])  ++repeats;
+    }
+    test(bits > 15000 && bits < 17000);
+    test(sum / array_length(nums) > 0x70000000u && sum / array_length(nums) < 0x90000000u);
+    test(repeats == 0);
+
+    XorShift xor_c;
+    XorShift_Init(&xor_c, 12314, 7);  // no specialized kernel
+    XorShift_Fill(&xor_c, more, array_length(more));
+    test(memcmp(nums, more, sizeof(more)) != 0);
+
+    // Whichever kernels this build has match the scalar generator, for
+    // each of the 81 shift triples and with a partial last block
+    _Bool matches_reference = true;
+    for (int params = 0; params < 81; ++params) {
+        uint32_t reference[101];
+        XorShift_Init(&xor_a, 999 + params, params);
+        xor_b = xor_a;
+        XorShift_Fill(&xor_a, nums, array_length(reference));
+        TestXorShiftFillReference(&xor_b, reference, array_length(reference));
+        matches_reference &= !memcmp(nums, reference, sizeof(reference)) && xor_a.x == xor_b.x;
+    }
+    test(matches_reference);
+}
 
-void RunTests(Test_Runner *runner)
+TEST_CASE(Xoshiro256)
 {
-    UNUSED(runner);
+    uint64_t sm = 12314;
+    test(SplitMix64_Next(&sm) == 0xEC7E3594A4DAC544);
+
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 12314);
+    Xoshiro256 start = rng;
+    test(Xoshiro256_Rand(&rng) == 0x65B478C46EFF2547);
+    test(Xoshiro256_Rand(&rng) == 0xCA1DDB7EB971A207);
+    test(Xoshiro256_Rand(&rng) == 0x21120E753A78128A);
+
+    rng = start;
+    Xoshiro256_Jump(&rng);
+    test(Xoshiro256_Rand(&rng) == 0x833B97207E118507);
+    test(Xoshiro256_Rand(&rng) == 0xFE6424673400F564);
+
+    rng = start;
+    Xoshiro256_LongJump(&rng);
+    test(Xoshiro256_Rand(&rng) == 0x408BAEF54940D005);
+    test(Xoshiro256_Rand(&rng) == 0x01B9511EAD6C1899);
+
+    Xoshiro256 stream_0, stream_1;
+    Xoshiro256_InitStream(&stream_0, 12314, 0);
+    Xoshiro256_InitStream(&stream_1, 12314, 1);
+    test(!memcmp(&stream_0, &start, sizeof(start)));
+    test(Xoshiro256_Rand(&stream_1) == 0x833B97207E118507);
+}
 
-    test(true);
-    //test(false);
-    
-    { // TypeId tests
-
-        TYPE_ID_DEFN(TypedFoo);
-
-        typedef struct TypedFoo {
-            TypeId type_info;
-            int x;
-        } TypedFoo;
-
-        typedef struct UntypedFoo {
-            float y;
-        } UntypedFoo;
-
-        TypedFoo   *nfoo = NULL;
-        TypedFoo   tfoo = { .type_info = TypedFoo_TypeId, .x = 1 };
-        UntypedFoo ufoo = { .y = 0.5 };
-
-        test( !type_of(nfoo) );
-        test( type_of(&tfoo) == TypedFoo_TypeId );
-        test( type_of(&tfoo) != type_of(&ufoo) );
-    }
-
-    { // tuple macro
-        vector(int, x, y, z) point = {{ 10, 11, 12 }};
-        test(vec_length(point) == 3);
-        test(point.x == 10);
-        test(point.y == 11);
-        test(point.z == 12);
-        test(point.components[0] == 10);
-        test(point.components[1] == 11);
-        test(point.components[2] == 12);
-    }
-
-    { // dynarray 
-
-        test(sizeof(dynarray(int)) == sizeof(dynarray(char)));
-        test(offsetof(dynarray(int), top) == offsetof(dynarray(char), top));
-        test(offsetof(dynarray(int), end) == offsetof(dynarray(char), end));
-        test(offsetof(dynarray(int), begin) == offsetof(dynarray(char), begin));
-
-        dynarray(int) *a = new_dynarray(int); 
-
-        test(capacity(a) == 64);
-        test(length(a) == 0);
-        test(remaining(a) == 64);
-        test(is_empty(a));
-        test(!is_full(a));
-
-        int x = 101;
-        int i = push(a, x++); // = x++;
-
-        // these don't compile because the macros are not L-values
-        //capacity(a) = 5;
-        //length(a) = 3;
-        //remaining(a) = 99;
-        //da_set(a, 0, 1000) = 0;
-
-        test(capacity(a) == 64);
-        test(length(a) == 1);
-        test(remaining(a) == 63);
-        test(!is_empty(a));
-        test(!is_full(a));
-        test(da_get(a, 0) == 101);
-        test(i == 101);
-
-        i = da_set(a, 0, 99);
-        test(a->begin[0] == 99);
-        test(i == 99);
-
-        for (int i = 47; i --> 0;)  push(a, x++); // = x++;
-
-        test(length(a) == 48);
-        test(remaining(a) == 16);
-        test(!is_empty(a));
-        test(!is_full(a));
-        test(da_get(a, 1) == 102);
-        test(da_get(a, 47) == 148);
-
-        int *ab = a->begin;
-        test(ab[2] == 103);
-        test(ab[46] == 147);
-
-        while (remaining(a))  push(a, x++); // = x++;
-
-        test(length(a) == 64);
-        test(remaining(a) == 0);
-        test(!is_empty(a));
-        test(is_full(a));
-        ab = a->begin;
-        test(ab[63] == 164);
-
-        void *b = enlarge(a);
-        test(b != NULL);
-        a = b;
-
-        test(capacity(a) == 128);
-        test(length(a) == 64);
-        test(remaining(a) == 64);
-        test(!is_empty(a));
-        test(!is_full(a));
-        
-        test(da_get(a, 1) == 102);
-        test(da_get(a, 40) == 141);
-        test(da_get(a, 63) == 164);
-
-        // Should assert
-        //int y = da_get(a, 129);
-        
-        a = enlarge(a, 44);
-        test(capacity(a) == 128+44);
-
-        free(a);
-    }
-
-    { // Trace
-
-        //TraceConfig tracer = { .file = stdout, .throttle = 8 };
-        //debug(&tracer, 5, SOURCE_LINE_STR, "Hello, world!");
-        //debug(&tracer, 10, SOURCE_LINE_STR, "This should not print.");
-
-        //TraceConfig logger = { 
-            //.file = fopen("trace_test.log", "w"),
-            //.throttle = 8 
-        //};
-
-        //print_log(&logger, 3, "Write this to log file");
-
-        //Status stat = { 
-            //.error = ErrorCode_Error,
-            //.debug_info = SOURCE_LINE_STR,
-            //.function = __func__,
-            //.message = "Write to log"
-        //};
-
-        //fclose(logger.file);
-    }
-
-    { // Maze Cells
-        Maze_Cell cell_1 = { .row = 1, .column = 3 };
-        test(cell_1.row == 1);
-        test(cell_1.column == 3);
-        test(cell_1.north == NULL);
-        test(cell_1.south == NULL);
-        test(cell_1.east == NULL);
-        test(cell_1.west == NULL);
-
-        Maze_Cell cell_n = { .row = 0, .column = 3 };
-        Maze_LinkCells(&cell_1, Maze_Dir_North, &cell_n);
-        test(cell_1.north == &cell_n);
-        test(cell_n.south == &cell_1);
-
-        Maze_Cell cell_e = { .row = 1, .column = 4 };
-        Maze_LinkCells(&cell_1, Maze_Dir_East, &cell_e);
-        test(cell_1.east = &cell_e);
-        test(cell_e.west = &cell_1);
-
-        Maze_Cell cell_s = { .row = 2, .column = 3, .north = &cell_1 };
-        cell_1.south = &cell_s;
-        test(Maze_FindLink(&cell_1, &cell_s) == &cell_1.south);
-        test(Maze_FindLink(&cell_s, &cell_1) == &cell_s.north);
-        Maze_UnlinkCells(&cell_1, &cell_s);
-        test(cell_s.north == NULL);
-        test(cell_1.south == NULL);
-
-        Maze_Cell cell_0;
-        test(!Maze_FindLink(&cell_1, &cell_0));
-    }
-
-    { // Maze Grid
-        Maze_Grid grid = { .num_rows = 10, .num_columns = 20 };
-        test(grid.num_rows == 10);
-        test(grid.num_columns == 20);
-        test(!grid.cells);
-        test(!grid.rows);
+TEST_CASE(BoundedRandom)
+{
+    XorShift xor;
+    XorShift_Init(&xor, 12314, 4);
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 12314);
+
+    int counts[2][3] = {0};
+    _Bool in_range = true;
+    for (int i = 0; i < 30000; ++i) {
+        uint32_t x = Kwr_RandBelow(&xor, 3);
+        uint64_t y = Kwr_RandBelow(&rng, 3);
+        in_range = in_range && x < 3 && y < 3;
+        if (x < 3)  ++counts[0][x];
+        if (y < 3)  ++counts[1][y];
+    }
+    test(in_range);
+    for (int g = 0; g < 2; ++g) {
+        for (int k = 0; k < 3; ++k)  test(counts[g][k] > 9500 && counts[g][k] < 10500);
+    }
+
+    test(Kwr_RandBelow(&xor, 1) == 0);
+    test(Kwr_RandBelow(&rng, 1) == 0);
 
+    uint64_t big_n = UINT64_C(3) << 62;
+    _Bool big_in_range = true, big_high = false;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t y = Kwr_RandBelow(&rng, big_n);
+        big_in_range = big_in_range && y < big_n;
+        big_high = big_high || y > (UINT64_C(1) << 63);
+    }
+    test(big_in_range);
+    test(big_high);
+
+    dynarray(int) *a = new_dynarray(int, 100);
+    for (int i = 0; i < 100; ++i)  push(a, i);
+    shuffle(a, &rng);
+    int sum = 0, moved = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        sum += da_get(a, i);
+        moved += da_get(a, i) != (int)i;
+    }
+    test(sum == 4950);
+    test(moved > 50);
+
+    XorShift_Shuffle(&xor, a->begin, length(a), sizeof(int));
+    sum = 0;
+    for (size_t i = 0; i < 100; ++i)  sum += da_get(a, i);
+    test(sum == 4950);
+
+    int pick = random_choice(a, &xor);
+    test(0 <= pick && pick < 100);
+    pick = random_choice(a, &rng);
+    test(0 <= pick && pick < 100);
+
+    Dynarray_Dispose(a);
+}
+
+TEST_CASE(PriorityQueue)
+{
+    Kwr_IndexHeap heap;
+    test(Kwr_InitIndexHeap(&heap, 100) == ErrorCode_OK);
+    test(Kwr_HeapIsEmpty(&heap));
+
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 7);
+    for (uint32_t item = 0; item < 100; ++item)  Kwr_HeapPush(&heap, item, 1000 + Xoshiro256_RandBelow(&rng, 1000));
+    test(Kwr_HeapPush(&heap, 42, 5));
+    test(!Kwr_HeapPush(&heap, 42, 6));
+    test(Kwr_HeapContains(&heap, 42));
+    test(heap.count == 100);
+
+    test(Kwr_HeapPop(&heap) == 42);
+    test(!Kwr_HeapContains(&heap, 42));
+    uint64_t previous = 0;
+    _Bool ordered = true;
+    while (heap.count > 50) {
+        uint32_t item = Kwr_HeapPop(&heap);
+        ordered = ordered && heap.priorities[item] >= previous;
+        previous = heap.priorities[item];
+    }
+    test(ordered);
+
+    Kwr_HeapClear(&heap);
+    test(Kwr_HeapIsEmpty(&heap));
+    _Bool all_absent = true;
+    for (uint32_t item = 0; item < 100; ++item)  all_absent = all_absent && !Kwr_HeapContains(&heap, item);
+    test(all_absent);
+    Kwr_DisposeIndexHeap(&heap);
+}
+
+TEST_CASE(Images)
+{
+    Kwr_Image image = { .width = 10, .height = 8, .channels = 1 };
+    test(Kwr_InitImage(&image) == ErrorCode_OK);
+    test(image.stride == 10);
+    Kwr_ImageFillRect(&image, 7, -2, 10, 4, (uint8_t[]){ 200 });
+    test(Kwr_ImageRow(&image, 0)[6] == 0);
+    test(Kwr_ImageRow(&image, 0)[7] == 200 && Kwr_ImageRow(&image, 1)[9] == 200);
+    test(Kwr_ImageRow(&image, 2)[9] == 0);
+
+    char path[32];
+    TestTempPath(path);
+    test(Kwr_WriteImage(&image, path) == ErrorCode_OK);
+    FILE *file = fopen(path, "rb");
+    char header[16] = {0};
+    size_t header_bytes = fread(header, 1, 12, file);
+    fseek(file, 0, SEEK_END);
+    test(header_bytes == 12 && !strcmp(header, "P5\n10 8\n255\n"));
+    test(ftell(file) == 12 + 80);
+    fclose(file);
+    remove(path);
+    Kwr_DisposeImage(&image);
+
+    Kwr_Image rgba = { .width = 3, .height = 2, .channels = 4 };
+    Kwr_InitImage(&rgba);
+    Kwr_ImageFillRect(&rgba, 1, 1, 5, 5, (uint8_t[]){ 1, 2, 3, 4 });
+    test(!memcmp(Kwr_ImageRow(&rgba, 1) + 4, (uint8_t[]){ 1, 2, 3, 4, 1, 2, 3, 4 }, 8));
+    test(Kwr_ImageRow(&rgba, 1)[0] == 0 && Kwr_ImageRow(&rgba, 0)[4] == 0);
+    Kwr_DisposeImage(&rgba);
+}
+
+TEST_CASE(MazeCells)
+{
+    Maze_Cell cell_1 = { .row = 1, .column = 3 };
+    test(cell_1.row == 1);
+    test(cell_1.column == 3);
+    test(cell_1.north == NULL);
+    test(cell_1.south == NULL);
+    test(cell_1.east == NULL);
+    test(cell_1.west == NULL);
+
+    Maze_Cell cell_n = { .row = 0, .column = 3 };
+    Maze_LinkCells(&cell_1, Maze_Dir_North, &cell_n);
+    test(cell_1.north == &cell_n);
+    test(cell_n.south == &cell_1);
+
+    Maze_Cell cell_e = { .row = 1, .column = 4 };
+    Maze_LinkCells(&cell_1, Maze_Dir_East, &cell_e);
+    test(cell_1.east = &cell_e);
+    test(cell_e.west = &cell_1);
+
+    Maze_Cell cell_s = { .row = 2, .column = 3, .north = &cell_1 };
+    cell_1.south = &cell_s;
+    test(Maze_FindLink(&cell_1, &cell_s) == &cell_1.south);
+    test(Maze_FindLink(&cell_s, &cell_1) == &cell_s.north);
+    Maze_UnlinkCells(&cell_1, &cell_s);
+    test(cell_s.north == NULL);
+    test(cell_1.south == NULL);
+
+    Maze_Cell cell_0;
+    test(!Maze_FindLink(&cell_1, &cell_0));
+}
+
+TEST_CASE(MazeGrid)
+{
+    Maze_Grid grid = { .num_rows = 10, .num_columns = 20 };
+    test(grid.num_rows == 10);
+    test(grid.num_columns == 20);
+    test(!grid.cells);
+    test(!grid.rows);
+
+    Maze_InitGrid(&grid);
+    test(grid.cells != NULL);
+    test(grid.rows != NULL);
+    for (int r = 0; r < grid.num_rows; ++r) {
+        for (int c = 0; c < grid.num_columns; ++c) {
+            test(grid.rows[r][c].row == r);
+            test(grid.rows[r][c].column == c);
+        }
+    }
+
+    test(Maze_GridCellAt(&grid,  0,  0));
+    test(Maze_GridCellAt(&grid,  5,  5));
+    test(Maze_GridCellAt(&grid,  9, 19));
+    test(Maze_GridCellAt(&grid, -1,  0) == NULL);
+    test(Maze_GridCellAt(&grid,  0, -1) == NULL);
+    test(Maze_GridCellAt(&grid, 10, 19) == NULL);
+    test(Maze_GridCellAt(&grid,  9, 20) == NULL);
+
+    test(Maze_CountGridCells(&grid) == 200);
+
+    Maze_Cell *cell = Maze_GridCellAt(&grid, 5,5);
+    Maze_Cell *north_cell = Maze_GoNorth(&grid, cell);
+    test(north_cell->row == 4 && north_cell->column == 5);
+
+    Maze_Cell *east_cell = Maze_GoEast(&grid, cell);
+    test(east_cell->row == 5 && east_cell->column == 6);
+
+    Maze_Cell *top_right_cell = Maze_GridCellAt(&grid, 0, 19);
+    test(NULL == Maze_GoNorth(&grid, top_right_cell));
+    test(NULL == Maze_GoEast(&grid, top_right_cell));
+
+    int row_count = 0;
+    Maze_ForEachGridRow(&grid, TestForEachGridRow, &row_count);
+    test(row_count == 45); // 0 + 1 + ... + 9
+
+    Maze_DisposeGrid(&grid);
+    test(grid.num_rows == 0);
+    test(grid.num_columns == 0);
+    test(!grid.cells);
+    test(!grid.rows);
+}
+
+TEST_CASE(MazeGridLayouts)
+{
+    for (Maze_Layout layout = Maze_Layout_RowMajor; layout <= Maze_Layout_Morton; ++layout) {
+        Maze_Grid grid = { .num_rows = 13, .num_columns = 21, .layout = layout };
         Maze_InitGrid(&grid);
-        test(grid.cells != NULL);
-        test(grid.rows != NULL);
+        test((grid.rows != NULL) == (layout == Maze_Layout_RowMajor));
+        test(Maze_GridStorage(&grid) == (layout == Maze_Layout_RowMajor? 13*21: 16*24));
+
+        _Bool placed = true, neighbors = true;
+        size_t real_cells = 0;
         for (int r = 0; r < grid.num_rows; ++r) {
             for (int c = 0; c < grid.num_columns; ++c) {
-                test(grid.rows[r][c].row == r);
-                test(grid.rows[r][c].column == c);
+                Maze_Cell *cell = Maze_GridCellAt(&grid, r, c);
+                placed = placed && cell->row == r && cell->column == c;
+                Maze_Cell *south = Maze_GoSouth(&grid, cell), *west = Maze_GoWest(&grid, cell);
+                neighbors = neighbors && (r == 12? !south: south->row == r+1 && south->column == c);
+                neighbors = neighbors && (c == 0? !west: west->row == r && west->column == c-1);
+                neighbors = neighbors && (r == 0 || Maze_GoNorth(&grid, south? south: cell) != NULL);
             }
         }
+        for (size_t i = 0; i < Maze_GridStorage(&grid); ++i)  real_cells += grid.cells[i].row >= 0;
+        test(placed);
+        test(neighbors);
+        test(real_cells == 13*21);
+        test(Maze_GridCellAt(&grid, 13, 0) == NULL);
+        test(Maze_GoEast(&grid, Maze_GridCellAt(&grid, 3, 20)) == NULL);
 
-        test(Maze_GridCellAt(&grid,  0,  0));
-        test(Maze_GridCellAt(&grid,  5,  5));
-        test(Maze_GridCellAt(&grid,  9, 19));
-        test(Maze_GridCellAt(&grid, -1,  0) == NULL);
-        test(Maze_GridCellAt(&grid,  0, -1) == NULL);
-        test(Maze_GridCellAt(&grid, 10, 19) == NULL);
-        test(Maze_GridCellAt(&grid,  9, 20) == NULL);
+        Maze_DisposeGrid(&grid);
+    }
 
-        test(Maze_CountGridCells(&grid) == 200);
+    Maze_Grid grid = { .num_rows = 16, .num_columns = 16, .layout = Maze_Layout_Morton };
+    Maze_InitGrid(&grid);
+    test(Maze_GridCellIndex(&grid, 0, 1) == 1);
+    test(Maze_GridCellIndex(&grid, 1, 0) == 2);
+    test(Maze_GridCellIndex(&grid, 1, 1) == 3);
+    test(Maze_GridCellIndex(&grid, 7, 7) == 63);
+    test(Maze_GridCellIndex(&grid, 0, 8) == 64);
+    test(Maze_GridCellIndex(&grid, 8, 0) == 128);
+    Maze_DisposeGrid(&grid);
+}
 
-        Maze_Cell *cell = Maze_GridCellAt(&grid, 5,5);
-        Maze_Cell *north_cell = Maze_GoNorth(&grid, cell);
-        test(north_cell->row == 4 && north_cell->column == 5);
+TEST_CASE(MazeCompactGrid)
+{
+    Maze_CompactGrid grid = { .num_rows = 10, .num_columns = 21 };
+    Maze_InitCompactGrid(&grid);
+    test(grid.passages != NULL);
+    test(grid.row_bytes == 6);
+    test(Maze_CompactCellBits(&grid, 9, 20) == 0);
+
+    Maze_CompactLinkCells(&grid, 5, 5, Maze_Dir_North);
+    test(Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_North));
+    test(Maze_CompactIsLinked(&grid, 4, 5, Maze_Dir_South));
+    test(!Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_East));
+    test(Maze_CompactCellBits(&grid, 5, 5) == Maze_Passage_North);
+
+    Maze_CompactLinkCells(&grid, 5, 5, Maze_Dir_West);
+    test(Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_West));
+    test(Maze_CompactIsLinked(&grid, 5, 4, Maze_Dir_East));
+    test(Maze_CompactCellBits(&grid, 5, 4) == Maze_Passage_East);
+
+    Maze_CompactLinkCells(&grid, 5, 5, Maze_Dir_South);
+    test(Maze_CompactIsLinked(&grid, 6, 5, Maze_Dir_North));
+
+    Maze_CompactUnlinkCells(&grid, 4, 5, Maze_Dir_South);
+    test(!Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_North));
+    test(Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_West));
+    test(Maze_CompactIsLinked(&grid, 5, 5, Maze_Dir_South));
+
+    test(!Maze_CompactIsLinked(&grid, 0, 0, Maze_Dir_North));
+    test(!Maze_CompactIsLinked(&grid, 9, 20, Maze_Dir_East));
+
+    int row = 5, col = 5;
+    test(Maze_CompactGoNorth(&grid, &row, &col) && row == 4 && col == 5);
+    test(Maze_CompactGoEast(&grid, &row, &col) && row == 4 && col == 6);
+    test(Maze_CompactGoSouth(&grid, &row, &col) && row == 5 && col == 6);
+    test(Maze_CompactGoWest(&grid, &row, &col) && row == 5 && col == 5);
+
+    row = 0, col = 20;
+    test(!Maze_CompactGoNorth(&grid, &row, &col));
+    test(!Maze_CompactGoEast(&grid, &row, &col));
+    test(row == 0 && col == 20);
+
+    Maze_DisposeCompactGrid(&grid);
+    test(grid.num_rows == 0);
+    test(!grid.passages);
+}
+
+TEST_CASE(ParallelGenerators)
+{
+    typedef ErrorCode (*Generator)(Maze_CompactGrid *, uint64_t, int);
+    Generator generators[] = { Maze_BinaryTree, Maze_Sidewinder };
+
+    for (size_t g = 0; g < array_length(generators); ++g) {
+        Maze_CompactGrid grids[3];
+        int threads[] = { 1, 4, 0 };
+        for (int i = 0; i < 3; ++i) {
+            grids[i] = (Maze_CompactGrid){ .num_rows = 150, .num_columns = 37 };
+            Maze_InitCompactGrid(&grids[i]);
+            test(generators[g](&grids[i], 12314, threads[i]) == ErrorCode_OK);
+        }
 
-        Maze_Cell *east_cell = Maze_GoEast(&grid, cell);
-        test(east_cell->row == 5 && east_cell->column == 6);
+        size_t bytes = grids[0].row_bytes * grids[0].num_rows;
+        test(IsPerfectMaze(&grids[0]));
+        test(!memcmp(grids[0].passages, grids[1].passages, bytes));
+        test(!memcmp(grids[0].passages, grids[2].passages, bytes));
 
-        Maze_Cell *top_right_cell = Maze_GridCellAt(&grid, 0, 19);
-        test(NULL == Maze_GoNorth(&grid, top_right_cell));
-        test(NULL == Maze_GoEast(&grid, top_right_cell));
+        test(generators[g](&grids[1], 12315, 4) == ErrorCode_OK);
+        test(IsPerfectMaze(&grids[1]));
+        test(memcmp(grids[0].passages, grids[1].passages, bytes) != 0);
 
-        int row_count = 0;
-        Maze_ForEachGridRow(&grid, TestForEachGridRow, &row_count);
-        test(row_count == 45); // 0 + 1 + ... + 9
+        for (int i = 0; i < 3; ++i)  Maze_DisposeCompactGrid(&grids[i]);
+    }
 
-        Maze_DisposeGrid(&grid);
-        test(grid.num_rows == 0);
-        test(grid.num_columns == 0);
-        test(!grid.cells);
-        test(!grid.rows);
+    Maze_CompactGrid line = { .num_rows = 1, .num_columns = 5 };
+    Maze_InitCompactGrid(&line);
+    Maze_Sidewinder(&line, 1, 1);
+    test(IsPerfectMaze(&line));
+    Maze_DisposeCompactGrid(&line);
+
+    Maze_CompactGrid column = { .num_rows = 70, .num_columns = 1 };
+    Maze_InitCompactGrid(&column);
+    Maze_BinaryTree(&column, 1, 2);
+    test(IsPerfectMaze(&column));
+    Maze_DisposeCompactGrid(&column);
+}
+
+TEST_CASE(StreamingGeneration)
+{
+    Maze_CompactGrid grid   = { .num_rows = 150, .num_columns = 37 };
+    Maze_CompactGrid stream = { .num_rows = 150, .num_columns = 37 };
+    Maze_InitCompactGrid(&grid);
+    Maze_InitCompactGrid(&stream);
+    size_t bytes = grid.row_bytes * grid.num_rows;
+    Maze_RowSink to_stream = { Maze_CopyRowToGrid, &stream };
+
+    Maze_BinaryTree(&grid, 99, 2);
+    test(Maze_StreamMaze(Maze_Algorithm_BinaryTree, 150, 37, 99, to_stream) == ErrorCode_OK);
+    test(!memcmp(grid.passages, stream.passages, bytes));
+
+    Maze_Sidewinder(&grid, 99, 2);
+    test(Maze_StreamMaze(Maze_Algorithm_Sidewinder, 150, 37, 99, to_stream) == ErrorCode_OK);
+    test(!memcmp(grid.passages, stream.passages, bytes));
+
+    test(Maze_StreamMaze(Maze_Algorithm_Eller, 150, 37, 99, to_stream) == ErrorCode_OK);
+    test(IsPerfectMaze(&stream));
+    test(Maze_Eller(&grid, 99) == ErrorCode_OK);
+    test(!memcmp(grid.passages, stream.passages, bytes));
+    test(Maze_Eller(&grid, 100) == ErrorCode_OK);
+    test(IsPerfectMaze(&grid));
+
+    Maze_DisposeCompactGrid(&grid);
+    Maze_DisposeCompactGrid(&stream);
+
+    Maze_CompactGrid shapes[] = { { .num_rows = 1, .num_columns = 9 }, { .num_rows = 9, .num_columns = 1 }, { .num_rows = 2, .num_columns = 2 } };
+    for (size_t i = 0; i < array_length(shapes); ++i) {
+        Maze_InitCompactGrid(&shapes[i]);
+        Maze_Eller(&shapes[i], 5);
+        test(IsPerfectMaze(&shapes[i]));
+        Maze_DisposeCompactGrid(&shapes[i]);
+    }
+
+    FILE *file = tmpfile();
+    test(Maze_StreamMaze(Maze_Algorithm_Eller, 1000, 101, 7, (Maze_RowSink){ Maze_WriteRowToFile, file }) == ErrorCode_OK);
+    test(ftell(file) == 1000 * 26);
+    fclose(file);
+
+    int rows_sent = 0;
+    test(Maze_StreamMaze(Maze_Algorithm_Sidewinder, 10, 10, 7, (Maze_RowSink){ TestFailingRowSink, &rows_sent }) == ErrorCode_Failure);
+    test(rows_sent == 4);
+
+    test(!strcmp(Maze_AlgorithmName(Maze_Algorithm_Sidewinder), "Sidewinder"));
+}
+
+TEST_CASE(RandomWalkGenerators)
+{
+    test(Maze_AlgorithmFromName("Wilson") == Maze_Algorithm_Wilson);
+    test(Maze_AlgorithmFromName("Prim") == Maze_Algorithm_End);
+
+    for (Maze_Algorithm algorithm = Maze_Algorithm_First; algorithm < Maze_Algorithm_End; ++algorithm) {
+        Maze_CompactGrid grid = { .num_rows = 43, .num_columns = 57 };
+        Maze_InitCompactGrid(&grid);
+        memset(grid.passages, 0xFF, grid.row_bytes * grid.num_rows);
+
+        Maze_GenStats stats;
+        test(Maze_Generate(&grid, algorithm, 12314, 2, &stats) == ErrorCode_OK);
+        test(IsPerfectMaze(&grid));
+        test(stats.cells == 43 * 57);
+        test(stats.seconds >= 0);
+
+        size_t bytes = grid.row_bytes * grid.num_rows;
+        uint8_t *first = malloc(bytes);
+        memcpy(first, grid.passages, bytes);
+        Maze_Generate(&grid, algorithm, 12314, 1, NULL);
+        test(!memcmp(first, grid.passages, bytes));
+
+        free(first);
+        Maze_DisposeCompactGrid(&grid);
+    }
+
+    Maze_CompactGrid grid = { .num_rows = 30, .num_columns = 30 };
+    Maze_InitCompactGrid(&grid);
+    Maze_GenStats stats;
+    Maze_Backtracker(&grid, 1, &stats);
+    test(stats.steps == 899);
+    Maze_AldousBroder(&grid, 1, &stats);
+    test(stats.steps >= 899);
+    Maze_Wilson(&grid, 1, &stats);
+    test(stats.steps >= 1);
+    Maze_DisposeCompactGrid(&grid);
+}
+
+TEST_CASE(Distances)
+{
+    Maze_CompactGrid grid = { .num_rows = 37, .num_columns = 130 };
+    Maze_InitCompactGrid(&grid);
+    size_t num_cells = 37 * 130;
+    uint32_t *distances = malloc(num_cells * sizeof(uint32_t));
+    uint32_t *hybrid    = malloc(num_cells * sizeof(uint32_t));
+    uint32_t source = 0, farthest = 0, hybrid_farthest = 0;
+
+    // Open grid: Manhattan distance, searched mostly bottom-up
+    memset(grid.passages, 0xFF, grid.row_bytes * grid.num_rows);
+    test(Maze_Distances(&grid, &source, 1, distances, &farthest) == ErrorCode_OK);
+    test(Maze_DistancesHybrid(&grid, &source, 1, hybrid, &hybrid_farthest) == ErrorCode_OK);
+    test(farthest == num_cells - 1);
+    test(hybrid_farthest == num_cells - 1);
+    test(!memcmp(distances, hybrid, num_cells * sizeof(uint32_t)));
+    test(distances[5 * 130 + 100] == 105);
+
+    uint32_t corners[] = { 0, num_cells - 1 };
+    Maze_DistancesHybrid(&grid, corners, 2, hybrid, &hybrid_farthest);
+    test(hybrid[num_cells - 2] == 1);
+    test(hybrid[hybrid_farthest] == (36 + 129) / 2);
+
+    // Closed grid: nothing reachable but the source
+    memset(grid.passages, 0, grid.row_bytes * grid.num_rows);
+    source = 200;
+    Maze_DistancesHybrid(&grid, &source, 1, hybrid, &hybrid_farthest);
+    test(hybrid[200] == 0 && hybrid[201] == Maze_Unreached && hybrid_farthest == 200);
+
+    // Many sources start bottom-up and switch back to the queue
+    uint32_t sources[300];
+    for (uint32_t i = 0; i < 300; ++i)  sources[i] = i * 16;
+
+    for (Maze_Algorithm algorithm = Maze_Algorithm_First; algorithm < Maze_Algorithm_End; ++algorithm) {
+        Maze_Generate(&grid, algorithm, 99, 1, NULL);
+        Maze_Distances(&grid, sources, 300, distances, &farthest);
+        Maze_DistancesHybrid(&grid, sources, 300, hybrid, &hybrid_farthest);
+        test(!memcmp(distances, hybrid, num_cells * sizeof(uint32_t)));
+        test(distances[farthest] == hybrid[hybrid_farthest]);
+
+        uint32_t from, to, length;
+        test(Maze_LongestPath(&grid, &from, &to, &length) == ErrorCode_OK);
+        Maze_Distances(&grid, &to, 1, distances, &farthest);
+        test(distances[from] == length);
+        test(distances[farthest] == length);
+    }
+
+    free(distances);
+    free(hybrid);
+    Maze_DisposeCompactGrid(&grid);
+}
+
+TEST_CASE(PathFinding)
+{
+    Maze_CompactGrid grid = { .num_rows = 40, .num_columns = 50 };
+    Maze_InitCompactGrid(&grid);
+    Maze_Generate(&grid, Maze_Algorithm_Wilson, 5, 1, NULL);
+
+    Maze_PathFinder finder;
+    test(Maze_InitPathFinder(&finder, &grid) == ErrorCode_OK);
+    uint32_t *distances = malloc(40 * 50 * sizeof(uint32_t));
+    Maze_Path *path = NULL;
+
+    Xoshiro256 rng;
+    Xoshiro256_Init(&rng, 3);
+    _Bool shortest = true, connected = true;
+    for (int query = 0; query < 50; ++query) {
+        uint32_t from = (uint32_t)Xoshiro256_RandBelow(&rng, 40 * 50);
+        uint32_t to   = (uint32_t)Xoshiro256_RandBelow(&rng, 40 * 50);
+        Maze_Distances(&grid, &from, 1, distances, NULL);
+        if (Maze_FindPath(&finder, from, to, &path) != ErrorCode_OK)  shortest = false;
+        shortest = shortest && length(path) == distances[to] + 1 && path->begin[0] == from && path->begin[length(path)-1] == to;
+
+        for (size_t i = 1; i < length(path); ++i) {
+            int row = (int)(path->begin[i-1] / 50), col = (int)(path->begin[i-1] % 50);
+            uint32_t next = path->begin[i];
+            connected = connected && ((next + 50 == path->begin[i-1] && Maze_CompactIsLinked(&grid, row, col, Maze_Dir_North))
+                                   || (next == path->begin[i-1] + 50 && Maze_CompactIsLinked(&grid, row, col, Maze_Dir_South))
+                                   || (next == path->begin[i-1] + 1  && Maze_CompactIsLinked(&grid, row, col, Maze_Dir_East))
+                                   || (next + 1 == path->begin[i-1]  && Maze_CompactIsLinked(&grid, row, col, Maze_Dir_West)));
+        }
+    }
+    test(shortest);
+    test(connected);
+
+    // Open grid: A* walks straight to the goal
+    memset(grid.passages, 0xFF, grid.row_bytes * grid.num_rows);
+    test(Maze_FindPath(&finder, 0, 40 * 50 - 1, &path) == ErrorCode_OK);
+    test(length(path) == 40 + 50 - 1);
+    test(finder.expanded == 40 + 50 - 2);
+
+    Maze_CompactUnlinkCells(&grid, 0, 0, Maze_Dir_East);
+    Maze_CompactUnlinkCells(&grid, 0, 0, Maze_Dir_South);
+    test(Maze_FindPath(&finder, 0, 1, &path) == ErrorCode_Failure);
+    test(is_empty(path));
+    test(Maze_FindPath(&finder, 7, 7, &path) == ErrorCode_OK);
+    test(length(path) == 1);
+
+    Dynarray_Dispose(path);
+    free(distances);
+    Maze_DisposePathFinder(&finder);
+    Maze_DisposeCompactGrid(&grid);
+}
+
+TEST_CASE(Rasterizing)
+{
+    // Two cells joined east-west above two cells joined north-south
+    // on the right:  +--+--+
+    //                |     |
+    //                +--+  +
+    //                |  |  |
+    //                +--+--+
+    Maze_CompactGrid grid = { .num_rows = 2, .num_columns = 2 };
+    Maze_InitCompactGrid(&grid);
+    Maze_CompactLinkCells(&grid, 0, 0, Maze_Dir_East);
+    Maze_CompactLinkCells(&grid, 1, 1, Maze_Dir_North);
+
+    int width, height;
+    Maze_RasterSize(&grid, 4, 1, &width, &height);
+    test(width == 11 && height == 11);
+
+    Kwr_Image gray = { .width = width, .height = height, .channels = 1 };
+    Kwr_Image rgba = { .width = width, .height = height, .channels = 4 };
+    Kwr_InitImage(&gray);
+    Kwr_InitImage(&rgba);
+    test(Maze_Rasterize(&grid, &gray, 4, 1, 1) == ErrorCode_OK);
+    test(Maze_Rasterize(&grid, &rgba, 4, 1, 2) == ErrorCode_OK);
+
+#define PIXEL(x_, y_)  Kwr_ImageRow(&gray, (y_))[(x_)]
+    test(PIXEL(0, 0) == 0 && PIXEL(1, 0) == 0 && PIXEL(0, 1) == 0);   // margin
+    test(PIXEL(1, 1) == 255 && PIXEL(9, 1) == 255);                   // top border
+    test(PIXEL(5, 3) == 0);                                            // no wall between the top cells
+    test(PIXEL(1, 3) == 255 && PIXEL(9, 3) == 255);                   // side borders
+    test(PIXEL(3, 5) == 255 && PIXEL(5, 5) == 255 && PIXEL(7, 5) == 0); // wall under the left cell only
+    test(PIXEL(5, 7) == 255);                                          // wall between the bottom cells
+    test(PIXEL(3, 7) == 0 && PIXEL(7, 7) == 0);                        // cell insides
+    test(PIXEL(9, 9) == 255 && PIXEL(10, 10) == 0);                    // bottom right corner, margin
+#undef PIXEL
+
+    _Bool same = true;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const uint8_t *p = Kwr_ImageRow(&rgba, y) + 4*x;
+            same = same && p[0] == Kwr_ImageRow(&gray, y)[x] && p[1] == p[0] && p[2] == p[0] && p[3] == 255;
+        }
+    }
+    test(same);
+
+    Kwr_DisposeImage(&gray);
+    Kwr_DisposeImage(&rgba);
+    Maze_DisposeCompactGrid(&grid);
+
+    // Bands drawn in parallel match one pass
+    grid = (Maze_CompactGrid){ .num_rows = 2 * Maze_BandRows + 5, .num_columns = 30 };
+    Maze_InitCompactGrid(&grid);
+    Maze_Generate(&grid, Maze_Algorithm_Backtracker, 8, 1, NULL);
+    Maze_RasterSize(&grid, 3, 0, &width, &height);
+    Kwr_Image one  = { .width = width, .height = height, .channels = 1 };
+    Kwr_Image many = { .width = width, .height = height, .channels = 1 };
+    Kwr_InitImage(&one);
+    Kwr_InitImage(&many);
+    Maze_Rasterize(&grid, &one, 3, 0, 1);
+    Maze_Rasterize(&grid, &many, 3, 0, 4);
+    test(!memcmp(one.pixels, many.pixels, one.stride * one.height));
+
+    size_t wall_pixels = 0;
+    for (size_t i = 0; i < one.stride * one.height; ++i)  wall_pixels += one.pixels[i] == 255;
+    test(wall_pixels > 0 && wall_pixels < one.stride * one.height);
+
+    Kwr_DisposeImage(&one);
+    Kwr_DisposeImage(&many);
+    Maze_DisposeCompactGrid(&grid);
+}
+
+TEST_CASE(MazeFiles)
+{
+    char path[32];
+    TestTempPath(path);
+    Maze_CompactGrid grid = { .num_rows = 37, .num_columns = 45 };
+    Maze_InitCompactGrid(&grid);
+    Maze_Generate(&grid, Maze_Algorithm_Wilson, 77, 1, NULL);
+    test(Maze_SaveMaze(&grid, path, Maze_Algorithm_Wilson, 77) == ErrorCode_OK);
+
+    Maze_CompactGrid loaded = {0};
+    Maze_FileHeader header;
+    test(Maze_LoadMaze(&loaded, path, &header) == ErrorCode_OK);
+    test(loaded.num_rows == 37 && loaded.num_columns == 45 && loaded.row_bytes == grid.row_bytes);
+    test(header.algorithm == Maze_Algorithm_Wilson && header.seed == 77);
+    test(header.payload_offset % Maze_FilePayloadAlign == 0);
+    test((uint8_t *)loaded.passages - (uint8_t *)loaded.mapping == Maze_FilePayloadAlign);
+    test(!memcmp(loaded.passages, grid.passages, grid.row_bytes * grid.num_rows));
+    test(IsPerfectMaze(&loaded));
+
+    // Loaded grids are copy-on-write
+    Maze_CompactUnlinkCells(&loaded, 0, 0, Maze_Dir_East);
+    Maze_CompactLinkCells(&loaded, 0, 0, Maze_Dir_East);
+    Maze_DisposeCompactGrid(&loaded);
+    test(!loaded.mapping && !loaded.passages);
+
+    // Streamed straight to the file
+    Maze_FileWriter writer;
+    test(Maze_OpenFileWriter(&writer, path, Maze_Algorithm_Sidewinder, 37, 45, 5) == ErrorCode_OK);
+    test(Maze_StreamMaze(Maze_Algorithm_Sidewinder, 37, 45, 5, (Maze_RowSink){ Maze_FileWriterPutRow, &writer }) == ErrorCode_OK);
+    test(Maze_CloseFileWriter(&writer) == ErrorCode_OK);
+    Maze_Sidewinder(&grid, 5, 1);
+    test(Maze_LoadMaze(&loaded, path, NULL) == ErrorCode_OK);
+    test(!memcmp(loaded.passages, grid.passages, grid.row_bytes * grid.num_rows));
+    Maze_DisposeCompactGrid(&loaded);
+
+    test(Maze_OpenFileWriter(&writer, path, Maze_Algorithm_Sidewinder, 37, 45, 5) == ErrorCode_OK);
+    Maze_FileWriterPutRow(&writer, 0, grid.passages, grid.row_bytes);
+    test(Maze_CloseFileWriter(&writer) == ErrorCode_Failure);
+    test(Maze_LoadMaze(&loaded, path, NULL) == ErrorCode_Failure);   // truncated
+    test(!loaded.passages);
+
+    FILE *file = fopen(path, "wb");
+    fputs("not a maze", file);
+    fclose(file);
+    test(Maze_LoadMaze(&loaded, path, NULL) == ErrorCode_Failure);
+    remove(path);
+    test(Maze_LoadMaze(&loaded, path, NULL) == ErrorCode_Error);
+
+    Maze_DisposeCompactGrid(&grid);
+}
+
+
+//------------------------------------------------------------
+//# Test Runner
+//
+// Cases run in parallel on worker threads, each with its own counters
+// and wall-clock time.  A case running past its time limit fails; one
+// still running well past it is taken to hang, and the watchdog stops
+// the whole run.  Failures print as they happen, prefixed by the case.
+//
+// usage: test [-threads n] [-filter name] [-slowest n]
+
+// name, time limit in seconds
+#define TEST_CASES_X_TABLE \
+  X(TypeIds,              1) \
+  X(TupleMacro,           1) \
+  X(Dynarray,             1) \
+  X(DynarrayGrowth,       5) \
+  X(MappedDynarray,       5) \
+  X(AllocStats,           1) \
+  X(Arena,                5) \
+  X(Pool,                 5) \
+  X(HashMaps,             5) \
+  X(Formatting,           1) \
+  X(Logging,              1) \
+  X(Clock,                1) \
+  X(Profiling,            1) \
+  X(XorShiftFill,         5) \
+  X(Xoshiro256,           5) \
+  X(BoundedRandom,        5) \
+  X(PriorityQueue,        1) \
+  X(Images,               1) \
+  X(MazeCells,            1) \
+  X(MazeGrid,             1) \
+  X(MazeGridLayouts,      1) \
+  X(MazeCompactGrid,      1) \
+  X(ParallelGenerators,  20) \
+  X(StreamingGeneration,  5) \
+  X(RandomWalkGenerators,10) \
+  X(Distances,            5) \
+  X(PathFinding,          5) \
+  X(Rasterizing,          5) \
+  X(MazeFiles,            5)
+
+#define TEST_HANG_FACTOR  4   // watchdog stops a case at this many time limits
+
+typedef void (*Test_CaseFn)(Test_Runner *runner);
+
+typedef struct Test_Case {
+    const char   *name;
+    Test_CaseFn   fn;
+    double        time_limit;
+    Test_Runner   runner;
+    double        seconds;
+    atomic_uint_least64_t started;   // ns, 0 until started
+    atomic_bool   finished;
+} Test_Case;
+
+typedef struct Test_Suite {
+    Test_Case   *cases;
+    size_t       num_cases;
+    atomic_bool  done;
+} Test_Suite;
+
+Test_Runner Test_MakeRunner(const char *case_name)
+{
+    return (Test_Runner){ .failure_count = 0, .test_count = 0, .case_name = case_name };
+}
+
+static void Test_RunCase(void *data, size_t index)
+{
+    Test_Suite *suite = data;
+    Test_Case *test_case = &suite->cases[index];
+
+    uint64_t start = Kwr_ClockNow();
+    atomic_store(&test_case->started, start);
+    test_case->fn(&test_case->runner);
+    test_case->seconds = (Kwr_ClockNow() - start) * 1e-9;
+    atomic_store(&test_case->finished, true);
+
+    if (test_case->seconds > test_case->time_limit) {
+        printf("[%s] took %.2f s, over its %.1f s time limit\n", test_case->name, test_case->seconds, test_case->time_limit);
+        ++test_case->runner.failure_count;
     }
+}
 
+static void *Test_Watchdog(void *data)
+{
+    Test_Suite *suite = data;
+    while (!atomic_load(&suite->done)) {
+        uint64_t now = Kwr_ClockNow();
+        for (size_t i = 0; i < suite->num_cases; ++i) {
+            Test_Case *test_case = &suite->cases[i];
+            uint64_t started = atomic_load(&test_case->started);
+            if (!started || atomic_load(&test_case->finished))  continue;
+
+            if ((now - started) * 1e-9 > test_case->time_limit * TEST_HANG_FACTOR) {
+                printf("[%s] still running after %.1f s, stopping the tests\n", test_case->name, (now - started) * 1e-9);
+                fflush(stdout);
+                _Exit(EXIT_FAILURE);
+            }
+        }
+        nanosleep(&(struct timespec){ .tv_nsec = 20 * 1000000 }, NULL);
+    }
+    return NULL;
 }
 
-Test_Runner Test_MakeRunner()
+static int Test_CompareSlowest(const void *a, const void *b)
 {
-    return (Test_Runner){ .failure_count = 0, .test_count = 0 };
+    double x = ((const Test_Case *)a)->seconds, y = ((const Test_Case *)b)->seconds;
+    return (x < y) - (x > y);
 }
 
 int main(int argc, char *argv[])
 {
-    UNUSED(argc);
-    UNUSED(argv);
+    int num_threads = 0, num_slowest = 5;
+    const char *filter = NULL;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (!strcmp(argv[i], "-threads"))  num_threads = atoi(argv[i+1]);
+        else if (!strcmp(argv[i], "-filter"))   filter      = argv[i+1];
+        else if (!strcmp(argv[i], "-slowest"))  num_slowest = atoi(argv[i+1]);
+    }
+
+#define X(Name, limit)  { .name = #Name, .fn = Test_##Name, .time_limit = (limit) },
+    static Test_Case all_cases[] = { TEST_CASES_X_TABLE };
+#undef X
+
+    Test_Suite suite = { .cases = all_cases };
+    for (size_t i = 0; i < array_length(all_cases); ++i) {
+        if (filter && !strstr(all_cases[i].name, filter))  continue;
+        Test_Case *test_case = &all_cases[suite.num_cases++];
+        *test_case = all_cases[i];
+        test_case->runner = Test_MakeRunner(test_case->name);
+    }
 
     printf("Testing...\n");
 
-    Test_Runner runner = Test_MakeRunner(); 
+    pthread_t watchdog;
+    _Bool watching = !pthread_create(&watchdog, NULL, Test_Watchdog, &suite);
+    uint64_t start = Kwr_ClockNow();
+    if (suite.num_cases)  Kwr_ParallelFor(suite.num_cases, num_threads, Test_RunCase, &suite);
+    double seconds = (Kwr_ClockNow() - start) * 1e-9;
+    atomic_store(&suite.done, true);
+    if (watching)  pthread_join(watchdog, NULL);
+
+    Test_Runner total = Test_MakeRunner("all");
+    for (size_t i = 0; i < suite.num_cases; ++i) {
+        total.failure_count += suite.cases[i].runner.failure_count;
+        total.test_count    += suite.cases[i].runner.test_count;
+    }
 
-    RunTests(&runner);
+    qsort(suite.cases, suite.num_cases, sizeof(Test_Case), Test_CompareSlowest);
+    if (num_slowest > 0 && suite.num_cases) {
+        printf("Slowest of %zu cases (%.2f s in all):\n", suite.num_cases, seconds);
+        for (size_t i = 0; i < suite.num_cases && i < (size_t)num_slowest; ++i) {
+            printf("  %8.3f s  %s\n", suite.cases[i].seconds, suite.cases[i].name);
+        }
+    }
 
-    if (runner.failure_count) {
-        printf("UH OH!  %d test failure%c\n", runner.failure_count, (char[]){' ','s'}[runner.failure_count > 1]);
+    if (total.failure_count) {
+        printf("UH OH!  %d test failure%c\n", total.failure_count, (char[]){' ','s'}[total.failure_count > 1]);
     }
     else {
-        printf("All good!  %d tests passed.\n", runner.test_count);
+        printf("All good!  %d tests passed.\n", total.test_count);
     }
 
-    return runner.failure_count;
+    return total.failure_count;
 }
-